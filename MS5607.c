@@ -29,8 +29,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
 #include "PiSPI.h"
+#include "spibus.h"
+#include "seqlock.h"
+#include "realtime.h"
+#include "star_common.h"
+#include "sim.h"
+#include "MS5607.h"
 
 // Definitions to support MS5607 altimeter
 static const unsigned int F_CPU = 4000000; // 4MHz XTAL
@@ -47,10 +59,113 @@ static const char CMD_ADC_4096 = 0x08;     // ADC OSR=4096
 static const char CMD_PROM_RD = 0xA0;      // Prom read command
 
 static const int CHANNEL = 0;              // SPI channel
+static struct spi_device altDev = { 0, -1, 0, 0, 8, 0 };
+static struct spi_bus *altBus = NULL;      // Shared with other devices, see altimeterSetBus()
+static unsigned long long altReady = 0;    // Not ready for commands before this, CLOCK_MONOTONIC
 
 volatile unsigned int C[8];                // Altimeter calibration coefficients
+
+// Calibration terms that don't change from sample to sample, worked
+// out once by precomputeCoefficients()
+static struct {
+  int64_t SENS_T1;              // C1 * 2^16
+  int64_t OFF_T1;               // C2 * 2^17
+  int64_t TCS;                  // C3
+  int64_t TCO;                  // C4
+  int64_t T_REF;                // C5 * 2^8
+  int64_t TEMPSENS;             // C6
+} K;
 volatile float QFF;                        // QFF pressure at sea level, mbar
 
+static struct altimeter_sample latest;     // Newest sample from altimeterThread()
+static struct seqlock latestLock;          // Lets readers copy latest without blocking
+static volatile bool samplerRunning;       // Signals altimeterThread() to exit
+static pthread_t samplerId;                // altimeterThread(), so it can be joined
+
+// Whether altimeterThread() still has to read the PROM and check it
+// against the calibration already in use, and how that went
+static bool verifyPending = false;
+static atomic_int promStatus = ALT_PROM_UNCHECKED;
+
+// Acquisition profiles for each flight phase.  Fast, coarse pressure
+// while the altitude is changing quickly, slow and fine when it isn't.
+// Temperature changes slowly, so it is only read every few samples.
+const struct altimeter_profile altimeterProfiles[ALT_PROFILES] = {
+  //  name       P OSR  T OSR  rate  T every
+  { "ground",    4096,  4096,   1.0,  5 },
+  { "ascent",     512,  1024,  10.0, 10 },
+  { "float",     4096,  4096,   1.0, 10 },
+  { "descent",    256,  1024,  10.0, 10 }
+};
+
+static struct altimeter_profile profile;   // Profile altimeterThread() is using
+pthread_mutex_t lock_profile;              // Prevent a race condition involving profile read/write
+
+// Where readings come from, see altimeterSetSource()
+static int altSource = ALT_SOURCE_SPI;
+static char simCmd = 0;                    // Conversion the simulator is "running"
+
+// Calibration the simulator pretends to have, from the data sheet example
+static const unsigned int simPROM[8] = { 0, 46372, 43981, 29059, 27842, 31553, 28165, 0 };
+
+/*
+ * altimeterSetSource(): Read a real MS5607 (ALT_SOURCE_SPI) or the
+ *                       simulator (ALT_SOURCE_SIM).  Only before
+ *                       altimeterSetup().
+ *****************************************************************************
+ */
+
+void altimeterSetSource(int source) {
+  altSource = source;
+}
+
+/*
+ * simADC(): What the simulator reads for a conversion command
+ *****************************************************************************
+ */
+
+static unsigned long simADC(char cmd) {
+  unsigned long T, P;
+
+  simAltimeter(&T, &P);
+  return ((cmd & CMD_ADC_D2) == CMD_ADC_D2) ? T : P;
+}
+
+/*
+ * nowNS: The current CLOCK_MONOTONIC time, nanoseconds
+ *****************************************************************************
+ */
+
+static unsigned long long nowNS(void) {
+  struct timespec tim;
+
+  clock_gettime(CLOCK_MONOTONIC, &tim);
+
+  return tim.tv_sec * 1000000000ULL + tim.tv_nsec;
+}
+
+/*
+ * altimeterSetBus(): Share the SPI bus with other devices.  From then on
+ *                    every message goes through the bus thread, so none
+ *                    of them can get in the way of the others.  Without
+ *                    one, messages go straight out.
+ *****************************************************************************
+ */
+
+void altimeterSetBus(struct spi_bus *bus) {
+  altBus = bus;
+}
+
+/*
+ * altTransfer(): Send an SPI message to the altimeter no earlier than
+ *                dueNS, or altReady if that's later
+ *****************************************************************************
+ */
+
+static int altTransfer(struct spi_segment *segs, int n, unsigned long long dueNS) {
+  return spiBusTransfer(altBus, &altDev, segs, n, (dueNS > altReady) ? dueNS : altReady);
+}
+
 /*
  * altimeterInit(): Initialize the altimeter
  *                  Returns the Linux file-descriptor for the device
@@ -59,20 +174,36 @@ volatile float QFF;                        // QFF pressure at sea level, mbar
  */
 
 int altimeterInit(void) {
-  return SPISetup(CHANNEL, F_CPU, 3);  // Set up the SPI channel
+  if (altSource == ALT_SOURCE_SIM)
+    return 0;
+
+  // Set up the SPI channel
+  if (SPIOpen(&altDev, CHANNEL, F_CPU, 3) < 0)
+    return -1;
+
+  return altDev.fd;
 }
 
 /*
- * altimeterReset(): Reset the altimeter
+ * altimeterReset(): Reset the altimeter.  The PROM takes 3ms to reload,
+ *                   and nothing more is sent to the altimeter until it
+ *                   has, but the bus is free for others in the meantime.
  *****************************************************************************
  */
 
 int altimeterReset(void) {
   unsigned char buffer[1] = {0};
+  struct spi_segment seg = { buffer, 1, 0, false };
+  int result;
 
-  SPISetDelay(3000);                     // Set a 3ms read/write delay
-  buffer[0] = CMD_RESET;                 // Put the reset command in the buffer
-  return SPIDataRW(CHANNEL, buffer, 1);  // Send the command
+  if (altSource == ALT_SOURCE_SIM)
+    return 0;
+
+  buffer[0] = CMD_RESET;                       // Put the reset command in the buffer
+  result = altTransfer(&seg, 1, 0);            // Send the command
+  altReady = nowNS() + 3000000ULL;             // 3ms to reload PROM
+
+  return result;
 }
 
 /*
@@ -108,16 +239,16 @@ void getAltimeterCalibration(int C_copy[]) {
 
 unsigned int readAltimeterCalibration(char coeffNum) {
   unsigned char buffer[5] = {0};
+  struct spi_segment seg = { buffer, 3, 500, false };  // 0.5ms read/write delay
   unsigned int rC = 0;
 
   coeffNum &= 7;     // Enforce 0..7
-  SPISetDelay(500);  // 0.5ms read/write delay
 
   buffer[0] = CMD_PROM_RD + (coeffNum * 2); // Send PROM READ command
   buffer[1] = CMD_ADC_READ;                 // Get next char
   buffer[2] = CMD_ADC_READ;                 // Get next char
 
-  SPIDataRW(CHANNEL, buffer, 3);            // Send and receive
+  altTransfer(&seg, 1, 0);                  // Send and receive
 
   rC = 256 * (int)buffer[1];                // Convert the high bits
   rC = rC + (int)buffer[2];                 // Add the low bits
@@ -125,48 +256,213 @@ unsigned int readAltimeterCalibration(char coeffNum) {
   return rC;
 }
 
+/*
+ * readAltimeterPROM(): Read all eight PROM words (calibration coefficients
+ *                      and CRC) in a single SPI message
+ *                      Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int readAltimeterPROM(unsigned int prom[8]) {
+  unsigned char buffer[8][3];
+  struct spi_segment segs[8];
+
+  // Data sheet values, with a CRC that checks out
+  if (altSource == ALT_SOURCE_SIM) {
+    for (int i = 0; i < 8; i++) {
+      prom[i] = simPROM[i];
+    }
+    prom[7] = altimeterCRC4(prom);
+    return 0;
+  }
+
+  for (int i = 0; i < 8; i++) {
+    buffer[i][0] = CMD_PROM_RD + (i * 2);   // PROM READ command for word i
+    buffer[i][1] = CMD_ADC_READ;            // Get next char
+    buffer[i][2] = CMD_ADC_READ;            // Get next char
+
+    segs[i].data = buffer[i];
+    segs[i].len = 3;
+    segs[i].delay = 500;                    // 0.5ms read/write delay
+    segs[i].csChange = true;                // Each read is its own command
+  }
+
+  if (altTransfer(segs, 8, 0) < 0)
+    return -1;
+
+  for (int i = 0; i < 8; i++) {
+    prom[i] = 256 * (int)buffer[i][1] + (int)buffer[i][2];
+  }
+
+  return 0;
+}
+
+/*
+ * altimeterPROMValid(): Does a PROM read pass its CRC?  A bus with
+ *                       nothing on it reads as all zeros or all ones,
+ *                       which are turned away no matter what.
+ *****************************************************************************
+ */
+
+bool altimeterPROMValid(const unsigned int prom[8]) {
+  unsigned int copy[8];
+  bool zeros = true, ones = true;
+
+  for (int i = 0; i < 8; i++) {
+    copy[i] = prom[i];
+    zeros = zeros && (prom[i] == 0x0000);
+    ones = ones && (prom[i] == 0xFFFF);
+  }
+
+  if (zeros || ones)
+    return false;
+
+  return ((prom[7] & 0x000F) == altimeterCRC4(copy));
+}
+
+/*
+ * readValidPROM(): Reads the PROM until it passes its CRC, a few times
+ *                  at most
+ *                  Returns -1 if it never does
+ *****************************************************************************
+ */
+
+static int readValidPROM(unsigned int prom[8]) {
+  for (int i = 0; i < ALT_PROM_TRIES; i++) {
+    if ((readAltimeterPROM(prom) == 0) && altimeterPROMValid(prom))
+      return 0;
+  }
+
+  return -1;
+}
+
+/*
+ * convTime(): How long a conversion takes at a given OSR, microseconds
+ *****************************************************************************
+ */
+
+static unsigned short convTime(char cmd) {
+  unsigned char osr = (cmd & 0x0F);
+
+  if (osr == CMD_ADC_256)
+    return 900;
+  else if (osr == CMD_ADC_512)
+    return 3000;
+  else if (osr == CMD_ADC_1024)
+    return 4000;
+  else if (osr == CMD_ADC_2048)
+    return 6000;
+  else if (osr == CMD_ADC_4096)
+    return 10000;
+  else
+    return 500;
+}
+
+/*
+ * osrCmd(): Convert an oversampling ratio (256..4096) to its ADC command
+ *           bits.  Anything else gets the finest OSR.
+ *****************************************************************************
+ */
+
+static char osrCmd(int osr) {
+  switch (osr) {
+    case 256:  return CMD_ADC_256;
+    case 512:  return CMD_ADC_512;
+    case 1024: return CMD_ADC_1024;
+    case 2048: return CMD_ADC_2048;
+    default:   return CMD_ADC_4096;
+  }
+}
+
 /*
  * altimeterADC(): Query the altimeter's analog to digital converter
  *
+ *                 The conversion is started, and the readout queued for
+ *                 when it will be done, so the bus is free for other
+ *                 devices while the ADC works.
+ *
  *                 These values are 24 bit, which is why they are acquired
  *                 in three parts.
  *****************************************************************************
  */
 
 unsigned long altimeterADC(char cmd) {
-
-  unsigned char buffer[5] = {0};            // Set up a buffer
-  unsigned char delay = (cmd & 0x0F);       // Calculate how much delay we need
-  unsigned short delayOld = SPIGetDelay();  // Save our old delay value
+  unsigned char conv[1] = {0};              // Conversion command
+  unsigned char buffer[4] = {0};            // ADC read command and result
+  struct spi_segment start = { conv, 1, 0, false };    // Convert
+  struct spi_segment read = { buffer, 4, 0, false };   // Read the result
   unsigned long temp = 0;
 
-  // Set an appropriate read/write delay
-  if (delay == CMD_ADC_256)
-    SPISetDelay(900);
-  else if (delay == CMD_ADC_512)
-    SPISetDelay(3000);
-  else if (delay == CMD_ADC_1024)
-    SPISetDelay(4000);
-  else if (delay == CMD_ADC_2048)
-    SPISetDelay(6000);
-  else if (delay == CMD_ADC_4096)
-    SPISetDelay(10000);
-  else
-    SPISetDelay(500);
+  // The simulator doesn't need to wait for anything
+  if (altSource == ALT_SOURCE_SIM)
+    return simADC(cmd);
+
+  conv[0] = CMD_ADC_CONV + cmd;         // Send conversion command
+  buffer[0] = CMD_ADC_READ;             // Send ADC read command
+  buffer[1] = CMD_ADC_READ;             // Send again to read first byte
+  buffer[2] = CMD_ADC_READ;             // Send again to read second byte
+  buffer[3] = CMD_ADC_READ;             // Send again to read third byte
+
+  altTransfer(&start, 1, 0);            // Start the conversion
+  altTransfer(&read, 1, nowNS() + convTime(cmd) * 1000ULL);  // Read it once it's done
+
+  temp = 65536 * (int)buffer[1];        // Convert the high bits
+  temp = temp + 256 * (int)buffer[2];   // Convert the middle bits and add them
+  temp = temp + (int)buffer[3];         // Add the low bits
+
+  return temp;
+}
+
+/*
+ * altimeterStartADC(): Start a conversion and return without waiting for
+ *                      it.  Read the result with altimeterReadADC() once
+ *                      convTime() has passed.
+ *****************************************************************************
+ */
+
+void altimeterStartADC(char cmd) {
+  unsigned char buffer[1] = {0};
+  struct spi_segment seg = { buffer, 1, 0, false };  // Don't wait for the conversion here
+
+  if (altSource == ALT_SOURCE_SIM) {
+    simCmd = cmd;
+    return;
+  }
 
   buffer[0] = CMD_ADC_CONV + cmd;       // Send conversion command
-  SPIDataRW(CHANNEL, buffer, 1);        // Send and receive
+  altTransfer(&seg, 1, 0);              // Send and receive
+}
+
+/*
+ * altimeterReadADC(): Read the result of the last conversion.  If next is
+ *                     not negative, the conversion command next is sent in
+ *                     the same SPI message, straight after the readout.
+ *****************************************************************************
+ */
 
-  SPISetDelay(delay);                   // Set the delay
+unsigned long altimeterReadADC(int next) {
+  unsigned char buffer[4] = {0};
+  unsigned char conv[1] = {0};
+  struct spi_segment segs[2] = {
+    { buffer, 4, 0, true },             // Read the result, deselect
+    { conv, 1, 0, false }               // Start the next conversion
+  };
+  unsigned long temp = 0;
+
+  if (altSource == ALT_SOURCE_SIM) {
+    temp = simADC(simCmd);
+    if (next >= 0)
+      simCmd = next;
+    return temp;
+  }
 
   buffer[0] = CMD_ADC_READ;             // Send ADC read command
   buffer[1] = CMD_ADC_READ;             // Send again to read first byte
   buffer[2] = CMD_ADC_READ;             // Send again to read second byte
   buffer[3] = CMD_ADC_READ;             // Send again to read third byte
+  conv[0] = CMD_ADC_CONV + next;        // Next conversion command
 
-  SPIDataRW(CHANNEL, buffer, 4);        // Send and receive
-
-  SPISetDelay(delayOld);                // Set the delay to previous value
+  altTransfer(segs, (next < 0) ? 1 : 2, 0);  // Send and receive
 
   temp = 65536 * (int)buffer[1];        // Convert the high bits
   temp = temp + 256 * (int)buffer[2];   // Convert the middle bits and add them
@@ -318,52 +614,98 @@ double calcFirstOrderT(unsigned long T) {
 }
 
 /*
- * calcSecondOrderP: Calculate the second order pressure using the MS5607 2nd
- *                   order non-linear algorithm.
+ * precomputeCoefficients: Work out the calibration terms used by
+ *                         altimeterCompensate()
+ *****************************************************************************
+ */
+
+static void precomputeCoefficients(void) {
+  K.SENS_T1 = (int64_t)C[1] * (1LL << 16);
+  K.OFF_T1 = (int64_t)C[2] * (1LL << 17);
+  K.TCS = C[3];
+  K.TCO = C[4];
+  K.T_REF = (int64_t)C[5] * (1LL << 8);
+  K.TEMPSENS = C[6];
+}
+
+/*
+ * setAltimeterCalibration(): Use calibration coefficients from somewhere
+ *                            other than the PROM, such as the header of
+ *                            a flight log being reprocessed
+ *****************************************************************************
+ */
+
+void setAltimeterCalibration(const unsigned int prom[8]) {
+  for (int i = 0; i < 8; i++) {
+    C[i] = prom[i];
+  }
+
+  precomputeCoefficients();
+}
+
+/*
+ * altimeterCompensate: Calculate first and second order temperature and
+ *                      pressure from raw D2 (T) and D1 (P) values using
+ *                      the MS5607 integer algorithm.  dT, OFF and SENS
+ *                      are worked out once and shared by every result.
  *
- *                   This calculation comes from the manufacturer's data sheet
+ *                      This calculation comes from the manufacturer's
+ *                      data sheet
  *****************************************************************************
  */
 
-double calcSecondOrderP(unsigned long T, unsigned long P) {
-  double Pcomp = 0.0;                 // compensated pressure value
-  double temp = calcFirstOrderT(T);   // first order temperature value
-  double temp2 = 0.0;                 // temperature adjustment
-  double dT;                          // difference between actual and measured temperature
-  double offset, offset2 = 0.0;       // offset at actual temperature
-  double sens, sens2 = 0.0;           // sensitivity at actual temperature
+void altimeterCompensate(unsigned long T, unsigned long P, struct altimeter_comp *comp) {
+  int64_t dT, TEMP, OFF, SENS;
+  int64_t T2 = 0, OFF2 = 0, SENS2 = 0;
 
-  offset = calcOffset(T);
-  sens = calcSens(T);
-  dT = calcDT(T);
+  // difference between actual and reference temperature
+  dT = (int64_t)T - K.T_REF;
+
+  // 1st order temperature, offset and sensitivity
+  TEMP = 2000 + dT * K.TEMPSENS / (1LL << 23);
+  OFF = K.OFF_T1 + K.TCO * dT / (1LL << 6);
+  SENS = K.SENS_T1 + K.TCS * dT / (1LL << 7);
+
+  comp->dT = dT;
+  comp->TEMP = TEMP;
+  comp->P1 = ((int64_t)P * SENS / (1LL << 21) - OFF) / (1LL << 15);
 
   // Temperature less than 20C
-  if (temp < 20.0) {
-    temp2 = pow(dT,2) / pow(2,31);
-    offset2 = 61 * pow((temp - 2000),2) / pow(2,4);
-    sens2 = 2 * pow((temp - 2000),2);
+  if (TEMP < 2000) {
+    T2 = dT * dT / (1LL << 31);
+    OFF2 = 61 * (TEMP - 2000) * (TEMP - 2000) / 16;
+    SENS2 = 2 * (TEMP - 2000) * (TEMP - 2000);
 
     // Temperature less than -15C
-    if (temp < -15) {
-      offset2 = offset2 + 15 * pow((temp + 1500),2);
-      sens2 = sens2 + 8 * pow((temp + 1500), 2);
+    if (TEMP < -1500) {
+      OFF2 += 15 * (TEMP + 1500) * (TEMP + 1500);
+      SENS2 += 8 * (TEMP + 1500) * (TEMP + 1500);
     }
   }
 
-  // Temperature greater than 20C
-  else {
-    temp2 = offset2 = sens2 = 0;
-  }
-
   // Subtract adjustments
-  temp -= temp2;
-  offset -= offset2;
-  sens -= sens2;
+  comp->TEMP2 = TEMP - T2;
+  OFF -= OFF2;
+  SENS -= SENS2;
 
-  // calculate 2nd order pressure (MS5607 2nd order non-linear algorithm)
-  Pcomp = (((P * sens) / pow(2,21) - offset) / pow(2,15)) / 100;
+  // 2nd order pressure (MS5607 2nd order non-linear algorithm)
+  comp->P2 = ((int64_t)P * SENS / (1LL << 21) - OFF) / (1LL << 15);
+}
 
-  return Pcomp;
+/*
+ * calcSecondOrderP: Calculate the second order pressure using the MS5607 2nd
+ *                   order non-linear algorithm.
+ *
+ *                   This calculation comes from the manufacturer's data sheet
+ *****************************************************************************
+ */
+
+double calcSecondOrderP(unsigned long T, unsigned long P) {
+  struct altimeter_comp comp;
+
+  altimeterCompensate(T, P, &comp);
+
+  return comp.P2 / 100.0;
 }
 
 /*
@@ -394,15 +736,30 @@ double calcSecondOrderP(unsigned long T, unsigned long P) {
  */
 
 void setQFF(float latitude, float elevation, float height) {
+  unsigned long T = readTUncompensated(); // Read the raw temperature value
+  unsigned long P = readPUncompensated(); // Read the raw pressure value
+
+  QFF = calcQFF(T, P, latitude, elevation, height);
+}
+
+/*
+ * calcQFF: Work out the QFF from raw T and P values taken at the station,
+ *          as setQFF() does with a fresh reading
+ *****************************************************************************
+ */
+
+float calcQFF(unsigned long T, unsigned long P, float latitude, float elevation, float height) {
   float R = 287.053;     // gas constant of air at sea level
   float g = 9.80665;     // acceleration due to gravity, m/s^2
   float t = 288.15;      // standard temperature at sea level
   double T1 = 0.0;
 
-  double T = readTUncompensated();       // Read the raw temperature value
-  double P = readPUncompensated();       // Read the raw pressure value
-  double Tcomp = calcFirstOrderT(T);     // Get the first order temperature correction
-  double Pcomp = calcSecondOrderP(T, P); // Get the second order pressure correction
+  struct altimeter_comp comp;
+
+  altimeterCompensate(T, P, &comp);       // Compensate them
+
+  double Tcomp = comp.TEMP / 100.0;       // The first order temperature
+  double Pcomp = comp.P2 / 100.0;         // The second order pressure
 
   double QFE = Pcomp *(1 + ((g * height) / (R * t)));    // Calculate QFE
 
@@ -415,7 +772,17 @@ void setQFF(float latitude, float elevation, float height) {
     T1 = 1.07 * Tcomp + 274.5;
 
   // Calculate QFF
-  QFF = QFE * exp((elevation * 0.034163 * (1 - 0.0026373 * cos(latitude)))/T1);
+  return QFE * exp((elevation * 0.034163 * (1 - 0.0026373 * cos(latitude)))/T1);
+}
+
+/*
+ * setQFFValue: Use a QFF worked out earlier, such as the one recorded
+ *              in a flight log
+ *****************************************************************************
+ */
+
+void setQFFValue(float qff) {
+  QFF = qff;
 }
 
 /*
@@ -427,6 +794,317 @@ void setQFF(float latitude, float elevation, float height) {
   return QFF;
 }
 
+/*
+ * sleepUntil: Sleep until an absolute CLOCK_MONOTONIC time, nanoseconds
+ *****************************************************************************
+ */
+
+static void sleepUntil(unsigned long long ns) {
+  struct timespec tim;
+
+  tim.tv_sec = ns / 1000000000ULL;
+  tim.tv_nsec = ns % 1000000000ULL;
+
+  // Keep going if we're interrupted by a signal
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tim, NULL) != 0) {
+    if (!samplerRunning)
+      break;
+  }
+}
+
+/*
+ * altimeterConvert: Compensate a raw T/P pair and work out the altitude,
+ *                   exactly as the live samples are
+ *****************************************************************************
+ */
+
+void altimeterConvert(unsigned long T, unsigned long P, struct altimeter_sample *s) {
+  struct altimeter_comp comp;
+
+  altimeterCompensate(T, P, &comp);
+
+  s->T = T;
+  s->P = P;
+  s->T1 = comp.TEMP / 100.0;
+  s->P1 = comp.P1 / 100.0;
+  s->P2 = comp.P2 / 100.0;
+  s->altitude = calcAltitude(s->P2, s->T1);
+}
+
+/*
+ * publishSample: Compensate a raw T/P pair and make it the latest sample
+ *****************************************************************************
+ */
+
+static void publishSample(unsigned long T, unsigned long P, unsigned long long ns) {
+  struct altimeter_sample s;
+
+  altimeterConvert(T, P, &s);
+  s.ns = ns;
+
+  seqlockWriteBegin(&latestLock);
+  s.seq = latest.seq + 1;
+  latest = s;
+  seqlockWriteEnd(&latestLock);
+}
+
+/*
+ * verifyPROM: Resets the altimeter and reads its PROM, for a start that
+ *             went ahead on a cached calibration.  A PROM that passes
+ *             its CRC but differs from the cache is taken over, before
+ *             any sample is worked out with it.
+ *****************************************************************************
+ */
+
+static void verifyPROM(void) {
+  unsigned int prom[8];
+  bool same = true;
+
+  altimeterReset();
+
+  if (readValidPROM(prom) < 0) {
+    atomic_store(&promStatus, ALT_PROM_BAD);
+    return;
+  }
+
+  for (int i = 0; i < 8; i++) {
+    same = same && (prom[i] == C[i]);
+  }
+
+  if (!same)
+    setAltimeterCalibration(prom);
+
+  atomic_store(&promStatus, same ? ALT_PROM_MATCH : ALT_PROM_CHANGED);
+}
+
+/*
+ * altimeterPROMStatus: How the PROM check went, ALT_PROM_*
+ *****************************************************************************
+ */
+
+int altimeterPROMStatus(void) {
+  return atomic_load(&promStatus);
+}
+
+/*
+ * altimeterThread: Thread to keep the latest altimeter sample up to date.
+ *
+ *                  The ADC does its conversion on its own, so instead of
+ *                  sitting in an SPI delay we start a conversion and get
+ *                  on with something else.  If the next sample is due
+ *                  before the current one would be published, its first
+ *                  conversion is started straight away and the current
+ *                  sample is compensated and published while it runs.
+ *
+ *                  The OSRs, sample rate and how often temperature is
+ *                  read come from the current profile, which is picked
+ *                  up at the start of every sample.
+ *****************************************************************************
+ */
+
+void *altimeterThread (void *vargp) {
+  struct altimeter_profile prof;      // Copy of the current profile
+  char cmdT, cmdP;                    // Conversion commands for this sample
+  char convCmd = 0;                   // Conversion that is running
+  unsigned long long convStart = 0;   // When it was started
+  unsigned long long next = nowNS();  // When the next sample is due
+  unsigned long T = 0, P = 0;         // Raw values of the newest sample
+  unsigned long long pNS = 0;         // When P was read
+  int tCount = 0;                     // Pressure samples since T was read
+  bool haveT = false;                 // Has T been read at all?
+  bool pending = false;               // Is there a sample to publish?
+  bool converting = false;            // Is a conversion already running?
+
+  rtApply(RT_ALTIMETER);
+
+  // Finish the setup that was put off to get counting sooner
+  if (verifyPending) {
+    verifyPROM();
+    next = nowNS();
+  }
+
+  while (samplerRunning) {
+
+    // Prevent other threads from clobbering this value
+    pthread_mutex_lock(&lock_profile);
+    prof = profile;
+    pthread_mutex_unlock(&lock_profile);
+
+    cmdT = CMD_ADC_D2 + osrCmd(prof.osrT);
+    cmdP = CMD_ADC_D1 + osrCmd(prof.osrP);
+
+    // Start this sample's first conversion, unless it's already running
+    if (!converting) {
+      sleepUntil(next);
+      convCmd = (!haveT || (tCount >= prof.tEvery)) ? cmdT : cmdP;
+      altimeterStartADC(convCmd);
+      convStart = nowNS();
+    }
+
+    // Publish the last sample while the ADC is busy
+    if (pending) {
+      publishSample(T, P, pNS);
+      pending = false;
+    }
+
+    sleepUntil(convStart + convTime(convCmd) * 1000ULL);
+
+    // Temperature first, then pressure.  Reading T and starting
+    // P go out as a single SPI message.
+    if ((convCmd & CMD_ADC_D2) == CMD_ADC_D2) {
+      T = altimeterReadADC(cmdP);
+      convStart = nowNS();
+      haveT = true;
+      tCount = 0;
+
+      sleepUntil(convStart + convTime(cmdP) * 1000ULL);
+      P = altimeterReadADC(-1);
+    }
+    else {
+      P = altimeterReadADC(-1);
+    }
+    pNS = nowNS();
+    tCount++;
+
+    // Schedule the next sample.  If we've fallen behind, start
+    // over from now rather than trying to catch up.
+    next += 1000000000.0 / prof.rate;
+    if (next < pNS)
+      next = pNS;
+
+    // Start the next sample now if it's due before its first
+    // conversion would finish, and publish this one while it runs
+    convCmd = (tCount >= prof.tEvery) ? cmdT : cmdP;
+    if (next <= pNS + convTime(convCmd) * 1000ULL) {
+      altimeterStartADC(convCmd);
+      convStart = nowNS();
+      converting = true;
+      pending = true;
+    }
+    else {
+      publishSample(T, P, pNS);
+      converting = false;
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * altimeterGetSample(): Copy the latest sample without waiting for the
+ *                       altimeter.  Returns false, leaving sample as it
+ *                       was, if there isn't one yet.
+ *****************************************************************************
+ */
+
+bool altimeterGetSample(struct altimeter_sample *sample) {
+  struct altimeter_sample s;
+  unsigned int seq;
+
+  do {
+    seq = seqlockReadBegin(&latestLock);
+    s = latest;
+  } while (seqlockReadRetry(&latestLock, seq));
+
+  // Nothing has been sampled yet, leave sample alone
+  if (s.seq == 0)
+    return false;
+
+  *sample = s;
+  return true;
+}
+
+/*
+ * altimeterSetProfile(): Switch the background sampler to a different
+ *                        acquisition profile.  Takes effect from the next
+ *                        sample.
+ *****************************************************************************
+ */
+
+void altimeterSetProfile(const struct altimeter_profile *prof) {
+
+  // Prevent other threads from clobbering this value
+  pthread_mutex_lock(&lock_profile);
+  profile = *prof;
+
+  // Guard against profiles that would stall the sampler
+  if (profile.rate <= 0.0)
+    profile.rate = 1.0;
+  if (profile.tEvery < 1)
+    profile.tEvery = 1;
+  pthread_mutex_unlock(&lock_profile);
+}
+
+/*
+ * altimeterGetProfile(): Get the acquisition profile in use
+ *****************************************************************************
+ */
+
+void altimeterGetProfile(struct altimeter_profile *prof) {
+
+  // Prevent other threads from clobbering this value
+  pthread_mutex_lock(&lock_profile);
+  *prof = profile;
+  pthread_mutex_unlock(&lock_profile);
+}
+
+/*
+ * altimeterFindProfile(): Look up one of altimeterProfiles[] by name.
+ *                         Returns NULL if there isn't one.
+ *****************************************************************************
+ */
+
+const struct altimeter_profile *altimeterFindProfile(const char *name) {
+  for (int i = 0; i < ALT_PROFILES; i++) {
+    if (strcmp(altimeterProfiles[i].name, name) == 0)
+      return &altimeterProfiles[i];
+  }
+  return NULL;
+}
+
+/*
+ * altimeterStart(): Start sampling in the background using a given
+ *                   profile.  Nothing else may talk to the altimeter
+ *                   until altimeterStop().  If the calibration came from
+ *                   setAltimeterCalibration() rather than altimeterSetup(),
+ *                   the PROM is read and checked first, see
+ *                   altimeterPROMStatus().
+ *****************************************************************************
+ */
+
+void altimeterStart(const struct altimeter_profile *prof) {
+  pthread_mutex_init(&lock_profile, NULL);
+  verifyPending = (atomic_load(&promStatus) == ALT_PROM_UNCHECKED);
+  if (verifyPending)
+    atomic_store(&promStatus, ALT_PROM_PENDING);
+
+  altimeterSetProfile(prof);
+
+  samplerRunning = true;
+
+  seqlockInit(&latestLock);
+  latest.seq = 0;
+
+  // Joinable, so stopping can wait for the last SPI transfer
+  if (pthread_create(&samplerId, NULL, altimeterThread, NULL) != 0)
+    samplerRunning = false;
+}
+
+/*
+ * altimeterStop(): Stop sampling in the background.  Waits for the sample
+ *                  in progress, at most one sample period, so the SPI bus
+ *                  can be stopped as soon as this returns.
+ *****************************************************************************
+ */
+
+void altimeterStop(void) {
+  if (!samplerRunning)
+    return;
+
+  samplerRunning = false;
+  pthread_join(samplerId, NULL);
+}
+
 /*
  * altimeterSetup(): Setup altimeter
  *                   Returns -1 if there is an error
@@ -434,6 +1112,7 @@ void setQFF(float latitude, float elevation, float height) {
  */
 
 int altimeterSetup(void) {
+  unsigned int prom[8];
 
   // Altimeter initialization failed
   if (altimeterInit() < 0)
@@ -444,9 +1123,16 @@ int altimeterSetup(void) {
     altimeterReset();              // Reset after power on
 
     // Get altimeter factory calibration coefficients
+    if (readValidPROM(prom) < 0)
+      return -1;
+    atomic_store(&promStatus, ALT_PROM_MATCH);
+
     for (int i=0; i < 8; i++) {
-      C[i] = readAltimeterCalibration(i);
+      C[i] = prom[i];
     }
+
+    // Work out everything that only depends on the calibration
+    precomputeCoefficients();
   }
   return 0;
 }
@@ -30,16 +30,80 @@
 #ifndef MS5607_H
 #define MS5607_H
 
+#include <stdbool.h>
+
+// How the background sampler drives the altimeter
+struct altimeter_profile {
+  const char *name;
+  int osrP;                   // Pressure oversampling ratio, 256..4096
+  int osrT;                   // Temperature oversampling ratio, 256..4096
+  double rate;                // Pressure samples per second
+  int tEvery;                 // Read temperature every this many samples
+};
+
+// Predefined profiles in altimeterProfiles[]
+#define ALT_PROFILE_GROUND  0
+#define ALT_PROFILE_ASCENT  1
+#define ALT_PROFILE_FLOAT   2
+#define ALT_PROFILE_DESCENT 3
+#define ALT_PROFILES        4
+
+// Where altimeter readings come from
+#define ALT_SOURCE_SPI      0   // A real MS5607
+#define ALT_SOURCE_SIM      1   // sim.c
+
+// How the PROM has checked out, from altimeterPROMStatus()
+#define ALT_PROM_UNCHECKED  0   // Not read yet
+#define ALT_PROM_PENDING    1   // altimeterThread() will read it first thing
+#define ALT_PROM_MATCH      2   // Passed its CRC and matches the calibration
+#define ALT_PROM_CHANGED    3   // Passed its CRC, but had to be taken over
+#define ALT_PROM_BAD        4   // Never passed its CRC
+
+// Times to read the PROM before giving up on it
+#define ALT_PROM_TRIES      3
+
+extern const struct altimeter_profile altimeterProfiles[ALT_PROFILES];
+
+// Integer compensation results, as in the data sheet
+struct altimeter_comp {
+  long long dT;               // Actual minus reference temperature
+  long long TEMP;             // First order temperature, 0.01 C
+  long long TEMP2;            // Second order temperature, 0.01 C
+  long long P1;               // First order pressure, 0.01 mbar
+  long long P2;               // Second order pressure, 0.01 mbar
+};
+
+// A compensated altimeter sample
+struct altimeter_sample {
+  unsigned long seq;          // Sample number, 0 if there's no sample yet
+  unsigned long long ns;      // CLOCK_MONOTONIC time P was read
+  unsigned long T;            // Raw temperature
+  unsigned long P;            // Raw pressure
+  double T1;                  // First order temperature, C
+  double P1;                  // First order pressure, mbar
+  double P2;                  // Second order pressure, mbar
+  float altitude;             // Altitude, m
+};
+
 // Altimeter initialization
+struct spi_bus;
 int altimeterSetup(void);
 int altimeterInit(void);
-void altimeterReset(void);
+void altimeterSetBus(struct spi_bus *bus);
+int altimeterReset(void);
+void altimeterSetSource(int source);
 
 // Altimeter communications
 void getAltimeterCalibration(int C_copy[]);
+void setAltimeterCalibration(const unsigned int prom[8]);
 unsigned int readAltimeterCalibration(char CNum);
+int readAltimeterPROM(unsigned int prom[8]);
 unsigned long altimeterADC(char cmd);
+void altimeterStartADC(char cmd);
+unsigned long altimeterReadADC(int next);
 unsigned char altimeterCRC4(unsigned int n_prom[]);
+bool altimeterPROMValid(const unsigned int prom[8]);
+int altimeterPROMStatus(void);
 
 // Read raw values from the altimeter
 unsigned long readPUncompensated(void);
@@ -52,12 +116,25 @@ double calcSens(unsigned long T);
 double calcFirstOrderP(unsigned long T, unsigned long P);
 double calcSecondOrderP(unsigned long T, unsigned long P);
 double calcFirstOrderT(unsigned long T);
+void altimeterCompensate(unsigned long T, unsigned long P, struct altimeter_comp *comp);
+void altimeterConvert(unsigned long T, unsigned long P, struct altimeter_sample *s);
 
 // Use T and P to calculate altitude
 double calcAltitude(double pressure, double temp);
 
+// Sample in the background
+void *altimeterThread(void *vargp);
+void altimeterStart(const struct altimeter_profile *prof);
+void altimeterSetProfile(const struct altimeter_profile *prof);
+void altimeterGetProfile(struct altimeter_profile *prof);
+const struct altimeter_profile *altimeterFindProfile(const char *name);
+void altimeterStop(void);
+bool altimeterGetSample(struct altimeter_sample *sample);
+
 // Set QFF to get an absolute altitude above mean sea level
 void setQFF(float latitude, float elevation, float height);
+float calcQFF(unsigned long T, unsigned long P, float latitude, float elevation, float height);
+void setQFFValue(float qff);
 float getQFF();
 
 #endif
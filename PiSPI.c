@@ -28,34 +28,130 @@
 
 #include <stdint.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdbool.h>
 #include <sys/ioctl.h>
 #include <asm/ioctl.h>
 #include <linux/spi/spidev.h>
+#include "PiSPI.h"
 
 
 static const char *spiDev0 = "/dev/spidev0.0";  // SPI device 0
 static const char *spiDev1 = "/dev/spidev0.1";  // SPI device 1
-static volatile unsigned char spiBPW = 8;       // SPI bits per word
-static volatile unsigned short spiDelay = 1000; // SPI delay, microseconds
-static unsigned int spiSpeeds[2];               // SPI bus speeds
-static int spiFds[2];                           // SPI file descriptors
+
+// The devices behind the original interface, one per chip select
+static struct spi_device spiDevs[2] = {
+  { 0, -1, 0, 0, 8, 1000 },
+  { 1, -1, 0, 0, 8, 1000 }
+};
+
+/*
+ * SPIOpen: Opens a device and sets it up
+ *          channel can be 0 or 1
+ *          speed is the bus speed of the device
+ *          mode can be 0, 1, 2, or 3
+ *          Returns -1 if there is an error
+ *****************************************************************************
+ */
+int SPIOpen(struct spi_device *dev, int channel, int speed, int mode) {
+  int fd;        // file descriptor
+
+  dev->channel = channel & 1;
+  dev->speed = speed;
+  dev->mode = mode & 3;
+  dev->bpw = 8;
+  dev->delay = 0;
+
+  // If we can't open the SPI channel read-write, exit
+  if ((fd = open(dev->channel == 0 ? spiDev0 : spiDev1, O_RDWR)) < 0)
+    return -1;
+
+  // The kernel keeps these for the file descriptor, but every transfer
+  // carries its own speed and word size as well
+  if ((ioctl(fd, SPI_IOC_WR_MODE, &dev->mode) < 0) ||
+      (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &dev->bpw) < 0) ||
+      (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &dev->speed) < 0)) {
+    close(fd);
+    return -1;
+  }
+
+  dev->fd = fd;
+
+  return 0;
+}
+
+/*
+ * SPIDeviceRW: Sends SPI data to a device, followed by its delay
+ *              data is an array of char
+ *              len is how many elements of the array to send (0..len-1)
+ *****************************************************************************
+ */
+int SPIDeviceRW(const struct spi_device *dev, unsigned char *data, int len) {
+  struct spi_segment seg = { data, len, dev->delay, false };
+
+  return SPIDeviceRWSegments(dev, &seg, 1);
+}
+
+/*
+ * SPIDeviceRWSegments: Sends several SPI segments to a device in a
+ *                      single system call
+ *                      segs is an array of segments, each with its own
+ *                      buffer, length, delay and chip select behaviour
+ *                      n is how many segments to send (1..SPI_MAX_SEGMENTS)
+ *****************************************************************************
+ */
+int SPIDeviceRWSegments(const struct spi_device *dev, struct spi_segment *segs, int n) {
+  struct spi_ioc_transfer spi[SPI_MAX_SEGMENTS];
+
+  if ((n < 1) || (n > SPI_MAX_SEGMENTS))
+    return -1;
+
+  memset(spi, 0, sizeof(spi));  // Allocate memory for the structs
+
+  for (int i = 0; i < n; i++) {
+    spi[i].tx_buf        = (unsigned long)segs[i].data; // TX buffer
+    spi[i].rx_buf        = (unsigned long)segs[i].data; // RX buffer is the same as TX
+    spi[i].len           = segs[i].len;                 // Number of chars to send
+    spi[i].delay_usecs   = segs[i].delay;               // Delay after this segment
+    spi[i].speed_hz      = dev->speed;                  // Bus speed of device
+    spi[i].bits_per_word = dev->bpw;                    // Bits per word
+
+    // On the last segment cs_change would leave the device selected
+    // after the message, so only honour it between segments
+    spi[i].cs_change     = (i < n - 1) ? segs[i].csChange : 0;
+  }
+
+  // Send all of the segments to the given file descriptor at once
+  return ioctl(dev->fd, SPI_IOC_MESSAGE(n), spi);
+}
+
+/*
+ * SPIClose: Closes a device
+ *****************************************************************************
+ */
+void SPIClose(struct spi_device *dev) {
+  if (dev->fd >= 0)
+    close(dev->fd);
+  dev->fd = -1;
+}
 
 /*
- * SPISetDelay: Sets the delay to a specific number of microseconds
+ * SPISetDelay: Sets the delay to a specific number of microseconds, for
+ *              SPIDataRW() on either chip select
  *****************************************************************************
  */
 void SPISetDelay(unsigned short delay) {
-  spiDelay = delay;
+  spiDevs[0].delay = spiDevs[1].delay = delay;
 }
 
 /*
- * SPIGetDelay: Gets the current value of spiDelay in microseconds
+ * SPIGetDelay: Gets the current SPIDataRW() delay in microseconds
  *****************************************************************************
  */
 unsigned short SPIGetDelay(void) {
-  return spiDelay;
+  return spiDevs[0].delay;
 }
 
 /*
@@ -63,7 +159,7 @@ unsigned short SPIGetDelay(void) {
  *****************************************************************************
  */
 void SPISetBPW(unsigned char bpw) {
-  spiBPW = (bpw & 8);
+  spiDevs[0].bpw = spiDevs[1].bpw = (bpw & 8);
 }
 
 /*
@@ -71,7 +167,7 @@ void SPISetBPW(unsigned char bpw) {
  *****************************************************************************
  */
 int SPIGetFd(int channel) {
-  return spiFds[channel & 1];
+  return spiDevs[channel & 1].fd;
 }
 
 /*
@@ -82,20 +178,17 @@ int SPIGetFd(int channel) {
  *****************************************************************************
  */
 int SPIDataRW(int channel, unsigned char *data, int len) {
-  struct spi_ioc_transfer spi;  // Create an SPI struct
-  channel &= 1;                 // Enforce channel 0 or 1
-
-  memset(&spi, 0, sizeof(spi)); // Allocate memory for the struct
-
-  spi.tx_buf        = (unsigned long)data; // TX buffer
-  spi.rx_buf        = (unsigned long)data; // RX buffer is the same as TX 
-  spi.len           = len;                 // Number of chars to send
-  spi.delay_usecs   = spiDelay;            // Delay between read/write
-  spi.speed_hz      = spiSpeeds[channel];  // Bus speed of device
-  spi.bits_per_word = spiBPW;              // Bits per word
+  return SPIDeviceRW(&spiDevs[channel & 1], data, len);
+}
 
-  // Send the data to the given file descriptor
-  return ioctl(spiFds[channel], SPI_IOC_MESSAGE(1), &spi);
+/*
+ * SPIDataRWSegments: Sends several SPI segments to a given channel in a
+ *                    single system call
+ *                    channel can be 0 or 1
+ *****************************************************************************
+ */
+int SPIDataRWSegments(int channel, struct spi_segment *segs, int n) {
+  return SPIDeviceRWSegments(&spiDevs[channel & 1], segs, n);
 }
 
 /*
@@ -106,30 +199,17 @@ int SPIDataRW(int channel, unsigned char *data, int len) {
  *****************************************************************************
  */
 int SPISetup(int channel, int speed, int mode) {
-  int fd;        // file descriptor
-  mode &= 3;     // mode is 0, 1, 2, or 3
-  channel &= 1;  // channel is 0 or 1
+  struct spi_device *dev = &spiDevs[channel & 1];
+  unsigned char bpw = dev->bpw;
+  unsigned short delay = dev->delay;
 
-  // If we can't open the SPI channel read-write, exit
-  if ((fd = open(channel == 0 ? spiDev0 : spiDev1, O_RDWR)) < 0)
+  if (SPIOpen(dev, channel, speed, mode) < 0)
     return -1;
 
-  // Save these parameters for the given channel
-  spiSpeeds[channel] = speed;
-  spiFds[channel] = fd;
-
-  // If we can't set the SPI mode, exit
-  if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0)
-    return -2;
-
-  // If we can't set the SPI bits per word, exit
-  if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &spiBPW) < 0)
-    return -3;
-
-  // If we can't set the SPI bus speed, exit
-  if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0)
-     return -4;
+  // Keep what was set before the device was opened
+  dev->bpw = bpw;
+  dev->delay = delay;
 
   // Success!  Return the file descriptor.
-  return fd;
+  return dev->fd;
 }
@@ -27,13 +27,44 @@
  */
 
 #ifndef PISPI_H
-#define PIPI_H
+#define PISPI_H
 
+#include <stdbool.h>
+
+// Most segments that can go out in one SPIDataRWSegments() call
+#define SPI_MAX_SEGMENTS 16
+
+// One part of a multi-segment transfer
+struct spi_segment {
+  unsigned char *data;        // TX buffer, received data replaces it
+  int len;                    // Number of chars to send
+  unsigned short delay;       // Delay after this segment, microseconds
+  bool csChange;              // Deselect the device before the next segment
+};
+
+// One device on the bus, with its own settings, so devices never
+// change each other's speed, mode or timing
+struct spi_device {
+  int channel;                // Chip select, 0 or 1
+  int fd;                     // spidev file descriptor, -1 if not open
+  unsigned int speed;         // Bus speed, Hz
+  unsigned char mode;         // SPI mode, 0..3
+  unsigned char bpw;          // Bits per word
+  unsigned short delay;       // Delay after a plain SPIDeviceRW(), microseconds
+};
+
+int SPIOpen(struct spi_device *dev, int channel, int speed, int mode);
+int SPIDeviceRW(const struct spi_device *dev, unsigned char *data, int len);
+int SPIDeviceRWSegments(const struct spi_device *dev, struct spi_segment *segs, int n);
+void SPIClose(struct spi_device *dev);
+
+// The original interface, one device per chip select
 void SPISetDelay(unsigned short delay);
 unsigned short SPIGetDelay(void);
 void SPISetBPW(unsigned char bpw);
 int SPIGetFd(int channel);
 int SPIDataRW(int channel, unsigned char *data, int len);
+int SPIDataRWSegments(int channel, struct spi_segment *segs, int n);
 int SPISetup(int channel, int speed, int mode);
 
 #endif
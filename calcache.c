@@ -0,0 +1,113 @@
+/*
+ *****************************************************************************
+ * calcache.c:  altimeter calibration and QFF kept on disk, so a restart
+ *              can start counting without waiting on the altimeter.
+ *
+ *              The cache is written to a temporary file which is synced
+ *              and then renamed over the old one, so a brownout part way
+ *              through leaves either the old cache or the new one.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include "flightlog.h"
+#include "calcache.h"
+
+// The on-disk layout must not depend on the compiler's padding
+_Static_assert(sizeof(struct calcache) == 96, "calcache is padded");
+
+
+/*
+ * calcacheFill: Fills in a cache to be saved
+ *****************************************************************************
+ */
+
+void calcacheFill(struct calcache *cc, const int C[8], double qff, const char *saved) {
+  memset(cc, 0, sizeof(*cc));
+
+  memcpy(cc->magic, CALCACHE_MAGIC, sizeof(cc->magic));
+  cc->version = CALCACHE_VERSION;
+  cc->size = sizeof(struct calcache);
+  for (int i = 0; i < 8; i++) {
+    cc->C[i] = C[i];
+  }
+  cc->qff = qff;
+  snprintf(cc->saved, sizeof(cc->saved), "%s", saved);
+
+  cc->crc = flightlogCRC(cc, offsetof(struct calcache, crc));
+}
+
+/*
+ * calcacheLoad: Reads the cache back
+ *               Returns -1 if there's none, or it isn't one we can trust
+ *****************************************************************************
+ */
+
+int calcacheLoad(const char *fname, struct calcache *cc) {
+  FILE *in;
+  int result = 0;
+
+  if ((in = fopen(fname, "rb")) == NULL)
+    return -1;
+
+  if ((fread(cc, sizeof(*cc), 1, in) != 1) ||
+      (memcmp(cc->magic, CALCACHE_MAGIC, sizeof(cc->magic)) != 0) ||
+      (cc->version != CALCACHE_VERSION) ||
+      (cc->size != sizeof(struct calcache)) ||
+      (cc->crc != flightlogCRC(cc, offsetof(struct calcache, crc))))
+    result = -1;
+
+  fclose(in);
+
+  return result;
+}
+
+/*
+ * calcacheSave: Replaces the cache on disk
+ *               Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int calcacheSave(const char *fname, const struct calcache *cc) {
+  char tmp[120];
+  FILE *out;
+  int result = 0;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+
+  if ((out = fopen(tmp, "wb")) == NULL)
+    return -1;
+
+  if ((fwrite(cc, sizeof(*cc), 1, out) != 1) || (fflush(out) != 0) || (fsync(fileno(out)) < 0))
+    result = -1;
+
+  if (fclose(out) != 0)
+    result = -1;
+
+  if ((result < 0) || (rename(tmp, fname) < 0)) {
+    unlink(tmp);
+    return -1;
+  }
+
+  return 0;
+}
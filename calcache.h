@@ -0,0 +1,51 @@
+/*
+ *****************************************************************************
+ * calcache.h:  altimeter calibration and QFF kept on disk, so a restart
+ *              can start counting without waiting on the altimeter.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef CALCACHE_H
+#define CALCACHE_H
+
+#include <stdint.h>
+
+#define CALCACHE_MAGIC     "STARCAL"  // Seven characters and a NUL
+#define CALCACHE_VERSION   1
+#define CALCACHE_FILE      "star_calibration.bin"
+
+// Everything the altimeter calculations need, as of the last full start
+struct calcache {
+  char magic[8];          // CALCACHE_MAGIC
+  uint16_t version;       // CALCACHE_VERSION
+  uint16_t size;          // sizeof(struct calcache)
+  uint32_t reserved;
+  uint32_t C[8];          // Altimeter PROM: factory data, C1..C6 and CRC
+  double qff;             // Sea level pressure, mbar
+  char saved[32];         // Local date and time it was saved
+  uint32_t reserved2;
+  uint32_t crc;           // CRC-32 of everything above
+};
+
+void calcacheFill(struct calcache *cc, const int C[8], double qff, const char *saved);
+int calcacheLoad(const char *fname, struct calcache *cc);
+int calcacheSave(const char *fname, const struct calcache *cc);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ *****************************************************************************
+ * deadtime.c:  dead time correction of Geiger count rates, and running
+ *              statistics of the measured pulse widths.
+ *
+ *              After each pulse the tube is dead for a while and misses
+ *              anything that arrives.  At low rates that hardly matters,
+ *              but near the Pfotzer maximum an SBM-20 spends a good part
+ *              of every second dead and the raw rate reads badly low.
+ *              Given the measured rate and the dead time per pulse, the
+ *              true rate is worked back out with either of the usual
+ *              models.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "deadtime.h"
+
+
+/*
+ * widthStatsReset: Forgets every pulse width
+ *****************************************************************************
+ */
+
+void widthStatsReset(struct width_stats *w) {
+  memset(w, 0, sizeof(*w));
+}
+
+/*
+ * widthStatsAdd: Adds a pulse width, in seconds.  The mean and variance
+ *                are kept with Welford's method, which stays accurate no
+ *                matter how many pulses there are.
+ *****************************************************************************
+ */
+
+void widthStatsAdd(struct width_stats *w, double width) {
+  double delta;
+  long bin;
+
+  w->n++;
+  delta = width - w->mean;
+  w->mean += delta / w->n;
+  w->m2 += delta * (width - w->mean);
+
+  if ((w->n == 1) || (width < w->min))
+    w->min = width;
+  if ((w->n == 1) || (width > w->max))
+    w->max = width;
+
+  bin = width * 1e9 / WIDTH_BIN_NS;
+  if (bin < 0)
+    bin = 0;
+  if (bin >= WIDTH_BINS)
+    bin = WIDTH_BINS - 1;
+  w->bins[bin]++;
+}
+
+/*
+ * widthStatsStdDev: Gets the standard deviation of the pulse widths,
+ *                   seconds
+ *****************************************************************************
+ */
+
+double widthStatsStdDev(const struct width_stats *w) {
+  if (w->n < 2)
+    return 0.0;
+
+  return sqrt(w->m2 / (w->n - 1));
+}
+
+/*
+ * widthStatsPercentile: Gets the width below which fraction p of the
+ *                       pulses fall, seconds, to the nearest bin
+ *****************************************************************************
+ */
+
+double widthStatsPercentile(const struct width_stats *w, double p) {
+  unsigned long want, seen = 0;
+
+  if (w->n == 0)
+    return 0.0;
+
+  want = ceil(p * w->n);
+  if (want < 1)
+    want = 1;
+
+  for (int i = 0; i < WIDTH_BINS; i++) {
+    seen += w->bins[i];
+    if (seen >= want)
+      return (i + 1) * WIDTH_BIN_NS / 1e9;
+  }
+
+  return w->max;
+}
+
+/*
+ * paralyzable: Solves rate = n * exp(-n * tau) for the true rate n.
+ *              With x = n * tau and y = rate * tau that is x * exp(-x) = y,
+ *              and we want the root below x = 1 (the other one is a
+ *              tube so swamped it counts less and less).  Newton's method
+ *              on a concave curve, started from x = y, creeps up on the
+ *              root from below without ever overshooting.
+ *****************************************************************************
+ */
+
+static double paralyzable(double rate, double tau) {
+  double y = rate * tau;
+  double x = y, f, df;
+
+  // Faster than the tube can ever count, it must be saturated
+  if (y >= exp(-1.0))
+    return -1.0;
+
+  for (int i = 0; i < 50; i++) {
+    f = x * exp(-x) - y;
+    df = (1.0 - x) * exp(-x);
+    if ((df <= 0.0) || (fabs(f) < 1e-12 * y))
+      break;
+    x -= f / df;
+  }
+
+  return x / tau;
+}
+
+/*
+ * deadTimeCorrect: Gets the true rate from a measured rate (counts/s) and
+ *                  the dead time per pulse (seconds), using one of the
+ *                  DEADTIME_* models.  Returns -1 if the measured rate is
+ *                  more than the model allows, which means the tube is
+ *                  saturated and no true rate can be trusted.
+ *****************************************************************************
+ */
+
+double deadTimeCorrect(int model, double rate, double tau) {
+
+  // Nothing to correct for
+  if ((rate <= 0.0) || (tau <= 0.0))
+    return rate;
+
+  if (model == DEADTIME_PARALYZABLE)
+    return paralyzable(rate, tau);
+
+  // Non-paralyzable: the tube is live for 1 - rate * tau of the time
+  if (rate * tau >= 1.0)
+    return -1.0;
+
+  return rate / (1.0 - rate * tau);
+}
+
+/*
+ * deadTimeModelName: Describes a DEADTIME_* model
+ *****************************************************************************
+ */
+
+const char *deadTimeModelName(int model) {
+  if (model == DEADTIME_PARALYZABLE)
+    return "paralyzable";
+  return "non-paralyzable";
+}
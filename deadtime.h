@@ -0,0 +1,54 @@
+/*
+ *****************************************************************************
+ * deadtime.h:  dead time correction of Geiger count rates, and running
+ *              statistics of the measured pulse widths.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef DEADTIME_H
+#define DEADTIME_H
+
+// How the tube behaves while it is dead
+#define DEADTIME_NONPARALYZABLE 0   // Pulses while dead are simply lost
+#define DEADTIME_PARALYZABLE    1   // Pulses while dead also extend it
+
+// Pulse width histogram: 20 us bins up to the 800 us we trust as dead
+// time.  The last bin holds anything wider.
+#define WIDTH_BIN_NS  20000
+#define WIDTH_BINS    41
+
+// Running statistics of pulse widths, without keeping the widths
+struct width_stats {
+  unsigned long n;                  // Pulses measured
+  double mean;                      // Mean width, seconds
+  double m2;                        // Sum of squared differences from the mean
+  double min;                       // Narrowest, seconds
+  double max;                       // Widest, seconds
+  unsigned long bins[WIDTH_BINS];   // Histogram, WIDTH_BIN_NS wide
+};
+
+void widthStatsReset(struct width_stats *w);
+void widthStatsAdd(struct width_stats *w, double width);
+double widthStatsStdDev(const struct width_stats *w);
+double widthStatsPercentile(const struct width_stats *w, double p);
+double deadTimeCorrect(int model, double rate, double tau);
+const char *deadTimeModelName(int model);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ *****************************************************************************
+ * flightlog.c:  compact binary flight log of STAR data.
+ *
+ *               Each segment is a header followed by fixed-size records,
+ *               each with its own CRC.  Records are held in memory and
+ *               appended in batches, then flushed to the card with
+ *               fdatasync(), so a power cut can lose at most the last
+ *               unsynced batch.  Nothing already written is ever
+ *               rewritten.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "flightlog.h"
+
+// The on-disk layout must not depend on the compiler's padding
+_Static_assert(sizeof(struct flightlog_header) == 96, "flightlog_header is padded");
+_Static_assert(sizeof(struct flightlog_record) == 72, "flightlog_record is padded");
+
+static uint32_t crcTable[256];
+static bool crcReady = false;
+
+
+/*
+ * flightlogCRC: CRC-32 (IEEE 802.3) of a block of memory
+ *****************************************************************************
+ */
+
+uint32_t flightlogCRC(const void *data, unsigned long len) {
+  const unsigned char *p = data;
+  uint32_t crc = 0xFFFFFFFF;
+
+  // Build the table the first time through
+  if (!crcReady) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+      }
+      crcTable[i] = c;
+    }
+    crcReady = true;
+  }
+
+  while (len--) {
+    crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+
+  return crc ^ 0xFFFFFFFF;
+}
+
+/*
+ * flightlogHeader: Fills in a header for a new log
+ *****************************************************************************
+ */
+
+void flightlogHeader(struct flightlog_header *hdr, const int C[8], double qff, const char *started) {
+  memset(hdr, 0, sizeof(*hdr));
+
+  memcpy(hdr->magic, FLIGHTLOG_MAGIC, sizeof(hdr->magic));
+  hdr->version = FLIGHTLOG_VERSION;
+  hdr->headerSize = sizeof(struct flightlog_header);
+  hdr->recordSize = sizeof(struct flightlog_record);
+  hdr->qff = qff;
+  for (int i = 0; i < 8; i++) {
+    hdr->C[i] = C[i];
+  }
+  snprintf(hdr->started, sizeof(hdr->started), "%s", started);
+
+  hdr->crc = flightlogCRC(hdr, offsetof(struct flightlog_header, crc));
+}
+
+/*
+ * flightlogHeaderValid: Is this a header we know how to read?
+ *****************************************************************************
+ */
+
+bool flightlogHeaderValid(const struct flightlog_header *hdr) {
+  if (memcmp(hdr->magic, FLIGHTLOG_MAGIC, sizeof(hdr->magic)) != 0)
+    return false;
+
+  if ((hdr->version != FLIGHTLOG_VERSION) ||
+      (hdr->headerSize != sizeof(struct flightlog_header)) ||
+      (hdr->recordSize != sizeof(struct flightlog_record)))
+    return false;
+
+  return (hdr->crc == flightlogCRC(hdr, offsetof(struct flightlog_header, crc)));
+}
+
+/*
+ * flightlogRecordValid: Does a record match its CRC?
+ *****************************************************************************
+ */
+
+bool flightlogRecordValid(const struct flightlog_record *rec) {
+  return (rec->crc == flightlogCRC(rec, offsetof(struct flightlog_record, crc)));
+}
+
+/*
+ * flightlogFromData: Packs a second of data into a record
+ *****************************************************************************
+ */
+
+void flightlogFromData(struct flightlog_record *rec, uint32_t seq, const struct data_second *data) {
+  memset(rec, 0, sizeof(*rec));
+
+  rec->elapsed = data->elapsed;
+  rec->T1 = data->T1;
+  rec->P1 = data->P1;
+  rec->P2 = data->P2;
+  rec->deadTime = data->deadTime;
+  rec->seq = seq;
+  rec->T = data->T;
+  rec->P = data->P;
+  rec->counts = data->counts;
+  rec->deadCounts = data->deadCounts;
+  rec->altitude = data->altitude;
+  rec->flags = data->flags;
+
+  rec->crc = flightlogCRC(rec, offsetof(struct flightlog_record, crc));
+}
+
+/*
+ * flightlogToData: Unpacks a record into a second of data
+ *****************************************************************************
+ */
+
+void flightlogToData(const struct flightlog_record *rec, struct data_second *data) {
+  memset(data, 0, sizeof(*data));
+
+  data->elapsed = rec->elapsed;
+  data->counts = rec->counts;
+  data->T = rec->T;
+  data->T1 = rec->T1;
+  data->P = rec->P;
+  data->P1 = rec->P1;
+  data->P2 = rec->P2;
+  data->altitude = rec->altitude;
+  data->deadTime = rec->deadTime;
+  data->deadCounts = rec->deadCounts;
+  data->flags = rec->flags;
+}
+
+/*
+ * flightlogOpen: Creates a new log, <prefix>_000.bin, and writes its
+ *                header to disk.  It moves on to a new segment every
+ *                segRecords records.
+ *                Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int flightlogOpen(struct flightlog *log, const char *prefix, const struct flightlog_header *hdr, long segRecords) {
+  log->hdr = *hdr;
+  log->seq = 0;
+  log->buffered = 0;
+
+  return logsegOpen(&log->seg, prefix, ".bin", sizeof(log->hdr) + segRecords * sizeof(struct flightlog_record), &log->hdr, sizeof(log->hdr));
+}
+
+/*
+ * flightlogWrite: Adds a second of data.  It is only held in memory
+ *                 until the buffer fills or flightlogSync() is called.
+ *                 Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int flightlogWrite(struct flightlog *log, const struct data_second *data) {
+  int result = 0;
+
+  // Make room first
+  if (log->buffered == FLIGHTLOG_BUFFER)
+    result = flightlogSync(log);
+
+  flightlogFromData(&log->buf[log->buffered++], log->seq++, data);
+
+  return result;
+}
+
+/*
+ * flightlogSync: Writes out every buffered record and waits for it to
+ *                reach the card
+ *                Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int flightlogSync(struct flightlog *log) {
+  int count = log->buffered;
+  int done = 0, n, result = 0;
+  long long fit;
+
+  if (count == 0)
+    return 0;
+
+  // Whatever happens, don't write the same records twice
+  log->buffered = 0;
+
+  // Fill up this segment, and start the next one with the rest
+  while (done < count) {
+    fit = logsegRemaining(&log->seg) / (long long)sizeof(log->buf[0]);
+    n = count - done;
+    if ((fit > 0) && (fit < n))
+      n = fit;
+
+    if (logsegWrite(&log->seg, &log->buf[done], n * sizeof(log->buf[0])) < 0)
+      result = -1;
+    done += n;
+  }
+
+  if (logsegSync(&log->seg) < 0)
+    result = -1;
+
+  return result;
+}
+
+/*
+ * flightlogClose: Syncs any buffered records and closes the log
+ *                 Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int flightlogClose(struct flightlog *log) {
+  int result;
+
+  result = flightlogSync(log);
+  if (logsegClose(&log->seg) < 0)
+    result = -1;
+
+  return result;
+}
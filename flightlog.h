@@ -0,0 +1,92 @@
+/*
+ *****************************************************************************
+ * flightlog.h:  compact binary flight log of STAR data.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef FLIGHTLOG_H
+#define FLIGHTLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "star_data.h"
+#include "logseg.h"
+
+#define FLIGHTLOG_MAGIC    "STARLOG"  // Seven characters and a NUL
+#define FLIGHTLOG_VERSION  1
+
+// Records held in memory between writes to disk
+#define FLIGHTLOG_BUFFER   64
+
+// Written once at the start of the file.  Everything needed to
+// recompute T and P from the raw values travels with the data.
+struct flightlog_header {
+  char magic[8];          // FLIGHTLOG_MAGIC
+  uint16_t version;       // FLIGHTLOG_VERSION
+  uint16_t headerSize;    // sizeof(struct flightlog_header)
+  uint16_t recordSize;    // sizeof(struct flightlog_record)
+  uint16_t reserved;
+  double qff;             // Sea level pressure used for altitude, mbar
+  uint32_t C[8];          // Altimeter PROM: factory data, C1..C6 and CRC
+  char started[32];       // Local date and time the run started
+  uint32_t reserved2;
+  uint32_t crc;           // CRC-32 of everything above
+};
+
+// A single second.  Fields are ordered so there is no padding.
+struct flightlog_record {
+  double elapsed;         // Seconds since the run epoch
+  double T1;              // Temperature, C
+  double P1;              // First order pressure, mbar
+  double P2;              // Second order pressure, mbar
+  double deadTime;        // Total dead time, seconds
+  uint32_t seq;           // Record number, from 0
+  uint32_t T;             // Raw temperature
+  uint32_t P;             // Raw pressure
+  int32_t counts;         // -1 if HV was off
+  int32_t deadCounts;     // -1 if HV was off
+  float altitude;         // Meters
+  uint32_t flags;         // DATA_*
+  uint32_t crc;           // CRC-32 of everything above
+};
+
+// An open log being written, as a series of segments that each
+// start with the same header
+struct flightlog {
+  struct logseg seg;
+  struct flightlog_header hdr;
+  uint32_t seq;                                       // Next record number
+  int buffered;                                       // Records in buf
+  struct flightlog_record buf[FLIGHTLOG_BUFFER];
+};
+
+uint32_t flightlogCRC(const void *data, unsigned long len);
+void flightlogHeader(struct flightlog_header *hdr, const int C[8], double qff, const char *started);
+bool flightlogHeaderValid(const struct flightlog_header *hdr);
+bool flightlogRecordValid(const struct flightlog_record *rec);
+void flightlogFromData(struct flightlog_record *rec, uint32_t seq, const struct data_second *data);
+void flightlogToData(const struct flightlog_record *rec, struct data_second *data);
+
+int flightlogOpen(struct flightlog *log, const char *prefix, const struct flightlog_header *hdr, long segRecords);
+int flightlogWrite(struct flightlog *log, const struct data_second *data);
+int flightlogSync(struct flightlog *log);
+int flightlogClose(struct flightlog *log);
+
+#endif
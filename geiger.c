@@ -33,8 +33,22 @@
 #include <time.h>
 #include <math.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
 #include <wiringPi.h>
 #include "star_common.h"
+#include "pulse.h"
+#include "history.h"
+#include "deadtime.h"
+#include "seqlock.h"
+#include "realtime.h"
+#include "latency.h"
+#include "sim.h"
+#include "geiger.h"
 
 #ifdef DEBUG
   #define DEBUG_PRINT(...) do { fprintf(stderr, __VA_ARGS__); } while(false)
@@ -48,138 +62,446 @@
   #define DEBUG2_PRINT(...) do { } while (false)
 #endif
 
-static int size = 60;           // Array size
+static int size = HISTORY_SECONDS_SIZE; // Seconds kept in the history
+
+// One Geiger tube, with everything needed to count it on its own.  Each
+// channel has its own edge ring, count thread, lock and history, so a
+// busy tube never holds up another one.
+struct geiger_channel {
+  int index;                    // Which channel this is
+  int pin;                      // wiringPi pin the tube is on
+  int lineFd;                   // GPIO character device line, if in use
+  bool rtApplied;               // Has the wiringPi ISR thread been set up?
+  pthread_mutex_t lock;         // Only one thread at a time may write t1/t2/hist
+  struct seqlock histLock;      // Lets readers copy hist/widths without blocking
+  unsigned long long t1, t2;    // Used for dead time calculations
+  struct history hist;          // Counts and dead time at 100 ms, 1 s, 1 min, 1 h
+  struct width_stats widths;    // Every believable pulse width since geigerReset()
+  atomic_ullong countedNS;      // countThread() has counted every edge in the ring before this
+
+  // Raw edges waiting to be processed.  The capture path is the only
+  // writer and countThread() the only reader, so no lock is needed.
+  struct pulse_ring edgeRing;
+  struct pulse_edge edgeBuf[8192];
+
+  // When each pulse started, for coincidenceThread(), the same way
+  struct pulse_ring startRing;
+  struct pulse_edge startBuf[1024];
+};
+
+static struct geiger_channel channels[GEIGER_MAX_CHANNELS];
+static int numChannels = 1;
+
+// The first tube is the one everything without a channel refers to
+static struct geiger_channel *primary = &channels[0];
+
+// Every channel counts from the same epoch, and readers of any channel
+// see it (and the HV state) consistently, since geigerReset() and
+// setHVState() change them inside every channel's histLock write
+volatile unsigned long long epochNS; // CLOCK_MONOTONIC time of second zero
+static int deadTimeModel = DEADTIME_NONPARALYZABLE;
+
+// Coincidences, pulses on at least coincNeeded channels no more than
+// coincWindow apart.  Only coincidenceThread() writes coincHist.
+static unsigned long long coincWindow = 10000; // ns
+static int coincNeeded = 2;
+static struct history coincHist;
+static struct seqlock coincLock;
+static pthread_mutex_t lock_coinc;
+static atomic_ulong coincLate;  // Pulses that turned up after their window was decided
+static atomic_ulong coincDropped; // Pulses that never got to coincidenceThread()
+
+// Conversion factor for SBM-20 tube
+// From https://sites.google.com/site/diygeigercounter/gm-tubes-supported
+//static const float uSvFactor = 0.0057;
+
+// Conversion factor for SBM-20 tube
+// From https://www.uradmonitor.com/topic/hardware-conversion-factor/
+// This one gave results consistent with another portable radiation
+// monitor I had available (within 1-2%).
+static const float uSvFactor = 0.006315;
 
-volatile int secNum;            // Which index in the seconds array
-volatile int sec[60];           // Array of collected counts per second
-
-volatile int LEDTime;           // How much time is left to light LED
 volatile bool LEDisOn;          // Is LED on?
 volatile bool keepRunning;      // Signals when to exit
 volatile bool HVisOn;           // Is HV on?
+volatile unsigned long long HVChangeNS; // When HVisOn last changed
 
-volatile unsigned long long t1, t2; // Used for dead time calculations
-volatile double deadTime[60];       // Array of dead time totals per secons
-volatile int deadCounts[60];
-
-pthread_mutex_t lock_sec;       // Prevent a race condition involving secNum read/write
 pthread_mutex_t lock_hv;        // Prevent a race condition involving HVisOn read/write
-pthread_mutex_t lock_count;     // Prevent a race condition involving t1/t2 read/write
-pthread_mutex_t lock_led;       // Prevent a race condition involving LEDTime read/write
+pthread_mutex_t lock_led;       // Prevent a race condition involving the LED pin and LEDisOn
+
+// How edges are captured, see geigerSetCapture()
+static int captureBackend = GEIGER_CAPTURE_WIRINGPI;
+static const char *gpioChip = "/dev/gpiochip0";
 
 // Initialize the GPIO pins.  Note that these are not the BCM GPIO pin
 // numbers or the physical header pin numbers!  Conversion table is at
 // http://wiringpi.com/pins/
 static int ledPin = 4;
-static int geigerPin = 5;
+static int geigerPins[GEIGER_MAX_CHANNELS] = { 5, 1, 2 };
 static int gatePin = 6;
 
 // How long to flash the LED when a count is recorded, in milliseconds
 static int flashTime = 5;
 
+// The LED stays lit until ledUntil (CLOCK_MONOTONIC ns).  blinkLED()
+// sleeps on ledWake while there is nothing to show, and is only woken
+// when a pulse arrives and finds it idle.
+static atomic_ullong ledUntil;
+static atomic_bool ledIdle;
+static int ledWake = -1;        // eventfd
+
 
 
 /*
- * getSecNum: Gets the current Geiger counting second.
+ * getSecNum: Gets the index of the current Geiger counting second.
  *****************************************************************************
  */
 
 int getSecNum(void) {
-  int ret;
+  return getIndex(getCurrentSec());
+}
+
+/*
+ * getCurrentSec: Gets the number of whole seconds since the run epoch set
+ *                by geigerReset().
+ *****************************************************************************
+ */
+
+long getCurrentSec(void) {
+  DEBUG2_PRINT("    getCurrentSec()\n");
+  return (getTimeNS() - getEpochNS()) / 1000000000ULL;
+}
+
+/*
+ * getEpochNS: Gets the CLOCK_MONOTONIC time, in nanoseconds, that the
+ *             current run's second zero began.
+ *****************************************************************************
+ */
 
-  pthread_mutex_lock(&lock_sec);
-  DEBUG2_PRINT("    getSecNum()\n");
-  DEBUG2_PRINT("        secNum: %d\n", secNum);
-  ret = secNum;
-  pthread_mutex_unlock(&lock_sec);
+unsigned long long getEpochNS(void) {
+  unsigned long long ret;
+  unsigned int seq;
+
+  do {
+    seq = seqlockReadBegin(&primary->histLock);
+    ret = epochNS;
+  } while (seqlockReadRetry(&primary->histLock, seq));
 
   return ret;
 }
 
 /*
- * setSecNum: Sets the current Geiger counting second
- *
- *            seconds is the elapsed seconds since start
+ * lockAll, unlockAll: Take and release every channel, in order, for the
+ *                     few changes that affect all of them at once
  *****************************************************************************
  */
 
-void setSecNum(unsigned long seconds) {
-  int numSecs = 0;
+static void lockAll(void) {
+  for (int i = 0; i < numChannels; i++) {
+    pthread_mutex_lock(&channels[i].lock);
+    seqlockWriteBegin(&channels[i].histLock);
+  }
+}
 
-  // Prevent other threads from clobbering this value
-  pthread_mutex_lock(&lock_count);
-  pthread_mutex_lock(&lock_sec);
-
-  DEBUG2_PRINT("    setSecNum(%ld)\n", seconds);
-  DEBUG2_PRINT("        seconds: %ld\n", seconds);
-
-  // We only care about the seconds buffer
-  numSecs = seconds % size;
-  DEBUG2_PRINT("        numSecs: %d\n", numSecs);
-
-  // If it's not the same second, initialize the array element
-  if (numSecs != secNum) {
-    sec[numSecs] = 0;
-    deadTime[numSecs] = 0;
-    deadCounts[numSecs] = 0;
-    // This is to prevent huge values of LEDTime when
-    // counting at high rates
-    if (LEDTime > 0) {
-      // Prevent other threads from clobbering this value
-      pthread_mutex_lock(&lock_led);
-      LEDTime = flashTime;
-      pthread_mutex_unlock(&lock_led);
-    }
+static void unlockAll(void) {
+  for (int i = numChannels - 1; i >= 0; i--) {
+    seqlockWriteEnd(&channels[i].histLock);
+    pthread_mutex_unlock(&channels[i].lock);
   }
-  secNum = numSecs;
+}
 
-  DEBUG2_PRINT("        secNum: %d\n", secNum);
+/*
+ * countPulse: Records a pulse on a channel that started at ns.
+ *             Must be called with the channel's lock held.
+ *****************************************************************************
+ */
+
+static void countPulse(struct geiger_channel *ch, unsigned long long ns) {
+  uint64_t one = 1;
 
-  pthread_mutex_unlock(&lock_sec);
-  pthread_mutex_unlock(&lock_count);
+  historyAdd(&ch->hist, ns - epochNS, 1, 0, 0.0);
 
+  // Hand it on to be matched against the other channels.  If that has
+  // fallen a whole ring behind, the pulse can't take part in a match.
+  if ((numChannels > 1) && !pulseRingPush(&ch->startRing, ns, PULSE_EDGE_FALLING))
+    atomic_fetch_add(&coincDropped, 1);
+
+  // Tell the LED to stay lit a little longer.  At high rates it just
+  // stays on.
+  atomic_store(&ledUntil, ns + flashTime * 1000000ULL);
+
+  // Only wake the LED thread if it's asleep
+  if (atomic_exchange(&ledIdle, false)) {
+    if (write(ledWake, &one, sizeof(one)) < 0) { }
+  }
 }
 
 /*
- * countInterrupt: Runs when a count is detected.
+ * captureEdge: Stamps an edge on a channel's pin and queues it for its
+ *              countThread(), so it never takes a lock.
+ *****************************************************************************
+ */
+
+static void captureEdge(struct geiger_channel *ch) {
+  struct timespec tim;
+
+  clock_gettime(CLOCK_MONOTONIC, &tim);
+
+  // wiringPi made this thread, so set it up the first time through
+  if (!ch->rtApplied) {
+    rtApply(RT_CAPTURE);
+    ch->rtApplied = true;
+  }
+
+  // wiringPi doesn't tell us which way the pin went
+  pulseRingPush(&ch->edgeRing, tim.tv_sec * 1000000000ULL + tim.tv_nsec, PULSE_EDGE_ANY);
+}
+
+/*
+ * countInterrupt: Runs when an edge is detected on the Geiger pin.
+ *                 wiringPi doesn't pass its handlers anything, so each
+ *                 channel has a handler of its own.
  *****************************************************************************
  */
 
 void countInterrupt(void) {
-  struct timespec tim1, tim2;
-  int numSec;
-  double dt_s;
+  captureEdge(&channels[0]);
+}
 
-  // Prevent other threads from clobbering this value
-  pthread_mutex_lock(&lock_count);
+static void countInterrupt1(void) {
+  captureEdge(&channels[1]);
+}
+
+static void countInterrupt2(void) {
+  captureEdge(&channels[2]);
+}
+
+static void (*const interrupts[GEIGER_MAX_CHANNELS])(void) = { countInterrupt, countInterrupt1, countInterrupt2 };
+
+/*
+ * edgeThread: Thread to read kernel-stamped edges from the GPIO character
+ *             device.  The kernel queues events with CLOCK_MONOTONIC
+ *             timestamps taken in its interrupt handler, so our wakeup
+ *             latency doesn't show up in the dead time, and a burst of
+ *             pulses comes back in one read().
+ *****************************************************************************
+ */
+
+void *edgeThread (void *vargp) {
+  struct geiger_channel *ch = vargp;
+  struct gpio_v2_line_event events[64];
+  struct pollfd pfd;
+  ssize_t len;
+  uint32_t type;
+
+  pfd.fd = ch->lineFd;
+  pfd.events = POLLIN;
+
+  rtApply(RT_CAPTURE);
+
+  while (keepRunning) {
+
+    // Wake up now and then to notice when we've been told to stop
+    if (poll(&pfd, 1, 100) <= 0)
+      continue;
 
-  numSec = getSecNum();
+    len = read(ch->lineFd, events, sizeof(events));
+    if (len < (ssize_t)sizeof(events[0])) {
+      DEBUG_PRINT("edgeThread() read: %s\n", strerror(errno));
+      continue;
+    }
+
+    for (size_t i = 0; i < len / sizeof(events[0]); i++) {
+      if (events[i].id == GPIO_V2_LINE_EVENT_FALLING_EDGE)
+        type = PULSE_EDGE_FALLING;
+      else
+        type = PULSE_EDGE_RISING;
+
+      pulseRingPush(&ch->edgeRing, events[i].timestamp_ns, type);
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * gpioLineOpen: Requests a Geiger pin from the GPIO character device
+ *               with edge detection on both edges.
+ *               Returns the line file descriptor, or -1 on error.
+ *****************************************************************************
+ */
+
+static int gpioLineOpen(int pin) {
+  struct gpio_v2_line_request req;
+  int fd;
+
+  if ((fd = open(gpioChip, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  memset(&req, 0, sizeof(req));
+
+  // The character device uses BCM numbering, not wiringPi numbering
+  req.offsets[0] = wpiPinToGpio(pin);
+  req.num_lines = 1;
+  req.event_buffer_size = 1024;
+  strncpy(req.consumer, "star-geiger", sizeof(req.consumer) - 1);
+
+  // Input, both edges, pull up/down resistors off
+  req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+                     GPIO_V2_LINE_FLAG_EDGE_RISING |
+                     GPIO_V2_LINE_FLAG_EDGE_FALLING |
+                     GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+
+  if (ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  // The line has its own descriptor, we don't need the chip any more
+  close(fd);
+
+  return req.fd;
+}
+
+/*
+ * simEdge: Queues an edge from the simulator.  There's only the one
+ *          simulated tube, so every channel sees it, as if every
+ *          particle went through all of them.
+ *****************************************************************************
+ */
+
+static void simEdge(uint64_t ns, uint32_t type) {
+  for (int i = 0; i < numChannels; i++) {
+    pulseRingPush(&channels[i].edgeRing, ns, type);
+  }
+}
+
+/*
+ * simThread: Thread to feed simulated edges into the ring, in batches,
+ *            each stamped with the moment it "happened".  This is much
+ *            like reading line events from the kernel.
+ *****************************************************************************
+ */
+
+void *simThread (void *vargp) {
+  struct timespec tim;
+  tim.tv_sec = 0;
+  tim.tv_nsec = 1000000;              // 1 ms
+
+  rtApply(RT_CAPTURE);
+
+  while (keepRunning) {
+    simEdges(getTimeNS(), simEdge);
+    nanosleep(&tim, NULL);
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * geigerSetCapture: Chooses how Geiger edges are captured.  Must be
+ *                   called before geigerSetup().
+ *
+ *                   GEIGER_CAPTURE_WIRINGPI uses wiringPiISR()
+ *                   GEIGER_CAPTURE_GPIOCDEV uses GPIO line events from
+ *                   chip (NULL for /dev/gpiochip0)
+ *                   GEIGER_CAPTURE_SIM takes edges from the simulator,
+ *                   see simConfigure() and simStart()
+ *                   GEIGER_CAPTURE_OFFLINE touches no hardware at all,
+ *                   counts come from a recording via geigerAddCounts()
+ *****************************************************************************
+ */
+
+void geigerSetCapture(int backend, const char *chip) {
+  captureBackend = backend;
+
+  if (chip != NULL) {
+    gpioChip = chip;
+  }
+}
+
+/*
+ * getCaptureName: Describes the capture backend in use.
+ *****************************************************************************
+ */
+
+const char *getCaptureName(void) {
+  if (captureBackend == GEIGER_CAPTURE_GPIOCDEV)
+    return "gpio line events";
+  if (captureBackend == GEIGER_CAPTURE_SIM)
+    return "simulator";
+  if (captureBackend == GEIGER_CAPTURE_OFFLINE)
+    return "offline";
+  return "wiringPiISR";
+}
+
+/*
+ * geigerAddCounts: Adds counts and dead time that were already binned to
+ *                  the second starting at ns, as read back from a flight
+ *                  log.  Everything that reads the history then sees
+ *                  them just as if the pulses had been counted live.
+ *****************************************************************************
+ */
+
+void geigerAddCounts(unsigned long long ns, int counts, int deadCounts, double deadTime) {
+
+  // Nothing was counted before the epoch
+  if (ns < epochNS)
+    return;
+
+  pthread_mutex_lock(&primary->lock);
+  seqlockWriteBegin(&primary->histLock);
+  historyAdd(&primary->hist, ns - epochNS, counts, deadCounts, deadTime);
+  seqlockWriteEnd(&primary->histLock);
+  pthread_mutex_unlock(&primary->lock);
+}
+
+/*
+ * processEdge: Pairs falling and rising edges into counts and dead time.
+ *              Must be called with the channel's lock held, inside a
+ *              histLock write.
+ *****************************************************************************
+ */
+
+static void processEdge(struct geiger_channel *ch, const struct pulse_edge *edge) {
+  double dt_s;
+
+  // This edge arrived before the last geigerReset()
+  if (edge->ns < epochNS)
+    return;
 
   // Waiting for the falling edge
-  if (t1 == 0) {
-    clock_gettime(CLOCK_MONOTONIC, &tim1);
+  if (ch->t1 == 0) {
 
-    // Increment the counter
-    sec[numSec]++;
+    // A rising edge with no pulse in progress isn't a count
+    if (edge->type == PULSE_EDGE_RISING) {
+      DEBUG_PRINT("rising edge while idle\n");
+      return;
+    }
 
-    // Prevent other threads from clobbering this value
-    pthread_mutex_lock(&lock_led);
-    LEDTime += flashTime;             // Tell the LED to turn on
-    pthread_mutex_unlock(&lock_led);
+    // Increment the counter
+    countPulse(ch, edge->ns);
 
     // Set the time that the falling pulse began and wait
     // for a rising edge
-    t1 = t2 = tim1.tv_sec * 1000000000 + tim1.tv_nsec;
+    ch->t1 = ch->t2 = edge->ns;
   }
   // Waiting for the rising edge
-  else if (t1 == t2) {
-    clock_gettime(CLOCK_MONOTONIC, &tim2);
+  else if (ch->t1 == ch->t2) {
+
+    // A falling edge here means the rising edge was lost, so this
+    // is really the start of the next pulse
+    if (edge->type == PULSE_EDGE_FALLING) {
+      countPulse(ch, edge->ns);
+      ch->t1 = ch->t2 = edge->ns;
+      return;
+    }
 
     // Set the time that the rising pulse began
-    t2 = tim2.tv_sec * 1000000000 + tim2.tv_nsec;
+    ch->t2 = edge->ns;
 
     // Get the time distance between the two
-    dt_s = (t2 - t1) / 1000000000.0;
+    dt_s = (ch->t2 - ch->t1) / 1000000000.0;
 
     // The time distance was positive
     if (dt_s > 0) {
@@ -188,35 +510,260 @@ void countInterrupt(void) {
       // four times the dead time of the tube
       if (dt_s <= 0.000800) {
 
-        // Tally the dead time
-        deadCounts[numSec] += 1;
-        deadTime[numSec] += dt_s;
-        DEBUG_PRINT("    getSecNum() = %d: %lf %lf\n", numSec, dt_s, deadTime[numSec]);
+        // Tally the dead time in the same bins as its count
+        historyAdd(&ch->hist, ch->t1 - epochNS, 0, 1, dt_s);
+        widthStatsAdd(&ch->widths, dt_s);
+        DEBUG_PRINT("    dead time: %lf\n", dt_s);
 
         // Reset and wait for a falling edge
-        t1 = 0;
+        ch->t1 = 0;
       }
 
       // The time distance wasn't realistic
+      else if (edge->type == PULSE_EDGE_RISING) {
+        // The pulse really did end here, it was just too long to
+        // trust as dead time.  Wait for the next falling edge.
+        ch->t1 = 0;
+      }
       else {
         // Assume we somehow got double falling/rising edges.
         // We don't know which, but we're out of phase,
         // so start the timer over at this point
-        t1 = t2;
+        ch->t1 = ch->t2;
       }
     }
     // The time distance was negative, I don't know how to handle this.
     // It shouldn't be happening, but I have seen it with CLOCK_REALTIME
     else {
-      DEBUG_PRINT("%lld < %lld\n", t2, t1);
+      DEBUG_PRINT("%lld < %lld\n", ch->t2, ch->t1);
     }
   }
   // This state should be impossible, which means it's probable.
   else {
       DEBUG_PRINT("t1 != t2\n");
   }
+}
 
-  pthread_mutex_unlock(&lock_count);
+/*
+ * countThread: Thread to drain the edge ring and do the counting.
+ *****************************************************************************
+ */
+
+void *countThread (void *vargp) {
+  struct geiger_channel *ch = vargp;
+  struct pulse_edge edge;
+  unsigned long long locked;        // When the channel's lock was taken
+  unsigned long long now;           // When we started draining the ring
+
+  // Set up nanosleep() for preventing 100% CPU use
+  struct timespec tim;
+  tim.tv_sec = 0;
+  tim.tv_nsec = 1000000;              // 1 ms
+
+  rtApply(RT_COUNT);
+
+  while (keepRunning) {
+
+    // Anything captured before now is in the ring, or soon will be
+    now = getTimeNS();
+
+    // Process everything that has arrived since we last looked
+    if (pulseRingPop(&ch->edgeRing, &edge)) {
+
+      // Prevent other threads from clobbering these values
+      pthread_mutex_lock(&ch->lock);
+      locked = getTimeNS();
+      do {
+        // How long the edge sat waiting to be counted
+        if (edge.ns < locked)
+          latRecord(LAT_EDGE, locked - edge.ns);
+
+        // One edge per write, so readers never wait long
+        seqlockWriteBegin(&ch->histLock);
+        processEdge(ch, &edge);
+        seqlockWriteEnd(&ch->histLock);
+      } while (pulseRingPop(&ch->edgeRing, &edge));
+      latRecord(LAT_COUNT, getTimeNS() - locked);
+      pthread_mutex_unlock(&ch->lock);
+    }
+
+    // Let geigerWaitCounted() know how far we've got
+    atomic_store_explicit(&ch->countedNS, now, memory_order_release);
+
+    nanosleep(&tim, NULL);
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * geigerWaitCounted: Waits until every channel's countThread() has
+ *                    counted the edges captured up to ns, so a second
+ *                    that ended at ns can be read whole.  Gives up after
+ *                    COUNT_WAIT, in case a count thread is stuck.
+ *                    Returns false if it gave up.
+ *****************************************************************************
+ */
+
+#define COUNT_WAIT     100000000ULL  // Longest to wait for the count threads, ns
+
+bool geigerWaitCounted(unsigned long long ns) {
+  unsigned long long until = getTimeNS() + COUNT_WAIT;
+  struct timespec tim;
+  tim.tv_sec = 0;
+  tim.tv_nsec = 200000;               // 200 us
+
+  for (int i = 0; i < numChannels; i++) {
+    while (atomic_load_explicit(&channels[i].countedNS, memory_order_acquire) < ns) {
+      if (getTimeNS() >= until)
+        return false;
+      nanosleep(&tim, NULL);
+    }
+  }
+
+  return true;
+}
+
+/*
+ * coincPending: Pulses a channel has handed to coincidenceThread() that
+ *               haven't been matched up yet, oldest first
+ *****************************************************************************
+ */
+
+#define COINC_PENDING  256      // Per channel, a power of two
+#define COINC_SETTLE   20000000ULL  // Longest a pulse can take to come through, ns
+
+struct coinc_pending {
+  unsigned long long ns[COINC_PENDING];
+  unsigned int head, tail;
+};
+
+/*
+ * coincRecord: Counts a coincidence that started at ns
+ *****************************************************************************
+ */
+
+static void coincRecord(unsigned long long ns) {
+  pthread_mutex_lock(&lock_coinc);
+  if (ns >= epochNS) {
+    seqlockWriteBegin(&coincLock);
+    historyAdd(&coincHist, ns - epochNS, 1, 0, 0.0);
+    seqlockWriteEnd(&coincLock);
+  }
+  pthread_mutex_unlock(&lock_coinc);
+}
+
+/*
+ * coincidenceThread: Thread to match pulses across channels.
+ *
+ *                    Each channel's pulses arrive in order on its own
+ *                    ring, so the oldest pulse waiting on any channel is
+ *                    matched against the oldest on every other one.  A
+ *                    pulse is only decided once every channel has had
+ *                    time to report anything within the window of it,
+ *                    so nothing here ever waits on a count thread.
+ *****************************************************************************
+ */
+
+void *coincidenceThread (void *vargp) {
+  static struct coinc_pending pend[GEIGER_MAX_CHANNELS];
+  struct pulse_edge start;
+  unsigned long long horizon, decided = 0, t0 = 0;
+  unsigned int mask;
+  int first, hits;
+
+  // Set up nanosleep() for preventing 100% CPU use
+  struct timespec tim;
+  tim.tv_sec = 0;
+  tim.tv_nsec = 1000000;              // 1 ms
+
+  rtApply(RT_COINC);
+
+  memset(pend, 0, sizeof(pend));
+
+  while (keepRunning) {
+
+    // Collect what every channel has counted since we last looked.  A
+    // full pending queue leaves the rest on the start ring, so anything
+    // that can't be kept is counted by countPulse() as it's dropped.
+    for (int c = 0; c < numChannels; c++) {
+      while ((pend[c].tail - pend[c].head < COINC_PENDING) && pulseRingPop(&channels[c].startRing, &start)) {
+        if (start.ns < decided)
+          atomic_fetch_add(&coincLate, 1);
+        else
+          pend[c].ns[pend[c].tail++ % COINC_PENDING] = start.ns;
+      }
+    }
+
+    // Anything older than this has had plenty of time to be counted
+    horizon = getTimeNS() - coincWindow - COINC_SETTLE;
+
+    while (true) {
+
+      // The oldest pulse waiting on any channel
+      first = -1;
+      for (int c = 0; c < numChannels; c++) {
+        if ((pend[c].head != pend[c].tail) && ((first < 0) || (pend[c].ns[pend[c].head % COINC_PENDING] < t0))) {
+          first = c;
+          t0 = pend[c].ns[pend[c].head % COINC_PENDING];
+        }
+      }
+      if ((first < 0) || (t0 > horizon))
+        break;
+
+      // Every channel with a pulse close enough after it
+      mask = 0;
+      hits = 0;
+      for (int c = 0; c < numChannels; c++) {
+        if ((pend[c].head != pend[c].tail) && (pend[c].ns[pend[c].head % COINC_PENDING] - t0 <= coincWindow)) {
+          mask |= 1U << c;
+          hits++;
+        }
+      }
+
+      // Each pulse takes part in one coincidence at most
+      if (hits >= coincNeeded) {
+        coincRecord(t0);
+        for (int c = 0; c < numChannels; c++) {
+          if (mask & (1U << c))
+            pend[c].head++;
+        }
+      }
+      else {
+        pend[first].head++;
+      }
+      decided = t0;
+    }
+
+    nanosleep(&tim, NULL);
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * getDroppedEdges: How many edges were lost because a countThread() fell
+ *                  too far behind, on every channel.
+ *****************************************************************************
+ */
+
+unsigned int getDroppedEdges(void) {
+  unsigned int dropped = 0;
+
+  for (int i = 0; i < numChannels; i++) {
+    dropped += pulseRingDropped(&channels[i].edgeRing);
+  }
+
+  return dropped;
+}
+
+/*
+ * channelDroppedEdges: How many edges were lost on one channel
+ *****************************************************************************
+ */
+
+unsigned int channelDroppedEdges(int channel) {
+  return pulseRingDropped(&channels[channel].edgeRing);
 }
 
 /*
@@ -247,44 +794,42 @@ void LEDOff(void) {
 
   digitalWrite(ledPin, LOW); // Turn off the LED
   LEDisOn = false;           // The LED is now off
-  LEDTime = 0;               // Set remaining blink time to zero
+  atomic_store(&ledUntil, 0); // Nothing left to show
 
   pthread_mutex_unlock(&lock_led);
 }
 
 /*
  * blinkLED: Thread to handle LED blinking.
+ *
+ *           Sleeps until the LED is due to go off, or, when there is
+ *           nothing to show, until countPulse() wakes it.
  *****************************************************************************
  */
 
 void *blinkLED (void *vargp) {
-
-  // Set up nanosleep() for blinking
+  unsigned long long until;
+  uint64_t wakes;
   struct timespec tim;
-  tim.tv_sec = 0;
-  tim.tv_nsec = flashTime * 1000000;  // Convert from ns to ms
-
-  // Set up nanosleep() for preventing 100% CPU use
-  struct timespec tim2;
-  tim2.tv_sec = 0;
-  tim2.tv_nsec = 1000000;            // 1 ms
 
   LEDisOn = false;                   // LED is off by default
 
+  rtApply(RT_LED);
+
   while (keepRunning) {
+    until = atomic_load(&ledUntil);
 
     // If the LED is supposed to be lit
-    while (LEDTime > 0) {
+    if (getTimeNS() < until) {
       if (!LEDisOn) {
         LEDOn();                  // Turn on the LED
       }
 
-      // Prevent other threads from clobbering this value
-      pthread_mutex_lock(&lock_led);
-      LEDTime -= flashTime;       // Subtract the time it will be lit
-      pthread_mutex_unlock(&lock_led);
-
-      nanosleep(&tim, NULL);      // Sleep for flashTime ms
+      // Sleep until it's due to go off, then look again
+      tim.tv_sec = until / 1000000000ULL;
+      tim.tv_nsec = until % 1000000000ULL;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tim, NULL);
+      continue;
     }
 
     // If the LED is not supposed to be lit
@@ -292,8 +837,16 @@ void *blinkLED (void *vargp) {
       LEDOff();                   // Turn off the LED
     }
 
-    // Prevent this thread from using 100% CPU
-    nanosleep(&tim2, NULL);
+    // Say we're going to sleep, then check a pulse didn't sneak in
+    // before anyone could see that
+    atomic_store(&ledIdle, true);
+    if (getTimeNS() < atomic_load(&ledUntil)) {
+      atomic_store(&ledIdle, false);
+      continue;
+    }
+
+    // Sleep until there's a pulse (or geigerStop())
+    if (read(ledWake, &wakes, sizeof(wakes)) < 0) { }
   }
 
   // Turn off the LED before exiting the thread
@@ -306,7 +859,7 @@ void *blinkLED (void *vargp) {
  *****************************************************************************
  */
 
-int getIndex(int numIndex) {
+int getIndex(long numIndex) {
 
   // Make sure our number is a valid index
   numIndex = numIndex % size;
@@ -321,20 +874,108 @@ int getIndex(int numIndex) {
 }
 
 
+/*
+ * channelStatsRange: Get a consistent snapshot of the counts, dead time
+ *                    and HV state of seconds first..last on one channel.
+ *                    Never blocks the pulse path, the copy is simply
+ *                    retried if a pulse lands while it's being taken.
+ *****************************************************************************
+ */
+
+void channelStatsRange(int channel, long first, long last, struct geiger_stats *stats) {
+  struct geiger_channel *ch = &channels[channel];
+  struct history_bin total;
+  unsigned long long epoch, changed;
+  unsigned int seq;
+  bool hvOn;
+
+  do {
+    seq = seqlockReadBegin(&ch->histLock);
+    historySum(&ch->hist, HISTORY_SECONDS, first, last, &total);
+    epoch = epochNS;
+    hvOn = HVisOn;
+    changed = HVChangeNS;
+  } while (seqlockReadRetry(&ch->histLock, seq));
+
+  stats->first = first;
+  stats->last = last;
+  stats->startNS = epoch + (first > 0 ? first : 0) * 1000000000ULL;
+  stats->counts = total.counts;
+  stats->deadCounts = total.deadCounts;
+  stats->deadTime = total.deadTime;
+  stats->hvOn = hvOn;
+
+  // Did HV change while these seconds were being counted?
+  stats->hvSteady = (changed <= stats->startNS);
+}
+
+/*
+ * getStatsRange: Get a consistent snapshot of seconds first..last on the
+ *                first channel
+ *****************************************************************************
+ */
+
+void getStatsRange(long first, long last, struct geiger_stats *stats) {
+  channelStatsRange(0, first, last, stats);
+}
+
+/*
+ * getCoincidences: Get the number of coincidences in seconds first..last
+ *****************************************************************************
+ */
+
+int getCoincidences(long first, long last) {
+  struct history_bin total;
+  unsigned int seq;
+
+  do {
+    seq = seqlockReadBegin(&coincLock);
+    historySum(&coincHist, HISTORY_SECONDS, first, last, &total);
+  } while (seqlockReadRetry(&coincLock, seq));
+
+  return total.counts;
+}
+
+/*
+ * getCoincLate: How many pulses reached coincidenceThread() too late to
+ *               be matched
+ *****************************************************************************
+ */
+
+unsigned long getCoincLate(void) {
+  return atomic_load(&coincLate);
+}
+
+/*
+ * getCoincDropped: How many pulses were dropped before coincidenceThread()
+ *                  could match them, because it fell too far behind
+ *****************************************************************************
+ */
+
+unsigned long getCoincDropped(void) {
+  return atomic_load(&coincDropped);
+}
+
+/*
+ * getStats: Get a consistent snapshot of a single second.
+ *****************************************************************************
+ */
+
+void getStats(long numSecs, struct geiger_stats *stats) {
+  getStatsRange(numSecs, numSecs, stats);
+}
+
 /*
  * getDeadTime: Get the dead time associated with a given second.
  *****************************************************************************
  */
 
-double getDeadTime(int numSecs) {
-  double ret;
+double getDeadTime(long numSecs) {
+  struct geiger_stats stats;
 
-  // Prevent other threads from clobbering this value
-  pthread_mutex_lock(&lock_count);
-  ret = deadTime[numSecs % size];
-  pthread_mutex_unlock(&lock_count);
+  getStats(numSecs, &stats);
 
-  return ret;
+  return stats.deadTime;
 }
 
 /*
@@ -342,15 +983,12 @@ double getDeadTime(int numSecs) {
  *****************************************************************************
  */
 
-int getDeadCounts(int numSecs) {
-  int ret;
+int getDeadCounts(long numSecs) {
+  struct geiger_stats stats;
 
-  // Prevent other threads from clobbering this value
-  pthread_mutex_lock(&lock_count);
-  ret = deadCounts[numSecs % size];
-  pthread_mutex_unlock(&lock_count);
+  getStats(numSecs, &stats);
 
-  return ret;
+  return stats.deadCounts;
 }
 
 /*
@@ -358,34 +996,166 @@ int getDeadCounts(int numSecs) {
  *****************************************************************************
  */
 
-int getCounts(int numSecs) {
-  int ret;
+int getCounts(long numSecs) {
+  struct geiger_stats stats;
 
-  // Prevent other threads from clobbering this value
-  pthread_mutex_lock(&lock_count);
-  ret = sec[numSecs % size];
-  pthread_mutex_unlock(&lock_count);
+  getStats(numSecs, &stats);
 
-  return ret;
+  return stats.counts;
 }
 
 /*
- * sumCounts: Sum the number of counts across the last numSecs seconds.
+ * getHistory: Get a consistent copy of the whole count history, and the
+ *             epoch it counts from.  The copy can be queried with
+ *             historyGet() and historySum() like the original.
  *****************************************************************************
  */
 
-int sumCounts(int numSecs) {
-  DEBUG2_PRINT("sumCounts(%d)\n", numSecs);
+void getHistory(struct history *dst, unsigned long long *epoch) {
+  unsigned int seq;
 
-  int total = 0;
+  do {
+    seq = seqlockReadBegin(&primary->histLock);
+    *dst = primary->hist;
+    *epoch = epochNS;
+  } while (seqlockReadRetry(&primary->histLock, seq));
 
-  // Sum seconds
-  for (int i=0; i < numSecs; i++) {
-    total += sec[getIndex(getSecNum() - i)];
+  historyRelink(dst);
+}
+
+/*
+ * getHistoryUpdate: Bring a copy taken with getHistory() up to date,
+ *                   copying only what has changed since.  Far less is
+ *                   read under the lock than with getHistory(), so a
+ *                   busy tube doesn't keep making it start over.  If the
+ *                   epoch has moved, the counting has been reset and the
+ *                   whole history is copied again.
+ *****************************************************************************
+ */
+
+void getHistoryUpdate(struct history *dst, unsigned long long *epoch) {
+  long have[HISTORY_LEVELS];
+  unsigned int seq;
+
+  for (int l = 0; l < HISTORY_LEVELS; l++) {
+    have[l] = dst->levels[l].lastBin;
+  }
+
+  do {
+    seq = seqlockReadBegin(&primary->histLock);
+
+    if (*epoch != epochNS) {
+      *dst = primary->hist;
+      historyRelink(dst);
+    }
+    else {
+      // A torn attempt may have moved these on
+      for (int l = 0; l < HISTORY_LEVELS; l++) {
+        dst->levels[l].lastBin = have[l];
+      }
+      historyUpdate(dst, &primary->hist);
+    }
+    *epoch = epochNS;
+  } while (seqlockReadRetry(&primary->histLock, seq));
+}
+
+/*
+ * getCountsAt: Get the number of counts in a given bin of a given
+ *              resolution (HISTORY_TENTHS .. HISTORY_HOURS).
+ *              Returns -1 if the bin has aged out of the history.
+ *****************************************************************************
+ */
+
+int getCountsAt(int level, long bin) {
+  struct history_bin b;
+  unsigned int seq;
+  bool kept;
+
+  do {
+    seq = seqlockReadBegin(&primary->histLock);
+    historyGet(&primary->hist, level, bin, &b);
+    kept = historyKept(&primary->hist, level, bin);
+  } while (seqlockReadRetry(&primary->histLock, seq));
+
+  return kept ? b.counts : -1;
+}
+
+/*
+ * sumWindowAt: Sum the counts and dead time across the last numBins bins
+ *              of a given resolution, including the one in progress.
+ *****************************************************************************
+ */
+
+static void sumWindowAt(int level, long numBins, struct history_bin *total) {
+  unsigned long long now = getTimeNS();
+  unsigned int seq;
+  long curBin;
+
+  // We can't look back further than the resolution is kept
+  if (numBins > historySize(level) - 1)
+    numBins = historySize(level) - 1;
+
+  // A consistent sum without holding up countThread()
+  do {
+    seq = seqlockReadBegin(&primary->histLock);
+    curBin = (now - epochNS) / historyWidth(level);
+    historySum(&primary->hist, level, curBin - numBins + 1, curBin, total);
+  } while (seqlockReadRetry(&primary->histLock, seq));
+}
+
+/*
+ * sumCountsAt: Sum the number of counts across the last numBins bins of a
+ *              given resolution, including the one in progress.
+ *****************************************************************************
+ */
+
+int sumCountsAt(int level, long numBins) {
+  struct history_bin total;
+
+  sumWindowAt(level, numBins, &total);
+
+  return total.counts;
+}
+
+/*
+ * windowLevel: Pick the finest resolution that still holds all of the
+ *              last numSecs seconds, and how many of its bins that is.
+ *****************************************************************************
+ */
+
+static int windowLevel(int numSecs, long *numBins) {
+  unsigned long long span = numSecs * 1000000000ULL;
+  unsigned long long width;
+  int level;
+
+  for (level = HISTORY_SECONDS; level < HISTORY_LEVELS - 1; level++) {
+    if (span <= historyWidth(level) * (historySize(level) - 1))
+      break;
   }
 
-  return total;
+  // Round up to whole bins, but no more than are kept
+  width = historyWidth(level);
+  *numBins = (span + width - 1) / width;
+  if (*numBins > historySize(level) - 1)
+    *numBins = historySize(level) - 1;
+
+  return level;
+}
+
+/*
+ * sumCounts: Sum the number of counts across the last numSecs seconds.
+ *            Windows longer than the 1 s history are rounded up to whole
+ *            minutes or hours.
+ *****************************************************************************
+ */
+
+int sumCounts(int numSecs) {
+  DEBUG2_PRINT("sumCounts(%d)\n", numSecs);
 
+  long numBins;
+  int level = windowLevel(numSecs, &numBins);
+
+  return sumCountsAt(level, numBins);
 }
 
 /*
@@ -395,28 +1165,29 @@ int sumCounts(int numSecs) {
  */
 
 float averageCounts(int numSecs) {
+  long numBins;
+  int level = windowLevel(numSecs, &numBins);
 
-  // Sum the counts, divide by the number of seconds
-  return ((float)sumCounts(numSecs) / (float)numSecs);
+  // Sum the counts, divide by the number of seconds they cover
+  return ((float)sumCountsAt(level, numBins) / (float)(numBins * (historyWidth(level) / 1000000000ULL)));
 }
 
 /*
- * cpmTouSv: Convert cpm (counts per minute) to microSieverts/hour
+ * cpmToDose: Convert a count rate in cpm (counts per minute) to
+ *            microSieverts/hour
  *****************************************************************************
  */
 
-float cpmTouSv(int numSecs) {
-
-  // Conversion factor for SBM-20 tube
-  // From https://sites.google.com/site/diygeigercounter/gm-tubes-supported
-  //float factor = 0.0057;
+float cpmToDose(float cpm) {
+  return uSvFactor * cpm;
+}
 
-  // Conversion factor for SBM-20 tube
-  // From https://www.uradmonitor.com/topic/hardware-conversion-factor/
-  // This one gave results consistent with another portable radiation
-  // monitor I had available (within 1-2%).
-  float factor = 0.006315;
+/*
+ * cpmTouSv: Convert cpm (counts per minute) to microSieverts/hour
+ *****************************************************************************
+ */
 
+float cpmTouSv(int numSecs) {
   float uSv;
   float cpm;
 
@@ -424,11 +1195,112 @@ float cpmTouSv(int numSecs) {
   cpm = averageCounts(numSecs) * 60.0;
 
   // Multiply by conversion factor
-  uSv = factor * cpm;
+  uSv = cpmToDose(cpm);
 
   return uSv;
 }
 
+/*
+ * correctedAverageCounts: Average the true number of counts per second
+ *                         across a specific number of seconds, putting
+ *                         back the pulses the tube missed while it was
+ *                         dead.  The dead time per pulse is the mean
+ *                         measured across the same window, or across
+ *                         the whole run if none were measured in it.
+ *                         Returns -1 if the tube was saturated.
+ *****************************************************************************
+ */
+
+float correctedAverageCounts(int numSecs) {
+  struct history_bin total;
+  double secs, tau = 0.0;
+  unsigned int seq;
+  long numBins;
+  int level = windowLevel(numSecs, &numBins);
+
+  sumWindowAt(level, numBins, &total);
+  secs = numBins * (historyWidth(level) / 1000000000.0);
+
+  if (total.deadCounts > 0) {
+    tau = total.deadTime / total.deadCounts;
+  }
+  else {
+    do {
+      seq = seqlockReadBegin(&primary->histLock);
+      tau = primary->widths.mean;
+    } while (seqlockReadRetry(&primary->histLock, seq));
+  }
+
+  return deadTimeCorrect(deadTimeModel, total.counts / secs, tau);
+}
+
+/*
+ * cpmTouSvCorrected: Convert dead time corrected cpm to microSieverts/hour
+ *                    Returns -1 if the tube was saturated.
+ *****************************************************************************
+ */
+
+float cpmTouSvCorrected(int numSecs) {
+  float cps = correctedAverageCounts(numSecs);
+
+  if (cps < 0)
+    return -1.0;
+
+  return uSvFactor * cps * 60.0;
+}
+
+/*
+ * getPulseWidths: Get a consistent copy of the pulse width statistics
+ *                 since the last geigerReset()
+ *****************************************************************************
+ */
+
+void getPulseWidths(struct width_stats *w) {
+  unsigned int seq;
+
+  do {
+    seq = seqlockReadBegin(&primary->histLock);
+    *w = primary->widths;
+  } while (seqlockReadRetry(&primary->histLock, seq));
+}
+
+/*
+ * setDeadTimeModel: Chooses the dead time model (DEADTIME_*) used by
+ *                   correctedAverageCounts()
+ *****************************************************************************
+ */
+
+void setDeadTimeModel(int model) {
+  deadTimeModel = model;
+}
+
+/*
+ * getDeadTimeModel: Gets the dead time model in use
+ *****************************************************************************
+ */
+
+int getDeadTimeModel(void) {
+  return deadTimeModel;
+}
+
+/*
+ * setHVState: Publishes a change of HV state alongside the counts, so
+ *             snapshots can tell which seconds had HV on throughout.
+ *             Must be called with lock_hv held.
+ *****************************************************************************
+ */
+
+static void setHVState(bool on) {
+
+  // Prevent other threads from clobbering these values
+  lockAll();
+
+  HVisOn = on;
+  HVChangeNS = getTimeNS();
+
+  unlockAll();
+}
+
 /*
  * HVOn: Turns HV on and logs it.
  *****************************************************************************
@@ -440,7 +1312,7 @@ void HVOn (void) {
     pthread_mutex_lock(&lock_hv);
 
     digitalWrite(gatePin, HIGH);  // Turn on the MOSFET gate pin
-    HVisOn = true;                // HV is now on
+    setHVState(true);             // HV is now on
 
     pthread_mutex_unlock(&lock_hv);
   }
@@ -457,7 +1329,7 @@ void HVOff (void) {
     pthread_mutex_lock(&lock_hv);
 
     digitalWrite(gatePin, LOW);   // Turn off the MOSFET gate pin
-    HVisOn = false;               // HV is now off
+    setHVState(false);            // HV is now off
 
     pthread_mutex_unlock(&lock_hv);
   }
@@ -480,31 +1352,109 @@ bool getHVOn (void) {
 }
 
 /*
- * geigerReset: Resets the Geiger counting variables.
+ * geigerReset: Resets the Geiger counting variables, on every channel.
  *****************************************************************************
  */
 
 int geigerReset(void) {
+  unsigned long long now = getTimeNS();
+
+  // Prevent other threads from clobbering these values
+  lockAll();
+  pthread_mutex_lock(&lock_coinc);
+  seqlockWriteBegin(&coincLock);
+
+  // Start counting from the most recent whole second, so that
+  // bins line up with waitNextSec()
+  epochNS = now - now % 1000000000ULL;
+
+  // Initialize the counting history
+  for (int i = 0; i < numChannels; i++) {
+    historyReset(&channels[i].hist);
+    widthStatsReset(&channels[i].widths);
+    channels[i].t1 = channels[i].t2 = 0;
+  }
+  historyReset(&coincHist);
+  atomic_store(&coincLate, 0);
+  atomic_store(&coincDropped, 0);
 
-  // Initialize counting variables
-  setSecNum(0);
+  seqlockWriteEnd(&coincLock);
+  pthread_mutex_unlock(&lock_coinc);
+  unlockAll();
 
-  // Prevent other threads from clobbering this value
-  pthread_mutex_lock(&lock_sec);
-  // Initialize the counting arrays
-  for (int i=0; i < size; i++) {
-    sec[i] = 0;
+  return 0;
+}
+
+/*
+ * geigerSetChannels: Sets how many tubes there are, and which wiringPi
+ *                    pin each one is on (NULL to keep the defaults).
+ *                    Must be called before geigerSetup().
+ *                    Returns -1 if there can't be that many.
+ *****************************************************************************
+ */
+
+int geigerSetChannels(int n, const int pins[]) {
+  if ((n < 1) || (n > GEIGER_MAX_CHANNELS))
+    return -1;
+
+  numChannels = n;
+  if (pins != NULL) {
+    for (int i = 0; i < n; i++) {
+      geigerPins[i] = pins[i];
+    }
   }
-  pthread_mutex_unlock(&lock_sec);
 
-  // Prevent other threads from clobbering this value
-  pthread_mutex_lock(&lock_count);
-  t1 = t2 = 0;
-  pthread_mutex_unlock(&lock_count);
+  return 0;
+}
+
+/*
+ * geigerNumChannels: Gets how many tubes are being counted
+ *****************************************************************************
+ */
+
+int geigerNumChannels(void) {
+  return numChannels;
+}
+
+/*
+ * geigerSetCoincidence: Sets how close together, in seconds, pulses on
+ *                       different channels must be to be coincident, and
+ *                       on how many channels.  Must be called after
+ *                       geigerSetChannels().
+ *                       Returns -1 if the window isn't positive or there
+ *                       aren't that many channels.
+ *****************************************************************************
+ */
+
+int geigerSetCoincidence(double window, int needed) {
+  if ((window <= 0) || (needed < 2) || (needed > numChannels))
+    return -1;
+
+  coincWindow = window * 1e9;
+  coincNeeded = needed;
 
   return 0;
 }
 
+/*
+ * channelInit: Sets up the locks and rings of a channel
+ *****************************************************************************
+ */
+
+static void channelInit(struct geiger_channel *ch, int index) {
+  ch->index = index;
+  ch->pin = geigerPins[index];
+  ch->lineFd = -1;
+  ch->rtApplied = false;
+  atomic_store(&ch->countedNS, 0);
+  seqlockInit(&ch->histLock);
+  pthread_mutex_init(&ch->lock, NULL);
+
+  // The rings have to exist before the first edge can arrive
+  pulseRingInit(&ch->edgeRing, ch->edgeBuf, sizeof(ch->edgeBuf) / sizeof(ch->edgeBuf[0]));
+  pulseRingInit(&ch->startRing, ch->startBuf, sizeof(ch->startBuf) / sizeof(ch->startBuf[0]));
+}
+
 /*
  * geigerSetup: Sets up the Geiger circuit.
  *****************************************************************************
@@ -512,33 +1462,72 @@ int geigerReset(void) {
 
 int geigerSetup(void) {
 
+  // Reprocessing a recording, possibly not even on a Pi
+  if (captureBackend == GEIGER_CAPTURE_OFFLINE) {
+    HVisOn = false;
+    for (int i = 0; i < numChannels; i++) {
+      channelInit(&channels[i], i);
+    }
+    seqlockInit(&coincLock);
+    pthread_mutex_init(&lock_hv, NULL);
+    pthread_mutex_init(&lock_led, NULL);
+    pthread_mutex_init(&lock_coinc, NULL);
+    geigerReset();
+    return 0;
+  }
+
   wiringPiSetup();           // Initialize wiringPi
 
   HVisOn = false;            // HV is off by default
 
   pinMode(gatePin, OUTPUT);  // Set up MOSFET gate pin
 
-  LEDTime = 0;               // Initialize the LED
+  atomic_store(&ledUntil, 0); // Initialize the LED
+  atomic_store(&ledIdle, false);
   LEDisOn = false;           // LED is off by default
   pinMode(ledPin, OUTPUT);   // Set up LED pin
 
-  // Configure wiringPi to detect pulses with a falling
-  // edge on the Geiger pin
-  wiringPiISR(geigerPin, INT_EDGE_BOTH, &countInterrupt);
-
-  // Pull up/down resistors off for this pin
-  pullUpDnControl(geigerPin, PUD_OFF);
-
   // Initialize the mutexes
-  pthread_mutex_init(&lock_sec, NULL);
+  for (int i = 0; i < numChannels; i++) {
+    channelInit(&channels[i], i);
+  }
+  seqlockInit(&coincLock);
   pthread_mutex_init(&lock_hv, NULL);
-  pthread_mutex_init(&lock_count, NULL);
   pthread_mutex_init(&lock_led, NULL);
+  pthread_mutex_init(&lock_coinc, NULL);
 
-  // Prevent other threads from clobbering this value
-  pthread_mutex_lock(&lock_count);
-  t1 = t2 = 0.0;
-  pthread_mutex_unlock(&lock_count);
+  // What the LED thread sleeps on while there are no pulses
+  if ((ledWake < 0) && ((ledWake = eventfd(0, EFD_CLOEXEC)) < 0))
+    return -1;
+
+  for (int i = 0; i < numChannels; i++) {
+
+    // Use kernel-stamped line events from the GPIO character device
+    if (captureBackend == GEIGER_CAPTURE_GPIOCDEV) {
+      if ((channels[i].lineFd = gpioLineOpen(channels[i].pin)) < 0) {
+
+        // Let go of the lines we did get, so nothing reads them if
+        // we fall back to something else
+        for (int j = 0; j < i; j++) {
+          close(channels[j].lineFd);
+          channels[j].lineFd = -1;
+        }
+        return -1;
+      }
+    }
+    // simThread() fills the rings, there's no pin to set up
+    else if (captureBackend == GEIGER_CAPTURE_WIRINGPI) {
+      // Configure wiringPi to detect pulses with a falling
+      // edge on the Geiger pin
+      wiringPiISR(channels[i].pin, INT_EDGE_BOTH, interrupts[i]);
+
+      // Pull up/down resistors off for this pin
+      pullUpDnControl(channels[i].pin, PUD_OFF);
+    }
+  }
+
+  // Start with empty counting arrays
+  geigerReset();
 
   return 0;
 }
@@ -560,6 +1549,31 @@ void geigerStart() {
   pthread_t led_id;
   pthread_create(&led_id, &attr, blinkLED, NULL);
 
+  for (int i = 0; i < numChannels; i++) {
+
+    // Set up the pulse counting thread
+    pthread_t count_id;
+    pthread_create(&count_id, &attr, countThread, &channels[i]);
+
+    // Set up the edge capture thread, if we're reading line events
+    if (channels[i].lineFd >= 0) {
+      pthread_t edge_id;
+      pthread_create(&edge_id, &attr, edgeThread, &channels[i]);
+    }
+  }
+
+  // Set up the coincidence thread, if there's anything to match
+  if (numChannels > 1) {
+    pthread_t coinc_id;
+    pthread_create(&coinc_id, &attr, coincidenceThread, NULL);
+  }
+
+  // Set up the simulator thread, if we're simulating
+  if (captureBackend == GEIGER_CAPTURE_SIM) {
+    pthread_t sim_id;
+    pthread_create(&sim_id, &attr, simThread, NULL);
+  }
+
   // Clean up thread attributes
   pthread_attr_destroy(&attr);
 }
@@ -570,13 +1584,16 @@ void geigerStart() {
  *****************************************************************************
  */
 void geigerStop() {
+  uint64_t one = 1;
+
   keepRunning = false;          // Stop running threads
   HVOff();                      // Make sure HV is off
   LEDOff();                     // Make sure the LED is off
 
+  // Wake the LED thread so it sees we're stopping
+  if (write(ledWake, &one, sizeof(one)) < 0) { }
+
   // Clean up the mutexes
-  pthread_mutex_destroy(&lock_sec);
   pthread_mutex_destroy(&lock_hv);
-  pthread_mutex_destroy(&lock_count);
   pthread_mutex_destroy(&lock_led);
 }
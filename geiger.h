@@ -26,6 +26,31 @@
 #ifndef GEIGER_H
 #define GEIGER_H
 
+#include <stdbool.h>
+#include "history.h"
+#include "deadtime.h"
+
+// Edge capture backends
+#define GEIGER_CAPTURE_WIRINGPI 0   // wiringPiISR(), user space timestamps
+#define GEIGER_CAPTURE_GPIOCDEV 1   // GPIO line events, kernel timestamps
+#define GEIGER_CAPTURE_SIM      2   // Simulated pulses from sim.c
+#define GEIGER_CAPTURE_OFFLINE  3   // Counts read back from a flight log
+
+// Tubes that can be counted at once, each on its own pin
+#define GEIGER_MAX_CHANNELS     3
+
+// A consistent snapshot of one or more seconds of counting
+struct geiger_stats {
+  long first;                 // First second covered, since the epoch
+  long last;                  // Last second covered
+  unsigned long long startNS; // CLOCK_MONOTONIC time that first began
+  int counts;                 // Counts
+  int deadCounts;             // Counts with a believable dead time
+  double deadTime;            // Total dead time, seconds
+  bool hvOn;                  // Is HV on now?
+  bool hvSteady;              // Was HV unchanged since startNS?
+};
+
 // LED routines
 void LEDOn (void);
 void LEDOff (void);
@@ -33,15 +58,40 @@ void *blinkLED (void *vargp);
 
 // Count routines
 int getSecNum(void);
-void setSecNum(unsigned long seconds);
-int getIndex(int numIndex);
-double getDeadTime(int numSecs);
-int getDeadCounts(int numSecs);
-int getCounts(int numSecs);
+long getCurrentSec(void);
+unsigned long long getEpochNS(void);
+int getIndex(long numIndex);
+void getStats(long numSecs, struct geiger_stats *stats);
+void getStatsRange(long first, long last, struct geiger_stats *stats);
+void channelStatsRange(int channel, long first, long last, struct geiger_stats *stats);
+int getCoincidences(long first, long last);
+unsigned long getCoincLate(void);
+unsigned long getCoincDropped(void);
+double getDeadTime(long numSecs);
+int getDeadCounts(long numSecs);
+int getCounts(long numSecs);
+void getHistory(struct history *dst, unsigned long long *epoch);
+void getHistoryUpdate(struct history *dst, unsigned long long *epoch);
+int getCountsAt(int level, long bin);
+int sumCountsAt(int level, long numBins);
 int sumCounts(int numSecs);
 float averageCounts(int numSecs);
+float cpmToDose(float cpm);
 float cpmTouSv(int numSecs);
+float correctedAverageCounts(int numSecs);
+float cpmTouSvCorrected(int numSecs);
+void getPulseWidths(struct width_stats *w);
+void setDeadTimeModel(int model);
+int getDeadTimeModel(void);
+void geigerAddCounts(unsigned long long ns, int counts, int deadCounts, double deadTime);
 void countInterrupt(void);
+void *countThread(void *vargp);
+bool geigerWaitCounted(unsigned long long ns);
+void *edgeThread(void *vargp);
+void *simThread(void *vargp);
+void *coincidenceThread(void *vargp);
+unsigned int getDroppedEdges(void);
+unsigned int channelDroppedEdges(int channel);
 
 // HV routines
 void HVOn(void);
@@ -49,6 +99,11 @@ void HVOff(void);
 bool getHVOn(void);
 
 // Setup routines
+void geigerSetCapture(int backend, const char *chip);
+const char *getCaptureName(void);
+int geigerSetChannels(int n, const int pins[]);
+int geigerNumChannels(void);
+int geigerSetCoincidence(double window, int needed);
 int geigerReset(void);
 int geigerSetup(void);
 void geigerStart(void);
@@ -0,0 +1,280 @@
+/*
+ *****************************************************************************
+ * history.c:  multi-resolution history of Geiger counts and dead time.
+ *
+ *             Every pulse is added to a 100 ms, 1 s, 1 min and 1 h bin at
+ *             once, so memory is fixed no matter how long we run.  Each
+ *             bin also carries the running totals through its end, so
+ *             the sum over any range of bins is just the difference of
+ *             two of them.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "history.h"
+
+// Bin widths, nanoseconds
+static const unsigned long long widths[HISTORY_LEVELS] = {
+  100000000ULL,           // 100 ms
+  1000000000ULL,          // 1 s
+  60000000000ULL,         // 1 min
+  3600000000000ULL        // 1 h
+};
+
+// Number of bins kept at each resolution
+static const int sizes[HISTORY_LEVELS] = {
+  HISTORY_TENTHS_SIZE,
+  HISTORY_SECONDS_SIZE,
+  HISTORY_MINUTES_SIZE,
+  HISTORY_HOURS_SIZE
+};
+
+
+/*
+ * historyWidth: Gets the bin width of a resolution, in nanoseconds
+ *****************************************************************************
+ */
+
+unsigned long long historyWidth(int level) {
+  return widths[level];
+}
+
+/*
+ * historySize: Gets the number of bins kept at a resolution
+ *****************************************************************************
+ */
+
+int historySize(int level) {
+  return sizes[level];
+}
+
+/*
+ * historyRelink: Points each resolution back at its own bins.  Needed
+ *                after a history has been copied somewhere else, such
+ *                as into shared memory and back out.
+ *****************************************************************************
+ */
+
+void historyRelink(struct history *h) {
+  h->levels[HISTORY_TENTHS].slots = h->tenths;
+  h->levels[HISTORY_SECONDS].slots = h->seconds;
+  h->levels[HISTORY_MINUTES].slots = h->minutes;
+  h->levels[HISTORY_HOURS].slots = h->hours;
+}
+
+/*
+ * historyUpdate: Brings a copy of a history up to date by copying only
+ *                the bins written since it was taken: its newest bin,
+ *                which may have filled up since, and everything after.
+ *                A history that has been started over since is copied
+ *                level by level in full.
+ *****************************************************************************
+ */
+
+void historyUpdate(struct history *dst, const struct history *src) {
+  const struct history_level *s;
+  struct history_level *d;
+  long first;
+
+  for (int l = 0; l < HISTORY_LEVELS; l++) {
+    s = &src->levels[l];
+    d = &dst->levels[l];
+
+    if (s->lastBin < d->lastBin) {
+      memcpy(d->slots, s->slots, sizes[l] * sizeof(struct history_slot));
+    }
+    else {
+      first = (d->lastBin > 0) ? d->lastBin : 0;
+      if (s->lastBin - first >= sizes[l])
+        first = s->lastBin - sizes[l] + 1;
+
+      for (long i = first; i <= s->lastBin; i++) {
+        d->slots[i % sizes[l]] = s->slots[i % sizes[l]];
+      }
+    }
+
+    d->width = widths[l];
+    d->size = sizes[l];
+    d->lastBin = s->lastBin;
+    d->total = s->total;
+  }
+}
+
+/*
+ * historyReset: Empties every resolution
+ *****************************************************************************
+ */
+
+void historyReset(struct history *h) {
+  struct history_slot *storage[HISTORY_LEVELS] = { h->tenths, h->seconds, h->minutes, h->hours };
+
+  for (int l = 0; l < HISTORY_LEVELS; l++) {
+    h->levels[l].width = widths[l];
+    h->levels[l].size = sizes[l];
+    h->levels[l].lastBin = -1;
+    h->levels[l].slots = storage[l];
+    memset(&h->levels[l].total, 0, sizeof(h->levels[l].total));
+
+    // Every slot holds a bin from before the epoch, which is always empty
+    for (int i = 0; i < sizes[l]; i++) {
+      memset(&storage[l][i], 0, sizeof(storage[l][i]));
+      storage[l][i].b.bin = i - sizes[l];
+    }
+  }
+}
+
+/*
+ * slotFor: Gets the slot of a bin.  Moving on to a newer bin closes off
+ *          every bin skipped over with the running totals, so they read
+ *          back as empty.  Time only moves forward, so an older bin than
+ *          the newest one is simply added to the newest one.
+ *****************************************************************************
+ */
+
+static struct history_slot *slotFor(struct history_level *lvl, long bin) {
+  struct history_slot *slot;
+  long first;
+
+  if (bin <= lvl->lastBin)
+    return &lvl->slots[lvl->lastBin % lvl->size];
+
+  // No need to close off more bins than we keep
+  first = lvl->lastBin + 1;
+  if (bin - first >= lvl->size)
+    first = bin - lvl->size + 1;
+
+  for (long i = first; i <= bin; i++) {
+    slot = &lvl->slots[i % lvl->size];
+    memset(&slot->b, 0, sizeof(slot->b));
+    slot->b.bin = i;
+    slot->cum = lvl->total;
+  }
+  lvl->lastBin = bin;
+
+  return &lvl->slots[bin % lvl->size];
+}
+
+/*
+ * historyAdd: Adds counts and dead time at offset nanoseconds after the
+ *             epoch to every resolution
+ *****************************************************************************
+ */
+
+void historyAdd(struct history *h, unsigned long long offset, int counts, int deadCounts, double deadTime) {
+  struct history_level *lvl;
+  struct history_slot *slot;
+
+  for (int l = 0; l < HISTORY_LEVELS; l++) {
+    lvl = &h->levels[l];
+    slot = slotFor(lvl, offset / widths[l]);
+
+    slot->b.counts += counts;
+    slot->b.deadCounts += deadCounts;
+    slot->b.deadTime += deadTime;
+
+    lvl->total.counts += counts;
+    lvl->total.deadCounts += deadCounts;
+    lvl->total.deadTime += deadTime;
+    slot->cum = lvl->total;
+  }
+}
+
+/*
+ * historyGet: Gets a single bin.  Bins that have aged out, or never had
+ *             anything in them, come back empty.
+ *****************************************************************************
+ */
+
+void historyGet(struct history *h, int level, long bin, struct history_bin *out) {
+  struct history_level *lvl = &h->levels[level];
+  struct history_slot *slot;
+
+  memset(out, 0, sizeof(*out));
+  out->bin = bin;
+
+  if ((bin < 0) || (bin > lvl->lastBin))
+    return;
+
+  slot = &lvl->slots[bin % lvl->size];
+
+  if (slot->b.bin == bin) {
+    *out = slot->b;
+  }
+}
+
+/*
+ * historyKept: Is a bin still in the history?  Bins after the newest one
+ *              are, they just haven't had anything in them yet.
+ *****************************************************************************
+ */
+
+bool historyKept(struct history *h, int level, long bin) {
+  struct history_level *lvl = &h->levels[level];
+
+  return (bin >= 0) && (bin > lvl->lastBin - lvl->size);
+}
+
+/*
+ * cumThrough: Gets the running totals through the end of a bin.  Bins
+ *             that have aged out read as the oldest one still kept.
+ *****************************************************************************
+ */
+
+static void cumThrough(struct history_level *lvl, long bin, struct history_total *cum) {
+
+  // Nothing has happened since the newest bin
+  if (bin >= lvl->lastBin) {
+    *cum = lvl->total;
+    return;
+  }
+
+  // Too old, use the oldest bin we still have
+  if (bin <= lvl->lastBin - lvl->size)
+    bin = lvl->lastBin - lvl->size + 1;
+
+  // Nothing happened before the epoch
+  if (bin < 0) {
+    memset(cum, 0, sizeof(*cum));
+    return;
+  }
+
+  *cum = lvl->slots[bin % lvl->size].cum;
+}
+
+/*
+ * historySum: Sums bins first..last of a resolution in constant time.
+ *             The start of the range must still be held at that
+ *             resolution.
+ *****************************************************************************
+ */
+
+void historySum(struct history *h, int level, long first, long last, struct history_bin *total) {
+  struct history_level *lvl = &h->levels[level];
+  struct history_total a, b;
+
+  cumThrough(lvl, first - 1, &a);
+  cumThrough(lvl, last, &b);
+
+  total->bin = first;
+  total->counts = b.counts - a.counts;
+  total->deadCounts = b.deadCounts - a.deadCounts;
+  total->deadTime = b.deadTime - a.deadTime;
+}
@@ -0,0 +1,92 @@
+/*
+ *****************************************************************************
+ * history.h:  multi-resolution history of Geiger counts and dead time.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+
+// Resolutions, finest first
+#define HISTORY_TENTHS   0      // 100 ms bins
+#define HISTORY_SECONDS  1      // 1 s bins
+#define HISTORY_MINUTES  2      // 1 min bins
+#define HISTORY_HOURS    3      // 1 h bins
+#define HISTORY_LEVELS   4
+
+// How many bins of each resolution are kept
+#define HISTORY_TENTHS_SIZE   600     // 1 minute
+#define HISTORY_SECONDS_SIZE  3600    // 1 hour
+#define HISTORY_MINUTES_SIZE  1440    // 1 day
+#define HISTORY_HOURS_SIZE    168     // 1 week
+
+// One bin of one resolution
+struct history_bin {
+  long bin;               // Which bin since the epoch this holds
+  int counts;             // Counts that started in this bin
+  int deadCounts;         // Counts with a believable dead time
+  double deadTime;        // Total dead time, seconds
+};
+
+// Running totals from the epoch through the end of a bin
+struct history_total {
+  long long counts;
+  long long deadCounts;
+  double deadTime;
+};
+
+// A bin and the running totals at its end, so that any range of
+// bins can be summed from just its two ends
+struct history_slot {
+  struct history_bin b;
+  struct history_total cum;
+};
+
+// A circular buffer of bins at a single resolution
+struct history_level {
+  unsigned long long width;   // Bin width, nanoseconds
+  int size;                   // Number of bins
+  long lastBin;               // Newest bin written, -1 if none yet
+  struct history_total total; // Running totals through lastBin
+  struct history_slot *slots;
+};
+
+// Every resolution, each kept up to date as pulses arrive
+struct history {
+  struct history_level levels[HISTORY_LEVELS];
+  struct history_slot tenths[HISTORY_TENTHS_SIZE];
+  struct history_slot seconds[HISTORY_SECONDS_SIZE];
+  struct history_slot minutes[HISTORY_MINUTES_SIZE];
+  struct history_slot hours[HISTORY_HOURS_SIZE];
+};
+
+void historyReset(struct history *h);
+void historyRelink(struct history *h);
+void historyUpdate(struct history *dst, const struct history *src);
+void historyAdd(struct history *h, unsigned long long offset, int counts, int deadCounts, double deadTime);
+void historyGet(struct history *h, int level, long bin, struct history_bin *out);
+bool historyKept(struct history *h, int level, long bin);
+void historySum(struct history *h, int level, long first, long last, struct history_bin *total);
+unsigned long long historyWidth(int level);
+int historySize(int level);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ *****************************************************************************
+ * latency.c:  always-on, low overhead timing histograms for the hot paths.
+ *
+ *             Recording a time is a handful of relaxed atomic adds into a
+ *             power-of-two histogram, with no locks, so it can stay on in
+ *             flight.  Readers may see a histogram in the middle of an
+ *             update, which is close enough for a summary.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include "star_common.h"
+#include "latency.h"
+
+struct lat_hist {
+  const char *name;
+  atomic_ulong bins[LAT_BINS];
+  atomic_ulong count;
+  atomic_ullong sum;      // ns
+  atomic_ullong max;      // ns
+};
+
+static struct lat_hist hists[LAT_HISTS] = {
+  { .name = "edge" },
+  { .name = "count lock" },
+  { .name = "tick" },
+  { .name = "spi" },
+  { .name = "write" },
+  { .name = "sync" }
+};
+
+
+/*
+ * binFor: Which power of two a time falls in
+ *****************************************************************************
+ */
+
+static int binFor(unsigned long long ns) {
+  int bin = 0;
+
+  while ((ns >>= 1) != 0) {
+    bin++;
+  }
+
+  return (bin < LAT_BINS) ? bin : LAT_BINS - 1;
+}
+
+/*
+ * latRecord: Adds a time to a histogram
+ *****************************************************************************
+ */
+
+void latRecord(int hist, unsigned long long ns) {
+  struct lat_hist *h = &hists[hist];
+
+  atomic_fetch_add_explicit(&h->bins[binFor(ns)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum, ns, memory_order_relaxed);
+
+  // Several channels may record at once, so only raise the worst time
+  unsigned long long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+  while ((ns > max) &&
+         !atomic_compare_exchange_weak_explicit(&h->max, &max, ns,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+/*
+ * latReset: Empties every histogram
+ *****************************************************************************
+ */
+
+void latReset(void) {
+  for (int i = 0; i < LAT_HISTS; i++) {
+    for (int b = 0; b < LAT_BINS; b++) {
+      atomic_store(&hists[i].bins[b], 0);
+    }
+    atomic_store(&hists[i].count, 0);
+    atomic_store(&hists[i].sum, 0);
+    atomic_store(&hists[i].max, 0);
+  }
+}
+
+/*
+ * percentile: Upper edge of the bin that holds a fraction of the times,
+ *             in microseconds
+ *****************************************************************************
+ */
+
+static double percentile(unsigned long *bins, unsigned long count, double frac) {
+  unsigned long want = count * frac, seen = 0;
+
+  for (int b = 0; b < LAT_BINS; b++) {
+    seen += bins[b];
+    if (seen > want)
+      return (double)(2ULL << b) / 1000.0;
+  }
+
+  return (double)(2ULL << (LAT_BINS - 1)) / 1000.0;
+}
+
+/*
+ * latSummary: One line per histogram: how many, mean, median, 99th
+ *             percentile and worst, in microseconds
+ *****************************************************************************
+ */
+
+void latSummary(FILE *f) {
+  unsigned long bins[LAT_BINS];
+  unsigned long count;
+  unsigned long long sum, max;
+
+  for (int i = 0; i < LAT_HISTS; i++) {
+    for (int b = 0; b < LAT_BINS; b++) {
+      bins[b] = atomic_load_explicit(&hists[i].bins[b], memory_order_relaxed);
+    }
+    count = atomic_load_explicit(&hists[i].count, memory_order_relaxed);
+    sum = atomic_load_explicit(&hists[i].sum, memory_order_relaxed);
+    max = atomic_load_explicit(&hists[i].max, memory_order_relaxed);
+
+    if (count == 0) {
+      fprintf(f, "%s latency %s: none\n", getTimeStamp(), hists[i].name);
+      continue;
+    }
+
+    fprintf(f, "%s latency %s: n = %lu, mean = %.1f us, p50 < %.1f us, p99 < %.1f us, max = %.1f us\n",
+            getTimeStamp(), hists[i].name, count, sum / 1000.0 / count,
+            percentile(bins, count, 0.50), percentile(bins, count, 0.99), max / 1000.0);
+  }
+}
+
+/*
+ * latDump: The summary, then every non-empty bin of every histogram
+ *****************************************************************************
+ */
+
+void latDump(FILE *f) {
+  unsigned long n;
+
+  latSummary(f);
+
+  for (int i = 0; i < LAT_HISTS; i++) {
+    fprintf(f, "%s latency %s bins:", getTimeStamp(), hists[i].name);
+    for (int b = 0; b < LAT_BINS; b++) {
+      if ((n = atomic_load_explicit(&hists[i].bins[b], memory_order_relaxed)) != 0)
+        fprintf(f, " <%lluns=%lu", 2ULL << b, n);
+    }
+    fprintf(f, "\n");
+  }
+}
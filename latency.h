@@ -0,0 +1,47 @@
+/*
+ *****************************************************************************
+ * latency.h:  always-on, low overhead timing histograms for the hot paths.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+
+// What is being timed.  Every channel's threads record edge and count lock
+// times, so any histogram may be recorded by several threads at once.
+#define LAT_EDGE      0     // Edge time stamp to countThread() picking it up
+#define LAT_COUNT     1     // Time spent holding a channel's count lock
+#define LAT_TICK      2     // How late the main loop woke for its deadline
+#define LAT_SPI       3     // SPI transactions, on the bus thread
+#define LAT_WRITE     4     // Handing a record to every writer sink
+#define LAT_SYNC      5     // Flushing the writer sinks
+#define LAT_HISTS     6
+
+// Bin n holds times from 2^n to 2^(n+1) - 1 ns (bin 0 also holds 0)
+#define LAT_BINS      40
+
+void latRecord(int hist, unsigned long long ns);
+void latReset(void);
+void latSummary(FILE *f);
+void latDump(FILE *f);
+
+#endif
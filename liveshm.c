@@ -0,0 +1,270 @@
+/*
+ *****************************************************************************
+ * liveshm.c:  live counts and altimeter readings in POSIX shared memory,
+ *             for local readers that want them without parsing logs.
+ *
+ *             A thread of its own copies the count history and the
+ *             latest altimeter sample into the segment a few times a
+ *             second.  There are two copies, and each update goes into
+ *             the one readers aren't using before it's made current.
+ *             Readers map it read-only and copy the current one out,
+ *             checking its seqlock to be sure it didn't change
+ *             underneath them, so they never take a lock, wait or make
+ *             a system call, and nothing they do can hold up the
+ *             counting.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "star_common.h"
+#include "geiger.h"
+#include "realtime.h"
+#include "liveshm.h"
+
+static struct live_shm *shm = NULL;     // The segment, mapped read/write
+static char shmName[64];
+
+// Put together here, then copied in one go, to keep the write short.
+// Its history is kept up to date bin by bin rather than copied whole.
+static struct live_data scratch;
+
+static pthread_t export_id;
+static volatile bool exporting = false;
+static unsigned long long period;       // Nanoseconds between updates
+
+
+/*
+ * liveshmOpen: Creates the shared memory segment
+ *              Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int liveshmOpen(const char *name) {
+  int fd;
+
+  snprintf(shmName, sizeof(shmName), "%s", (name != NULL) ? name : LIVESHM_NAME);
+
+  if ((fd = shm_open(shmName, O_CREAT | O_RDWR, 0644)) < 0)
+    return -1;
+
+  if (ftruncate(fd, sizeof(struct live_shm)) < 0) {
+    close(fd);
+    shm_unlink(shmName);
+    return -1;
+  }
+
+  shm = mmap(NULL, sizeof(struct live_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (shm == MAP_FAILED) {
+    shm = NULL;
+    shm_unlink(shmName);
+    return -1;
+  }
+
+  // Readers that see the old version or no magic yet will wait
+  for (int i = 0; i < 2; i++) {
+    seqlockInit(&shm->slots[i].lock);
+    memset(&shm->slots[i].data, 0, sizeof(shm->slots[i].data));
+  }
+  atomic_store(&shm->current, 0);
+  shm->version = LIVESHM_VERSION;
+  shm->size = sizeof(struct live_shm);
+  memcpy(shm->magic, LIVESHM_MAGIC, sizeof(shm->magic));
+
+  return 0;
+}
+
+/*
+ * publish: Copies the latest of everything into the segment
+ *****************************************************************************
+ */
+
+static void publish(void) {
+  struct live_slot *slot;
+  unsigned long long epoch = scratch.epochNS;
+
+  getHistoryUpdate(&scratch.hist, &epoch);
+  scratch.epochNS = epoch;
+  altimeterGetSample(&scratch.alt);
+  scratch.hvOn = getHVOn();
+  scratch.deadTimeModel = getDeadTimeModel();
+  scratch.updates++;
+  scratch.updatedNS = getTimeNS();
+
+  // Readers are on the current slot, so fill in the other one
+  slot = &shm->slots[(atomic_load_explicit(&shm->current, memory_order_relaxed) + 1) & 1];
+  seqlockWriteBegin(&slot->lock);
+  memcpy(&slot->data, &scratch, sizeof(scratch));
+  seqlockWriteEnd(&slot->lock);
+
+  atomic_store_explicit(&shm->current, slot - shm->slots, memory_order_release);
+}
+
+/*
+ * exportThread: Publishes every period nanoseconds until stopped
+ *****************************************************************************
+ */
+
+static void *exportThread(void *vargp) {
+  struct schedule sch;
+
+  rtApply(RT_EXPORT);
+
+  scheduleInit(&sch, getTimeNS(), period);
+  while (exporting) {
+    publish();
+    scheduleWait(&sch);
+  }
+
+  return NULL;
+}
+
+/*
+ * liveshmStart: Starts publishing rate times a second
+ *               Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int liveshmStart(double rate) {
+  unsigned long long epoch;
+
+  if ((shm == NULL) || (rate <= 0))
+    return -1;
+
+  period = 1e9 / rate;
+  memset(&scratch, 0, sizeof(scratch));
+
+  // The one full copy, from then on only what changed is copied
+  getHistory(&scratch.hist, &epoch);
+  scratch.epochNS = epoch;
+  exporting = true;
+
+  if (pthread_create(&export_id, NULL, exportThread, NULL) != 0) {
+    exporting = false;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * liveshmStop: Stops publishing, after one last update
+ *****************************************************************************
+ */
+
+void liveshmStop(void) {
+  if (!exporting)
+    return;
+
+  exporting = false;
+  pthread_join(export_id, NULL);
+  publish();
+}
+
+/*
+ * liveshmClose: Removes the segment.  Readers that have it mapped keep
+ *               the last snapshot.
+ *****************************************************************************
+ */
+
+void liveshmClose(void) {
+  if (shm == NULL)
+    return;
+
+  munmap(shm, sizeof(struct live_shm));
+  shm_unlink(shmName);
+  shm = NULL;
+}
+
+/*
+ * liveshmMap: Maps a segment read-only for a reader
+ *             Returns NULL if it doesn't exist, or is a version we can't
+ *             read
+ *****************************************************************************
+ */
+
+const struct live_shm *liveshmMap(const char *name) {
+  const struct live_shm *m;
+  struct stat st;
+  int fd;
+
+  if ((fd = shm_open((name != NULL) ? name : LIVESHM_NAME, O_RDONLY, 0)) < 0)
+    return NULL;
+
+  if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(struct live_shm))) {
+    close(fd);
+    return NULL;
+  }
+
+  m = mmap(NULL, sizeof(struct live_shm), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (m == MAP_FAILED)
+    return NULL;
+
+  if ((memcmp(m->magic, LIVESHM_MAGIC, sizeof(m->magic)) != 0) || (m->version != LIVESHM_VERSION) || (m->size != sizeof(struct live_shm))) {
+    munmap((void *)m, sizeof(struct live_shm));
+    return NULL;
+  }
+
+  return m;
+}
+
+/*
+ * liveshmRead: Takes a consistent copy of the live data.  The copy's
+ *              history can be queried with historyGet() and historySum().
+ *              The current slot only changes under a reader if the
+ *              writer gets all the way around to it again, so this
+ *              only ever tries again for a reader that was held up for
+ *              more than a whole update.
+ *              Returns false if nothing has been published yet, or if
+ *              no consistent copy could be taken in LIVESHM_TRIES.
+ *****************************************************************************
+ */
+
+bool liveshmRead(const struct live_shm *m, struct live_data *out) {
+  struct live_shm *w = (struct live_shm *)m;
+  struct live_slot *slot;
+  unsigned int seq;
+
+  for (int i = 0; i < LIVESHM_TRIES; i++) {
+    slot = &w->slots[atomic_load_explicit(&w->current, memory_order_acquire) & 1];
+
+    // The writer has come back around to it, look again
+    if (!seqlockReadTry(&slot->lock, &seq))
+      continue;
+
+    memcpy(out, &slot->data, sizeof(*out));
+    if (!seqlockReadRetry(&slot->lock, seq)) {
+      historyRelink(&out->hist);
+      return out->updates > 0;
+    }
+  }
+
+  return false;
+}
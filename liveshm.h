@@ -0,0 +1,81 @@
+/*
+ *****************************************************************************
+ * liveshm.h:  live counts and altimeter readings in POSIX shared memory,
+ *             for local readers that want them without parsing logs.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef LIVESHM_H
+#define LIVESHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "seqlock.h"
+#include "history.h"
+#include "MS5607.h"
+
+#define LIVESHM_NAME     "/star"
+#define LIVESHM_MAGIC    "STARSHM"  // Seven characters and a NUL
+#define LIVESHM_VERSION  2
+
+// Times a reader tries for a consistent copy before giving up
+#define LIVESHM_TRIES    8
+
+// Everything a reader gets in a single snapshot
+struct live_data {
+  uint64_t updates;                 // Times it's been published
+  uint64_t updatedNS;               // CLOCK_MONOTONIC time of the last one
+  uint64_t epochNS;                 // CLOCK_MONOTONIC time of second zero
+  uint32_t hvOn;                    // Was HV on?
+  uint32_t deadTimeModel;           // DEADTIME_*
+  struct altimeter_sample alt;      // Latest altimeter sample
+  struct history hist;              // Counts and dead time, every resolution
+};
+
+// One of the two copies of the data
+struct live_slot {
+  struct seqlock lock;              // Odd while data is being written
+  struct live_data data;
+};
+
+// The shared memory segment.  Readers map it read-only, check magic,
+// version and size, and take copies of the current slot with
+// liveshmRead().  Each update is written to the other slot and then
+// made current, so a reader never has to wait for the writer.
+struct live_shm {
+  char magic[8];                    // LIVESHM_MAGIC
+  uint32_t version;                 // LIVESHM_VERSION
+  uint32_t size;                    // sizeof(struct live_shm)
+  atomic_uint current;              // Slot holding the latest data
+  struct live_slot slots[2];
+};
+
+// Producer
+int liveshmOpen(const char *name);
+int liveshmStart(double rate);
+void liveshmStop(void);
+void liveshmClose(void);
+
+// Readers
+const struct live_shm *liveshmMap(const char *name);
+bool liveshmRead(const struct live_shm *shm, struct live_data *out);
+
+#endif
@@ -0,0 +1,382 @@
+/*
+ *****************************************************************************
+ * logseg.c:  preallocated, rotating log file segments.
+ *
+ *            Appending to a file one small write at a time makes the
+ *            filesystem allocate blocks as it goes, and on an SD card
+ *            that can stall a write for hundreds of milliseconds.  Each
+ *            segment here has all of its space reserved up front, and
+ *            segments are opened and closed by a helper thread.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "realtime.h"
+#include "logseg.h"
+
+
+/*
+ * segmentName: Builds the file name of a segment
+ *****************************************************************************
+ */
+
+static void segmentName(struct logseg *seg, int index, char *name, size_t len) {
+  snprintf(name, len, "%s_%03d%s", seg->prefix, index, seg->suffix);
+}
+
+/*
+ * writeAll: Writes a whole block, picking up after short writes
+ *           Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+static int writeAll(int fd, const void *data, size_t len) {
+  const char *p = data;
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/*
+ * openSegment: Creates a segment, reserves its space and writes its
+ *              header
+ *              Returns the file descriptor, or -1 if there is an error
+ *****************************************************************************
+ */
+
+static int openSegment(struct logseg *seg, int index) {
+  char name[140];
+  int fd;
+
+  segmentName(seg, index, name, sizeof(name));
+
+  // Never clobber an existing segment
+  fd = open(name, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+  if (fd < 0)
+    return -1;
+
+  // Reserve the blocks without changing the file size, so appends
+  // still land at the end of what has been written.  Not every
+  // filesystem can do this, and the log still works without it.
+  fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, seg->segBytes);
+
+  if (seg->hdrLen > 0) {
+    if ((writeAll(fd, seg->hdr, seg->hdrLen) < 0) || (fdatasync(fd) < 0)) {
+      close(fd);
+      unlink(name);
+      return -1;
+    }
+  }
+
+  return fd;
+}
+
+/*
+ * finishSegment: Flushes a segment to disk, gives back whatever space
+ *                it didn't use and closes it
+ *****************************************************************************
+ */
+
+static void finishSegment(int fd, long long used) {
+  fdatasync(fd);
+  if (ftruncate(fd, used) < 0) { }  // Just wastes the reserved tail
+  close(fd);
+}
+
+/*
+ * logsegHelper: Keeps a spare segment ready and closes retired ones
+ *****************************************************************************
+ */
+
+static void *logsegHelper(void *vargp) {
+  struct logseg *seg = vargp;
+  int fd, index;
+  long long used;
+
+  // Disk work, so never with the settings of whoever opened the log
+  rtApply(RT_WRITER);
+
+  pthread_mutex_lock(&seg->lock);
+  while (seg->running) {
+
+    // Close the last segment first, it's holding data
+    if (seg->retired >= 0) {
+      fd = seg->retired;
+      used = seg->retiredUsed;
+      seg->retired = -1;
+      pthread_mutex_unlock(&seg->lock);
+
+      finishSegment(fd, used);
+
+      pthread_mutex_lock(&seg->lock);
+    }
+
+    // Get the next segment ready.  The writer won't move on to
+    // another segment while this is going on.
+    else if ((seg->spare < 0) && !seg->spareFailed) {
+      index = seg->index + 1;
+      seg->opening = true;
+      pthread_mutex_unlock(&seg->lock);
+
+      fd = openSegment(seg, index);
+
+      pthread_mutex_lock(&seg->lock);
+      seg->opening = false;
+      seg->spare = fd;
+      seg->spareFailed = (fd < 0);
+      pthread_cond_broadcast(&seg->wake);
+    }
+
+    else {
+      pthread_cond_wait(&seg->wake, &seg->lock);
+    }
+  }
+  pthread_mutex_unlock(&seg->lock);
+
+  pthread_exit(NULL);
+}
+
+/*
+ * logsegOpen: Creates the first segment and starts the helper
+ *             hdr (hdrLen bytes, may be NULL) is written at the start of
+ *             every segment and must stay valid until logsegClose()
+ *             Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int logsegOpen(struct logseg *seg, const char *prefix, const char *suffix, long long segBytes, const void *hdr, size_t hdrLen) {
+  memset(seg, 0, sizeof(*seg));
+
+  snprintf(seg->prefix, sizeof(seg->prefix), "%s", prefix);
+  snprintf(seg->suffix, sizeof(seg->suffix), "%s", suffix);
+  seg->segBytes = segBytes;
+  seg->hdr = hdr;
+  seg->hdrLen = hdrLen;
+  seg->spare = -1;
+  seg->retired = -1;
+
+  seg->index = 0;
+  seg->used = hdrLen;
+  seg->fd = openSegment(seg, 0);
+  if (seg->fd < 0)
+    return -1;
+
+  pthread_mutex_init(&seg->lock, NULL);
+  pthread_cond_init(&seg->wake, NULL);
+  seg->running = true;
+
+  // Joinable, so closing can wait for the last segment to be finished
+  if (pthread_create(&seg->helper, NULL, logsegHelper, seg) != 0) {
+    seg->running = false;
+    pthread_cond_destroy(&seg->wake);
+    pthread_mutex_destroy(&seg->lock);
+    finishSegment(seg->fd, seg->used);
+    seg->fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * logsegRemaining: Bytes left in the current segment
+ *****************************************************************************
+ */
+
+long long logsegRemaining(struct logseg *seg) {
+  return seg->segBytes - seg->used;
+}
+
+/*
+ * rotate: Moves on to the next segment, handing the current one to the
+ *         helper to close
+ *         Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+static int rotate(struct logseg *seg) {
+  int fd, oldFd = -1;
+  long long oldUsed = 0;
+
+  pthread_mutex_lock(&seg->lock);
+
+  // Normally the spare is already waiting, or nearly so
+  while (seg->opening) {
+    pthread_cond_wait(&seg->wake, &seg->lock);
+  }
+  fd = seg->spare;
+  seg->spare = -1;
+  seg->spareFailed = false;
+
+  // Hand the current segment over.  If the helper hasn't closed the
+  // last one yet, we'll do it.
+  if (seg->fd >= 0) {
+    if (seg->retired >= 0) {
+      oldFd = seg->retired;
+      oldUsed = seg->retiredUsed;
+    }
+    seg->retired = seg->fd;
+    seg->retiredUsed = seg->used;
+  }
+
+  seg->index++;
+  pthread_mutex_unlock(&seg->lock);
+
+  if (oldFd >= 0)
+    finishSegment(oldFd, oldUsed);
+
+  // Fell behind, make the next segment ourselves
+  if (fd < 0)
+    fd = openSegment(seg, seg->index);
+
+  seg->fd = fd;
+  seg->used = seg->hdrLen;
+
+  pthread_mutex_lock(&seg->lock);
+  pthread_cond_broadcast(&seg->wake);
+  pthread_mutex_unlock(&seg->lock);
+
+  return (fd < 0) ? -1 : 0;
+}
+
+/*
+ * logsegWrite: Appends a block, which is never split across segments
+ *              Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int logsegWrite(struct logseg *seg, const void *data, size_t len) {
+
+  // Move on if it doesn't fit, unless nothing has been written here
+  // yet.  If the last segment couldn't be opened, try again.
+  if ((seg->fd < 0) ||
+      (((long long)len > logsegRemaining(seg)) && (seg->used > (long long)seg->hdrLen))) {
+    if (rotate(seg) < 0)
+      return -1;
+  }
+
+  if (writeAll(seg->fd, data, len) < 0)
+    return -1;
+  seg->used += len;
+
+  return 0;
+}
+
+/*
+ * logsegSync: Waits for everything written so far to reach the disk
+ *             Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int logsegSync(struct logseg *seg) {
+  if (seg->fd < 0)
+    return -1;
+
+  return fdatasync(seg->fd);
+}
+
+/*
+ * logsegClose: Stops the helper, throws away the unused spare and
+ *              closes everything else
+ *              Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int logsegClose(struct logseg *seg) {
+  char name[140];
+
+  pthread_mutex_lock(&seg->lock);
+  seg->running = false;
+  pthread_cond_broadcast(&seg->wake);
+  pthread_mutex_unlock(&seg->lock);
+  pthread_join(seg->helper, NULL);
+
+  if (seg->spare >= 0) {
+    segmentName(seg, seg->index + 1, name, sizeof(name));
+    close(seg->spare);
+    unlink(name);
+    seg->spare = -1;
+  }
+
+  if (seg->retired >= 0) {
+    finishSegment(seg->retired, seg->retiredUsed);
+    seg->retired = -1;
+  }
+
+  pthread_cond_destroy(&seg->wake);
+  pthread_mutex_destroy(&seg->lock);
+
+  if (seg->fd < 0)
+    return -1;
+
+  finishSegment(seg->fd, seg->used);
+  seg->fd = -1;
+
+  return 0;
+}
+
+/*
+ * Stream glue, so the log can be written with fprintf()
+ *****************************************************************************
+ */
+
+static ssize_t cookieWrite(void *cookie, const char *buf, size_t size) {
+  return (logsegWrite(cookie, buf, size) < 0) ? -1 : (ssize_t)size;
+}
+
+static int cookieClose(void *cookie) {
+  return logsegClose(cookie);
+}
+
+/*
+ * logsegFile: Wraps an open log in a line buffered stream.  Closing the
+ *             stream closes the log.
+ *             Returns NULL if there is an error
+ *****************************************************************************
+ */
+
+FILE *logsegFile(struct logseg *seg) {
+  cookie_io_functions_t io = { NULL, cookieWrite, NULL, cookieClose };
+  FILE *f;
+
+  f = fopencookie(seg, "w", io);
+  if (f != NULL)
+    setvbuf(f, NULL, _IOLBF, 0);
+
+  return f;
+}
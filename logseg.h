@@ -0,0 +1,65 @@
+/*
+ *****************************************************************************
+ * logseg.h:  preallocated, rotating log file segments.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef LOGSEG_H
+#define LOGSEG_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// A log written as <prefix>_000<suffix>, <prefix>_001<suffix>, ...
+// Each segment has its disk space reserved when it is created, and
+// the next one is always made ready (and the last one closed) by a
+// helper thread, so the writer never waits on block allocation.
+struct logseg {
+  char prefix[100];
+  char suffix[16];
+  long long segBytes;         // Size of each segment, header included
+  const void *hdr;            // Written at the start of every segment
+  size_t hdrLen;
+
+  int fd;                     // Segment being written
+  int index;                  // Its number
+  long long used;             // Bytes written to it
+
+  pthread_t helper;
+  pthread_mutex_t lock;       // Guards everything below
+  pthread_cond_t wake;
+  bool running;
+  int spare;                  // Next segment, ready to go, or -1
+  bool opening;               // The helper is making the spare
+  bool spareFailed;           // The helper couldn't make one
+  int retired;                // Last segment, waiting to be closed, or -1
+  long long retiredUsed;
+};
+
+int logsegOpen(struct logseg *seg, const char *prefix, const char *suffix, long long segBytes, const void *hdr, size_t hdrLen);
+long long logsegRemaining(struct logseg *seg);
+int logsegWrite(struct logseg *seg, const void *data, size_t len);
+int logsegSync(struct logseg *seg);
+int logsegClose(struct logseg *seg);
+FILE *logsegFile(struct logseg *seg);
+
+#endif
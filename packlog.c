@@ -0,0 +1,368 @@
+/*
+ *****************************************************************************
+ * packlog.c:  compressed log of raw readings, for long ground runs and
+ *             flights where every byte of storage or downlink counts.
+ *
+ *             Only what was measured is kept: elapsed time, counts, dead
+ *             time, the raw T and P and the flags.  T1, P1, P2 and the
+ *             altitude all follow from the raw values and the calibration
+ *             in the header, so they are worked out again when reading.
+ *
+ *             Records are grouped into blocks that each stand on their
+ *             own.  The first record of a block holds its values as they
+ *             are, every other one only how it differs from the one
+ *             before (the dead time from what the last second's pulse
+ *             widths would give), and every value is a zigzag varint, so
+ *             a typical second takes about 7 bytes instead of 72.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include "packlog.h"
+#include "flightlog.h"
+
+// The on-disk layout must not depend on the compiler's padding
+_Static_assert(sizeof(struct packlog_header) == 96, "packlog_header is padded");
+_Static_assert(sizeof(struct packlog_block) == 12, "packlog_block is padded");
+
+
+/*
+ * putVarint: Appends a signed value as a zigzag varint, 7 bits a byte,
+ *            lowest first, so small values either side of zero take a
+ *            single byte
+ *            Returns the number of bytes written
+ *****************************************************************************
+ */
+
+static int putVarint(uint8_t *p, int64_t v) {
+  uint64_t u = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  int n = 0;
+
+  while (u >= 0x80) {
+    p[n++] = (u & 0x7F) | 0x80;
+    u >>= 7;
+  }
+  p[n++] = u;
+
+  return n;
+}
+
+/*
+ * getVarint: Reads back a zigzag varint, without going past end
+ *            Returns the number of bytes read, or 0 if it runs off the end
+ *****************************************************************************
+ */
+
+static int getVarint(const uint8_t *p, const uint8_t *end, int64_t *v) {
+  uint64_t u = 0;
+  int n = 0;
+
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p + n >= end)
+      return 0;
+    u |= (uint64_t)(p[n] & 0x7F) << shift;
+    if ((p[n++] & 0x80) == 0) {
+      *v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+      return n;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * nextSecond: Where the next record is expected to be, the start of the
+ *             second after the last one, microseconds.  The main loop
+ *             wakes up just after each second, so what is left over is
+ *             only how late it woke up.
+ *****************************************************************************
+ */
+
+static int64_t nextSecond(int64_t elapsedUS) {
+  return (elapsedUS / 1000000 + 1) * 1000000;
+}
+
+/*
+ * startState: What every block follows on from, so that its first
+ *             record holds its values as they are
+ *****************************************************************************
+ */
+
+static void startState(struct packlog_state *s) {
+  memset(s, 0, sizeof(*s));
+  s->elapsedUS = -1000000;          // nextSecond() of this is zero
+}
+
+/*
+ * predictDeadTime: What the dead time of a second should be, if its
+ *                  pulses are as wide on average as the last second's
+ *                  were, microseconds.  Only how far off that is gets
+ *                  stored, which is nothing at all for a steady tube.
+ *****************************************************************************
+ */
+
+static int64_t predictDeadTime(const struct packlog_state *prev, int64_t deadCounts) {
+  if ((prev->deadCounts <= 0) || (deadCounts <= 0))
+    return 0;
+
+  return (deadCounts * prev->deadTimeUS + prev->deadCounts / 2) / prev->deadCounts;
+}
+
+/*
+ * toState: Gets a second of data in the units it is stored in
+ *****************************************************************************
+ */
+
+static void toState(const struct data_second *data, struct packlog_state *s) {
+  s->elapsedUS = llround(data->elapsed * 1e6);
+  s->counts = data->counts;
+  s->deadCounts = data->deadCounts;
+  s->deadTimeUS = llround(data->deadTime * 1e6);
+  s->T = data->T;
+  s->P = data->P;
+}
+
+/*
+ * packlogHeader: Fills in a header for a new log
+ *****************************************************************************
+ */
+
+void packlogHeader(struct packlog_header *hdr, const int C[8], double qff, const char *started, int blockRecords) {
+  memset(hdr, 0, sizeof(*hdr));
+
+  memcpy(hdr->magic, PACKLOG_MAGIC, sizeof(hdr->magic));
+  hdr->version = PACKLOG_VERSION;
+  hdr->headerSize = sizeof(struct packlog_header);
+  hdr->blockRecords = blockRecords;
+  hdr->qff = qff;
+  for (int i = 0; i < 8; i++) {
+    hdr->C[i] = C[i];
+  }
+  snprintf(hdr->started, sizeof(hdr->started), "%s", started);
+
+  hdr->crc = flightlogCRC(hdr, offsetof(struct packlog_header, crc));
+}
+
+/*
+ * packlogHeaderValid: Is this a header we know how to read?
+ *****************************************************************************
+ */
+
+bool packlogHeaderValid(const struct packlog_header *hdr) {
+  if (memcmp(hdr->magic, PACKLOG_MAGIC, sizeof(hdr->magic)) != 0)
+    return false;
+
+  if ((hdr->version != PACKLOG_VERSION) ||
+      (hdr->headerSize != sizeof(struct packlog_header)) ||
+      (hdr->blockRecords < 1) || (hdr->blockRecords > PACKLOG_MAX_BLOCK))
+    return false;
+
+  return (hdr->crc == flightlogCRC(hdr, offsetof(struct packlog_header, crc)));
+}
+
+/*
+ * packlogDecode: Unpacks the block at the start of buf into out, which
+ *                must have room for max records.  T1, P1, P2 and the
+ *                altitude are left at zero for the caller to work out.
+ *                used is set to how far to move on, which for a damaged
+ *                block is just past its mark, so the next one can be
+ *                looked for.
+ *                Returns the number of records, or -1 if the block is
+ *                damaged or cut short
+ *****************************************************************************
+ */
+
+int packlogDecode(const uint8_t *buf, size_t len, struct data_second *out, int max, size_t *used) {
+  struct packlog_block blk;
+  struct packlog_state s;
+  const uint8_t *p, *end;
+  int64_t v[7], deadCounts;
+  int n;
+
+  *used = 1;
+
+  if (len < sizeof(blk))
+    return -1;
+  memcpy(&blk, buf, sizeof(blk));
+  if ((blk.mark != PACKLOG_BLOCK_MARK) || (blk.count > max) || (blk.len > len - sizeof(blk)))
+    return -1;
+
+  p = buf + sizeof(blk);
+  end = p + blk.len;
+  if (blk.crc != flightlogCRC(p, blk.len))
+    return -1;
+
+  startState(&s);
+  for (int i = 0; i < blk.count; i++) {
+    for (int k = 0; k < 7; k++) {
+      if ((n = getVarint(p, end, &v[k])) == 0)
+        return -1;
+      p += n;
+    }
+
+    // The first record stands on its own, the rest follow on from it
+    s.elapsedUS = nextSecond(s.elapsedUS) + v[0];
+    s.counts += v[1];
+    deadCounts = s.counts - v[2];
+    s.deadTimeUS = predictDeadTime(&s, deadCounts) + v[3];
+    s.deadCounts = deadCounts;
+    s.T += v[4];
+    s.P += v[5];
+
+    memset(&out[i], 0, sizeof(out[i]));
+    out[i].elapsed = s.elapsedUS / 1e6;
+    out[i].counts = s.counts;
+    out[i].deadCounts = s.deadCounts;
+    out[i].deadTime = s.deadTimeUS / 1e6;
+    out[i].T = s.T;
+    out[i].P = s.P;
+    out[i].flags = v[6];
+  }
+
+  *used = sizeof(blk) + blk.len;
+
+  return blk.count;
+}
+
+/*
+ * packlogOpen: Creates a new log, <prefix>_000.pak, and writes its
+ *              header to disk.  It moves on to a new segment after
+ *              about segRecords records.
+ *              Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int packlogOpen(struct packlog *log, const char *prefix, const struct packlog_header *hdr, long segRecords) {
+  log->hdr = *hdr;
+  log->seq = 0;
+  log->len = 0;
+  log->count = 0;
+
+  // Most seconds pack into well under this, so the space reserved for
+  // a segment is only a guess at what it will need
+  return logsegOpen(&log->seg, prefix, ".pak", sizeof(log->hdr) + segRecords * 12LL, &log->hdr, sizeof(log->hdr));
+}
+
+/*
+ * writeBlock: Finishes off the block being built and hands it to the
+ *             segment.  Blocks are never split, so a segment that is
+ *             nearly full is simply left a little short.
+ *             Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+static int writeBlock(struct packlog *log) {
+  struct packlog_block blk;
+  int result;
+
+  if (log->len == 0)
+    return 0;
+
+  memcpy(&blk, log->buf, sizeof(blk));
+  blk.count = log->count;
+  blk.len = log->len - sizeof(blk);
+  blk.crc = flightlogCRC(log->buf + sizeof(blk), blk.len);
+  memcpy(log->buf, &blk, sizeof(blk));
+
+  result = logsegWrite(&log->seg, log->buf, log->len);
+
+  // Whatever happens, don't write the same records twice
+  log->len = 0;
+  log->count = 0;
+
+  return result;
+}
+
+/*
+ * packlogWrite: Adds a second of data to the block being built.  It is
+ *               only written out once the block is full.
+ *               Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int packlogWrite(struct packlog *log, const struct data_second *data) {
+  struct packlog_block blk;
+  struct packlog_state s;
+  uint8_t *p;
+
+  toState(data, &s);
+
+  // Start a new block, which holds the values as they are
+  if (log->len == 0) {
+    memset(&blk, 0, sizeof(blk));
+    blk.mark = PACKLOG_BLOCK_MARK;
+    blk.firstSeq = log->seq;
+    memcpy(log->buf, &blk, sizeof(blk));
+    log->len = sizeof(blk);
+    startState(&log->prev);
+  }
+
+  p = log->buf + log->len;
+  p += putVarint(p, s.elapsedUS - nextSecond(log->prev.elapsedUS));
+  p += putVarint(p, s.counts - log->prev.counts);
+  p += putVarint(p, s.counts - s.deadCounts);       // Pulses without a believable width
+  p += putVarint(p, s.deadTimeUS - predictDeadTime(&log->prev, s.deadCounts));
+  p += putVarint(p, s.T - log->prev.T);
+  p += putVarint(p, s.P - log->prev.P);
+  p += putVarint(p, data->flags);
+  log->len = p - log->buf;
+
+  log->prev = s;
+  log->seq++;
+
+  if (++log->count == log->hdr.blockRecords)
+    return writeBlock(log);
+
+  return 0;
+}
+
+/*
+ * packlogSync: Waits for every finished block to reach the card.  The
+ *              block being built stays in memory, so it isn't broken
+ *              up just to be written sooner.
+ *              Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int packlogSync(struct packlog *log) {
+  return logsegSync(&log->seg);
+}
+
+/*
+ * packlogClose: Writes out the last, partly full block, syncs and closes
+ *               the log
+ *               Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int packlogClose(struct packlog *log) {
+  int result;
+
+  result = writeBlock(log);
+  if (packlogSync(log) < 0)
+    result = -1;
+  if (logsegClose(&log->seg) < 0)
+    result = -1;
+
+  return result;
+}
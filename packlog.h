@@ -0,0 +1,102 @@
+/*
+ *****************************************************************************
+ * packlog.h:  compressed log of raw readings, for long ground runs and
+ *             flights where every byte of storage or downlink counts.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef PACKLOG_H
+#define PACKLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "star_data.h"
+#include "logseg.h"
+
+#define PACKLOG_MAGIC      "STARPAK"  // Seven characters and a NUL
+#define PACKLOG_VERSION    1
+
+// Records per block.  A block is only written once it's full, so this
+// is also how much can be lost if the power goes.
+#define PACKLOG_BLOCK      60
+#define PACKLOG_MAX_BLOCK  255
+
+// The most a record can take: seven varints of up to 10 bytes
+#define PACKLOG_MAX_RECORD 70
+
+// Starts every block, so a decoder can find its way after damage
+#define PACKLOG_BLOCK_MARK 0xA5
+
+// Written once at the start of every segment.  Everything needed to
+// recompute T, P and altitude from the raw values travels with the data.
+struct packlog_header {
+  char magic[8];          // PACKLOG_MAGIC
+  uint16_t version;       // PACKLOG_VERSION
+  uint16_t headerSize;    // sizeof(struct packlog_header)
+  uint16_t blockRecords;  // Records in a full block
+  uint16_t reserved;
+  double qff;             // Sea level pressure used for altitude, mbar
+  uint32_t C[8];          // Altimeter PROM: factory data, C1..C6 and CRC
+  char started[32];       // Local date and time the run started
+  uint32_t reserved2;
+  uint32_t crc;           // CRC-32 of everything above
+};
+
+// Precedes the records of a block
+struct packlog_block {
+  uint8_t mark;           // PACKLOG_BLOCK_MARK
+  uint8_t count;          // Records in the block
+  uint16_t len;           // Bytes of records after this
+  uint32_t firstSeq;      // Record number of the first one
+  uint32_t crc;           // CRC-32 of the records
+};
+
+// What the last record in a block was, in the units it's stored in
+struct packlog_state {
+  int64_t elapsedUS;      // Elapsed, microseconds
+  int64_t counts;
+  int64_t deadCounts;
+  int64_t deadTimeUS;     // Dead time, microseconds
+  int64_t T;
+  int64_t P;
+};
+
+// An open log being written
+struct packlog {
+  struct logseg seg;
+  struct packlog_header hdr;
+  uint32_t seq;                       // Next record number
+  struct packlog_state prev;          // Last record in the block so far
+  int count;                          // Records in the block so far
+  size_t len;                         // Bytes in buf, block header included
+  uint8_t buf[sizeof(struct packlog_block) + PACKLOG_MAX_BLOCK * PACKLOG_MAX_RECORD];
+};
+
+void packlogHeader(struct packlog_header *hdr, const int C[8], double qff, const char *started, int blockRecords);
+bool packlogHeaderValid(const struct packlog_header *hdr);
+int packlogDecode(const uint8_t *buf, size_t len, struct data_second *out, int max, size_t *used);
+
+int packlogOpen(struct packlog *log, const char *prefix, const struct packlog_header *hdr, long segRecords);
+int packlogWrite(struct packlog *log, const struct data_second *data);
+int packlogSync(struct packlog *log);
+int packlogClose(struct packlog *log);
+
+#endif
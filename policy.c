@@ -0,0 +1,183 @@
+/*
+ *****************************************************************************
+ * policy.c:  picks the altimeter profile and how often the log is
+ *            flushed from how fast we're climbing or falling and how
+ *            fast the tube is counting.
+ *
+ *            Going up, coming down fast after the burst and high count
+ *            rates get the fast profiles and a flush every second.  The
+ *            ground and a slow float get the slow, fine profiles and
+ *            flushes far apart, which saves CPU, power and wear on the
+ *            card.  Both rates are smoothed and a new phase has to
+ *            last a while before it's taken up, so noise doesn't flip
+ *            the altimeter back and forth.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "MS5607.h"
+#include "policy.h"
+
+static const struct policy_config defaults = {
+  POLICY_CLIMB_RATE, POLICY_SINK_RATE, POLICY_BUSY_CPS, POLICY_TAU,
+  POLICY_HOLD, POLICY_QUIET_FLUSH, POLICY_BUSY_FLUSH
+};
+
+
+/*
+ * policyInit: Starts on the ground with nothing smoothed yet.  cfg may
+ *             be NULL for the defaults.
+ *****************************************************************************
+ */
+
+void policyInit(struct policy *p, const struct policy_config *cfg) {
+  p->cfg = (cfg != NULL) ? *cfg : defaults;
+  p->lastSeq = 0;
+  p->lastNS = 0;
+  p->lastAlt = 0.0;
+  p->haveAlt = false;
+  p->speed = 0.0;
+  p->cps = 0.0;
+  p->phase = ALT_PROFILE_GROUND;
+  p->candidate = ALT_PROFILE_GROUND;
+  p->since = 0;
+}
+
+/*
+ * smooth: Moves an average dt seconds on towards x
+ *****************************************************************************
+ */
+
+static double smooth(double avg, double x, double dt, double tau) {
+  return avg + (x - avg) * dt / (tau + dt);
+}
+
+/*
+ * flyingPhase: The phase a vertical speed points to once we're flying
+ *****************************************************************************
+ */
+
+static int flyingPhase(const struct policy *p) {
+  if (p->speed > p->cfg.climbRate)
+    return ALT_PROFILE_ASCENT;
+  else if (p->speed < -p->cfg.sinkRate)
+    return ALT_PROFILE_DESCENT;
+  else
+    return ALT_PROFILE_FLOAT;
+}
+
+/*
+ * policyUpdate: Takes in another second.  seq, ns and altitude are from
+ *               the newest altimeter sample (seq 0 if there isn't one),
+ *               counts are from the second just finished, or negative
+ *               if the tube was off.  Launching goes straight to the
+ *               ascent and landing straight to the ground, anything in
+ *               between has to last cfg.hold seconds.
+ *               Returns the phase to be in, ALT_PROFILE_*
+ *****************************************************************************
+ */
+
+int policyUpdate(struct policy *p, bool flying, unsigned long seq, unsigned long long ns, float altitude, int counts) {
+  double dt;
+
+  // The speed from each new sample to the one after it
+  if ((seq != 0) && (seq != p->lastSeq)) {
+    if (p->haveAlt && (ns > p->lastNS)) {
+      dt = (ns - p->lastNS) / 1e9;
+      p->speed = smooth(p->speed, (altitude - p->lastAlt) / dt, dt, p->cfg.tau);
+    }
+    p->lastSeq = seq;
+    p->lastNS = ns;
+    p->lastAlt = altitude;
+    p->haveAlt = true;
+  }
+
+  p->cps = smooth(p->cps, (counts > 0) ? counts : 0, 1.0, p->cfg.tau);
+
+  if (!flying) {
+    p->phase = p->candidate = ALT_PROFILE_GROUND;
+    p->since = 0;
+    return p->phase;
+  }
+
+  // Just launched, we know which way we're going
+  if (p->phase == ALT_PROFILE_GROUND) {
+    p->phase = p->candidate = ALT_PROFILE_ASCENT;
+    p->since = 0;
+    return p->phase;
+  }
+
+  if (flyingPhase(p) != p->candidate) {
+    p->candidate = flyingPhase(p);
+    p->since = 0;
+  }
+
+  if ((p->candidate != p->phase) && (++p->since >= p->cfg.hold))
+    p->phase = p->candidate;
+
+  return p->phase;
+}
+
+/*
+ * policyPhase: The phase we're in, ALT_PROFILE_*
+ *****************************************************************************
+ */
+
+int policyPhase(const struct policy *p) {
+  return p->phase;
+}
+
+/*
+ * policyBusy: Is something happening that's worth keeping close track
+ *             of?  Climbing, falling, or counting fast.
+ *****************************************************************************
+ */
+
+bool policyBusy(const struct policy *p) {
+  return (p->phase == ALT_PROFILE_ASCENT) || (p->phase == ALT_PROFILE_DESCENT) || (p->cps > p->cfg.busyCPS);
+}
+
+/*
+ * policyFlushEvery: How many records to let go between flushes of the log
+ *****************************************************************************
+ */
+
+int policyFlushEvery(const struct policy *p) {
+  return policyBusy(p) ? p->cfg.busyFlush : p->cfg.quietFlush;
+}
+
+/*
+ * policySpeed: The smoothed vertical speed, m/s, up is positive
+ *****************************************************************************
+ */
+
+double policySpeed(const struct policy *p) {
+  return p->speed;
+}
+
+/*
+ * policyCPS: The smoothed count rate, counts/s
+ *****************************************************************************
+ */
+
+double policyCPS(const struct policy *p) {
+  return p->cps;
+}
@@ -0,0 +1,71 @@
+/*
+ *****************************************************************************
+ * policy.h:  picks the altimeter profile and how often the log is
+ *            flushed from how fast we're climbing or falling and how
+ *            fast the tube is counting.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stdbool.h>
+
+// Defaults for struct policy_config
+#define POLICY_CLIMB_RATE     1.5     // m/s, faster than this up is an ascent
+#define POLICY_SINK_RATE      1.5     // m/s, faster than this down is a descent
+#define POLICY_BUSY_CPS       20.0    // counts/s, more than this is busy
+#define POLICY_TAU            10.0    // s, smoothing of both rates
+#define POLICY_HOLD           10      // s a new phase has to last to be taken up
+#define POLICY_QUIET_FLUSH    30      // Records between flushes when quiet
+#define POLICY_BUSY_FLUSH     1       // Records between flushes when busy
+
+struct policy_config {
+  double climbRate;           // m/s
+  double sinkRate;            // m/s
+  double busyCPS;             // counts/s
+  double tau;                 // s
+  int hold;                   // s
+  int quietFlush;             // Records
+  int busyFlush;              // Records
+};
+
+struct policy {
+  struct policy_config cfg;
+  unsigned long lastSeq;      // Altimeter sample the speed was last worked out from
+  unsigned long long lastNS;  //   and when it was taken
+  float lastAlt;              //   and its altitude
+  bool haveAlt;               // Is there a sample to work from yet?
+  double speed;               // Smoothed vertical speed, m/s, up is positive
+  double cps;                 // Smoothed count rate, counts/s
+  int phase;                  // ALT_PROFILE_*
+  int candidate;              // Phase the speed points to
+  int since;                  // Seconds it has pointed there
+};
+
+void policyInit(struct policy *p, const struct policy_config *cfg);
+int policyUpdate(struct policy *p, bool flying, unsigned long seq, unsigned long long ns, float altitude, int counts);
+int policyPhase(const struct policy *p);
+bool policyBusy(const struct policy *p);
+int policyFlushEvery(const struct policy *p);
+double policySpeed(const struct policy *p);
+double policyCPS(const struct policy *p);
+
+#endif
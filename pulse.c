@@ -0,0 +1,117 @@
+/*
+ *****************************************************************************
+ * pulse.c:  lock-free ring of raw Geiger pulse edges, written by the edge
+ *           capture path and read by the pulse processing thread.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "pulse.h"
+
+
+/*
+ * pulseRingInit: Set up a ring over caller-provided storage.
+ *                size must be a power of two.
+ *                Returns -1 if the size is unusable.
+ *****************************************************************************
+ */
+
+int pulseRingInit(struct pulse_ring *ring, struct pulse_edge *edges, uint32_t size) {
+
+  // The index math below relies on wrapping with a mask
+  if ((size < 2) || ((size & (size - 1)) != 0))
+    return -1;
+
+  ring->edges = edges;
+  ring->mask = size - 1;
+  pulseRingReset(ring);
+
+  return 0;
+}
+
+/*
+ * pulseRingReset: Empty the ring.  Only safe while no edges are being
+ *                 pushed or popped.
+ *****************************************************************************
+ */
+
+void pulseRingReset(struct pulse_ring *ring) {
+  atomic_store(&ring->head, 0);
+  atomic_store(&ring->tail, 0);
+  atomic_store(&ring->dropped, 0);
+}
+
+/*
+ * pulseRingPush: Append an edge.  Called only by the producer.
+ *                Returns false (and counts a drop) if the ring is full.
+ *****************************************************************************
+ */
+
+bool pulseRingPush(struct pulse_ring *ring, uint64_t ns, uint32_t type) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  // The consumer has fallen a whole ring behind, drop the edge
+  if (head - tail > ring->mask) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return false;
+  }
+
+  ring->edges[head & ring->mask].ns = ns;
+  ring->edges[head & ring->mask].type = type;
+
+  // Publish the slot only after it has been filled in
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+  return true;
+}
+
+/*
+ * pulseRingPop: Take the oldest edge.  Called only by the consumer.
+ *               Returns false if the ring is empty.
+ *****************************************************************************
+ */
+
+bool pulseRingPop(struct pulse_ring *ring, struct pulse_edge *edge) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  // Nothing waiting
+  if (tail == head)
+    return false;
+
+  *edge = ring->edges[tail & ring->mask];
+
+  // Hand the slot back to the producer only after it has been copied
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+  return true;
+}
+
+/*
+ * pulseRingDropped: How many edges have been lost to a full ring.
+ *****************************************************************************
+ */
+
+uint32_t pulseRingDropped(struct pulse_ring *ring) {
+  return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,60 @@
+/*
+ *****************************************************************************
+ * pulse.h:  lock-free ring of raw Geiger pulse edges, written by the edge
+ *           capture path and read by the pulse processing thread.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef PULSE_H
+#define PULSE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Which way the Geiger pin moved.  PULSE_EDGE_ANY is used when the
+// capture path can't tell (wiringPi only reports that an edge happened).
+#define PULSE_EDGE_ANY     0
+#define PULSE_EDGE_FALLING 1
+#define PULSE_EDGE_RISING  2
+
+// A single edge, stamped against CLOCK_MONOTONIC
+struct pulse_edge {
+  uint64_t ns;            // Time of the edge, nanoseconds
+  uint32_t type;          // PULSE_EDGE_*
+};
+
+// Single-producer/single-consumer ring.  head is only written by the
+// producer and tail only by the consumer, so neither side ever locks.
+struct pulse_ring {
+  struct pulse_edge *edges;                 // Storage, size is a power of 2
+  uint32_t mask;                            // size - 1
+  _Alignas(64) atomic_uint head;            // Next slot to write
+  _Alignas(64) atomic_uint tail;            // Next slot to read
+  _Alignas(64) atomic_uint dropped;         // Edges lost to a full ring
+};
+
+int pulseRingInit(struct pulse_ring *ring, struct pulse_edge *edges, uint32_t size);
+void pulseRingReset(struct pulse_ring *ring);
+bool pulseRingPush(struct pulse_ring *ring, uint64_t ns, uint32_t type);
+bool pulseRingPop(struct pulse_ring *ring, struct pulse_edge *edge);
+uint32_t pulseRingDropped(struct pulse_ring *ring);
+
+#endif
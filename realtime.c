@@ -0,0 +1,204 @@
+/*
+ *****************************************************************************
+ * realtime.c:  scheduling policy, priority and CPU affinity of each of
+ *              STAR's threads, and memory locking.
+ *
+ *              Each thread calls rtApply() for its role as it starts, so
+ *              the settings chosen on the command line follow it no
+ *              matter who created it.  Nothing changes unless a role
+ *              has been configured.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "star_common.h"
+#include "realtime.h"
+
+// What was asked for, and what happened, for each role
+struct rt_role {
+  const char *name;
+  int policy;             // SCHED_*, or RT_POLICY_INHERIT
+  int priority;
+  unsigned long cpus;     // Bit n allows CPU n, 0 leaves affinity alone
+  bool applied;           // Has the thread started yet?
+  int policyErr;          // errno from setting the policy, 0 if fine
+  int cpuErr;             // errno from setting the affinity, 0 if fine
+};
+
+static struct rt_role roles[RT_ROLES] = {
+  { "capture",   RT_POLICY_INHERIT, 0, 0, false, 0, 0 },
+  { "count",     RT_POLICY_INHERIT, 0, 0, false, 0, 0 },
+  { "LED",       RT_POLICY_INHERIT, 0, 0, false, 0, 0 },
+  { "writer",    RT_POLICY_INHERIT, 0, 0, false, 0, 0 },
+  { "altimeter", RT_POLICY_INHERIT, 0, 0, false, 0, 0 },
+  { "main",      RT_POLICY_INHERIT, 0, 0, false, 0, 0 },
+  { "export",    RT_POLICY_INHERIT, 0, 0, false, 0, 0 },
+  { "coincidence", RT_POLICY_INHERIT, 0, 0, false, 0, 0 },
+  { "spi",       RT_POLICY_INHERIT, 0, 0, false, 0, 0 }
+};
+
+static int lockErr = -1;  // errno from mlockall(), 0 if fine, -1 if not tried
+
+pthread_mutex_t lock_rt = PTHREAD_MUTEX_INITIALIZER;  // Guards roles and lockErr
+
+
+/*
+ * rtNumCPUs: How many CPUs are online
+ *****************************************************************************
+ */
+
+int rtNumCPUs(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return (n < 1) ? 1 : n;
+}
+
+/*
+ * rtConfigure: Sets the policy, priority and allowed CPUs for a role.
+ *              Only takes effect for threads started afterwards.
+ *****************************************************************************
+ */
+
+void rtConfigure(int role, int policy, int priority, unsigned long cpus) {
+  pthread_mutex_lock(&lock_rt);
+  roles[role].policy = policy;
+  roles[role].priority = priority;
+  roles[role].cpus = cpus;
+  pthread_mutex_unlock(&lock_rt);
+}
+
+/*
+ * rtApply: Applies a role's settings to the calling thread
+ *****************************************************************************
+ */
+
+void rtApply(int role) {
+  struct rt_role r;
+  struct sched_param param;
+  cpu_set_t set;
+
+  pthread_mutex_lock(&lock_rt);
+  r = roles[role];
+  pthread_mutex_unlock(&lock_rt);
+
+  r.policyErr = 0;
+  r.cpuErr = 0;
+
+  if (r.policy != RT_POLICY_INHERIT) {
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = r.priority;
+    r.policyErr = pthread_setschedparam(pthread_self(), r.policy, &param);
+  }
+
+  if (r.cpus != 0) {
+    CPU_ZERO(&set);
+    for (int i = 0; i < (int)(8 * sizeof(r.cpus)); i++) {
+      if (r.cpus & (1UL << i))
+        CPU_SET(i, &set);
+    }
+    r.cpuErr = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  pthread_mutex_lock(&lock_rt);
+  roles[role].applied = true;
+  roles[role].policyErr = r.policyErr;
+  roles[role].cpuErr = r.cpuErr;
+  pthread_mutex_unlock(&lock_rt);
+}
+
+/*
+ * rtLockMemory: Locks every page we have, and every page we will have,
+ *               into RAM so a page fault never stalls the pulse path
+ *               Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int rtLockMemory(void) {
+  int result = mlockall(MCL_CURRENT | MCL_FUTURE);
+
+  pthread_mutex_lock(&lock_rt);
+  lockErr = (result < 0) ? errno : 0;
+  pthread_mutex_unlock(&lock_rt);
+
+  return result;
+}
+
+/*
+ * policyName: Names a scheduling policy
+ *****************************************************************************
+ */
+
+static const char *policyName(int policy) {
+  switch (policy) {
+    case RT_POLICY_INHERIT: return "inherited";
+    case SCHED_OTHER:       return "SCHED_OTHER";
+    case SCHED_FIFO:        return "SCHED_FIFO";
+    case SCHED_RR:          return "SCHED_RR";
+    default:                return "unknown";
+  }
+}
+
+/*
+ * rtReport: Writes what each role asked for and got to the log
+ *****************************************************************************
+ */
+
+void rtReport(FILE *errf) {
+  struct rt_role r;
+  int err;
+
+  pthread_mutex_lock(&lock_rt);
+  err = lockErr;
+  pthread_mutex_unlock(&lock_rt);
+
+  if (err < 0)
+    fprintf(errf, "%s rt memory not locked\n", getTimeStamp());
+  else
+    fprintf(errf, "%s rt mlockall(): %s\n", getTimeStamp(), (err == 0) ? "ok" : strerror(err));
+
+  for (int i = 0; i < RT_ROLES; i++) {
+    pthread_mutex_lock(&lock_rt);
+    r = roles[i];
+    pthread_mutex_unlock(&lock_rt);
+
+    fprintf(errf, "%s rt %s: %s", getTimeStamp(), r.name, policyName(r.policy));
+    if (r.policy != RT_POLICY_INHERIT)
+      fprintf(errf, " %d", r.priority);
+    if (r.cpus != 0)
+      fprintf(errf, ", CPUs 0x%lx", r.cpus);
+    else
+      fprintf(errf, ", any CPU");
+
+    if (!r.applied)
+      fprintf(errf, ", not started yet\n");
+    else if ((r.policyErr != 0) || (r.cpuErr != 0))
+      fprintf(errf, ", failed: %s\n", strerror((r.policyErr != 0) ? r.policyErr : r.cpuErr));
+    else
+      fprintf(errf, ", ok\n");
+  }
+}
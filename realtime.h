@@ -0,0 +1,51 @@
+/*
+ *****************************************************************************
+ * realtime.h:  scheduling policy, priority and CPU affinity of each of
+ *              STAR's threads, and memory locking.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdio.h>
+
+// What each thread does
+#define RT_CAPTURE    0     // Edge capture, ISR or line events
+#define RT_COUNT      1     // Edge processing, countThread()
+#define RT_LED        2     // blinkLED()
+#define RT_WRITER     3     // Disk and console output, and the log segment helpers
+#define RT_ALTIMETER  4     // Altimeter sampling
+#define RT_MAIN       5     // The 1 Hz main loop
+#define RT_EXPORT     6     // Shared memory export
+#define RT_COINC      7     // Coincidences across channels, coincidenceThread()
+#define RT_SPI        8     // SPI bus thread, spibus.c
+#define RT_ROLES      9
+
+// Leave the policy alone
+#define RT_POLICY_INHERIT  -1
+
+int rtNumCPUs(void);
+void rtConfigure(int role, int policy, int priority, unsigned long cpus);
+void rtApply(int role);
+int rtLockMemory(void);
+void rtReport(FILE *errf);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ *****************************************************************************
+ * seqlock.c:  sequence lock, so that readers can take a consistent copy of
+ *             data without ever blocking the thread that writes it.
+ *
+ *             There must only be one writer at a time.  Readers copy the
+ *             data between seqlockReadBegin() and seqlockReadRetry(), and
+ *             try again if a write happened in the meantime.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include "seqlock.h"
+
+
+/*
+ * seqlockInit: Sets up a sequence lock with no write in progress
+ *****************************************************************************
+ */
+
+void seqlockInit(struct seqlock *sl) {
+  atomic_store(&sl->seq, 0);
+}
+
+/*
+ * seqlockWriteBegin: Marks the start of a write
+ *****************************************************************************
+ */
+
+void seqlockWriteBegin(struct seqlock *sl) {
+  unsigned int seq = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&sl->seq, seq + 1, memory_order_relaxed);
+
+  // Readers must see the odd count before any of the new data
+  atomic_thread_fence(memory_order_release);
+}
+
+/*
+ * seqlockWriteEnd: Marks the end of a write
+ *****************************************************************************
+ */
+
+void seqlockWriteEnd(struct seqlock *sl) {
+  unsigned int seq = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+
+  // Publish the data before the even count
+  atomic_store_explicit(&sl->seq, seq + 1, memory_order_release);
+}
+
+/*
+ * seqlockReadBegin: Waits for any write in progress to finish and returns
+ *                   the count to hand to seqlockReadRetry()
+ *****************************************************************************
+ */
+
+unsigned int seqlockReadBegin(struct seqlock *sl) {
+  unsigned int seq;
+
+  while ((seq = atomic_load_explicit(&sl->seq, memory_order_acquire)) & 1) {
+    sched_yield();          // Let the writer finish
+  }
+
+  return seq;
+}
+
+/*
+ * seqlockReadTry: Like seqlockReadBegin(), but never waits.  Returns
+ *                 false if a write is in progress.
+ *****************************************************************************
+ */
+
+bool seqlockReadTry(struct seqlock *sl, unsigned int *start) {
+  *start = atomic_load_explicit(&sl->seq, memory_order_acquire);
+
+  return (*start & 1) == 0;
+}
+
+/*
+ * seqlockReadRetry: Returns true if the data read since seqlockReadBegin()
+ *                   may be torn and has to be read again
+ *****************************************************************************
+ */
+
+bool seqlockReadRetry(struct seqlock *sl, unsigned int start) {
+
+  // Finish reading the data before looking at the count again
+  atomic_thread_fence(memory_order_acquire);
+
+  return atomic_load_explicit(&sl->seq, memory_order_relaxed) != start;
+}
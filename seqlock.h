@@ -0,0 +1,43 @@
+/*
+ *****************************************************************************
+ * seqlock.h:  sequence lock, so that readers can take a consistent copy of
+ *             data without ever blocking the thread that writes it.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// The count is odd while a write is in progress
+struct seqlock {
+  atomic_uint seq;
+};
+
+void seqlockInit(struct seqlock *sl);
+void seqlockWriteBegin(struct seqlock *sl);
+void seqlockWriteEnd(struct seqlock *sl);
+unsigned int seqlockReadBegin(struct seqlock *sl);
+bool seqlockReadTry(struct seqlock *sl, unsigned int *start);
+bool seqlockReadRetry(struct seqlock *sl, unsigned int start);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ *****************************************************************************
+ * sim.c:  simulated Geiger pulses and altimeter readings, for testing and
+ *         benchmarking without a tube, a source or an MS5607.
+ *
+ *         Particles arrive as a Poisson process at a set rate, or at the
+ *         per-second counts of a recorded flight.  The tube is modelled
+ *         as non-paralyzable: each particle it sees becomes a pulse of a
+ *         fixed width (a falling then a rising edge), and any particle
+ *         that arrives during a pulse is lost.  What really happened is
+ *         kept as ground truth for the counting to be checked against.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "star_common.h"
+#include "pulse.h"
+#include "sim.h"
+
+#define NEVER  UINT64_MAX
+
+// Raw readings that compensate to 20.07 C and 1000.09 mbar with the
+// coefficients from the MS5607 data sheet example
+#define SIM_D1  6465444UL
+#define SIM_D2  8077636UL
+
+static struct sim_config config = { 0.0, 0.000150, NULL, 0 };
+
+// A recorded flight, one entry per second
+static long replaySecs = 0;
+static int *replayCounts = NULL;
+static unsigned long *replayT = NULL;
+static unsigned long *replayP = NULL;
+
+// Arrival times within the replay second being played, ns from its start
+static unsigned long long *secArrivals = NULL;
+static int secSize = 0, secNum = 0, secNext = 0;
+static long replaySec;
+
+static bool running = false;
+static unsigned long long startNS, endNS;
+static unsigned long long nextArrival;  // Next particle, or NEVER
+static unsigned long long pendingRise;  // End of the pulse in progress, or 0
+static unsigned long long deadUntil;    // The tube can't see anything before this
+static unsigned long long widthNS;
+static uint64_t rng;                    // xorshift64* state
+static struct sim_truth truth;
+
+pthread_mutex_t lock_sim = PTHREAD_MUTEX_INITIALIZER;  // Guards everything above
+
+
+/*
+ * uniform: A random number in (0, 1]
+ *****************************************************************************
+ */
+
+static double uniform(void) {
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+
+  return ((rng * 2685821657736338717ULL) >> 11) / 9007199254740992.0 + 1.0 / 9007199254740992.0;
+}
+
+/*
+ * compareNS: For sorting arrival times
+ *****************************************************************************
+ */
+
+static int compareNS(const void *a, const void *b) {
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ * arrivalAfter: When the next particle arrives after one at t
+ *****************************************************************************
+ */
+
+static unsigned long long arrivalAfter(unsigned long long t) {
+
+  // Play back a flight, spreading each second's counts at random
+  if (replaySecs > 0) {
+    while (secNext >= secNum) {
+      if (++replaySec >= replaySecs)
+        return NEVER;
+
+      secNum = (replayCounts[replaySec] > 0) ? replayCounts[replaySec] : 0;
+      if (secNum > secSize) {
+        secSize = secNum;
+        secArrivals = realloc(secArrivals, secSize * sizeof(secArrivals[0]));
+      }
+      for (int i = 0; i < secNum; i++) {
+        secArrivals[i] = (1.0 - uniform()) * 1000000000.0;
+      }
+      qsort(secArrivals, secNum, sizeof(secArrivals[0]), compareNS);
+      secNext = 0;
+    }
+
+    return startNS + replaySec * 1000000000ULL + secArrivals[secNext++];
+  }
+
+  // Poisson arrivals have exponential gaps
+  if (config.rate <= 0)
+    return NEVER;
+
+  return t + (unsigned long long)(-log(uniform()) / config.rate * 1000000000.0);
+}
+
+/*
+ * loadReplay: Reads the per-second counts and raw altimeter values of a
+ *             counts_*.txt file, as written by STAR or star2csv.
+ *             Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+static int loadReplay(const char *fname) {
+  char line[256];
+  double elapsed;
+  int counts;
+  unsigned long T, P;
+  long size = 0;
+  FILE *f;
+
+  free(replayCounts);
+  free(replayT);
+  free(replayP);
+  replayCounts = NULL;
+  replayT = replayP = NULL;
+  replaySecs = 0;
+
+  if ((f = fopen(fname, "r")) == NULL)
+    return -1;
+
+  // The time stamp and column names don't scan as numbers
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "%lf, %d, %lu, %*f, %lu", &elapsed, &counts, &T, &P) != 4)
+      continue;
+
+    if (replaySecs == size) {
+      size = (size == 0) ? 4096 : size * 2;
+      replayCounts = realloc(replayCounts, size * sizeof(replayCounts[0]));
+      replayT = realloc(replayT, size * sizeof(replayT[0]));
+      replayP = realloc(replayP, size * sizeof(replayP[0]));
+    }
+    replayCounts[replaySecs] = counts;
+    replayT[replaySecs] = T;
+    replayP[replaySecs] = P;
+    replaySecs++;
+  }
+  fclose(f);
+
+  return (replaySecs > 0) ? 0 : -1;
+}
+
+/*
+ * simConfigure: Sets what to simulate, loading the flight to replay if
+ *               there is one.  Takes effect at the next simStart().
+ *               Returns -1 if the replay can't be read
+ *****************************************************************************
+ */
+
+int simConfigure(const struct sim_config *cfg) {
+  int result = 0;
+
+  pthread_mutex_lock(&lock_sim);
+
+  config = *cfg;
+  if (config.replay != NULL)
+    result = loadReplay(config.replay);
+  else
+    replaySecs = 0;
+
+  pthread_mutex_unlock(&lock_sim);
+
+  return result;
+}
+
+/*
+ * simStart: Starts simulating with the first particle after startNS,
+ *           and none from endNS on (0 to run forever).  Clears the
+ *           ground truth.
+ *****************************************************************************
+ */
+
+void simStart(unsigned long long start, unsigned long long end) {
+  pthread_mutex_lock(&lock_sim);
+
+  startNS = start;
+  endNS = (end == 0) ? NEVER : end;
+  widthNS = config.width * 1000000000.0;
+  rng = (config.seed != 0) ? config.seed : (uint64_t)time(NULL) * 2654435761ULL + 1;
+
+  replaySec = -1;
+  secNum = secNext = 0;
+  nextArrival = arrivalAfter(start);
+  pendingRise = 0;
+  deadUntil = 0;
+  memset(&truth, 0, sizeof(truth));
+  running = true;
+
+  pthread_mutex_unlock(&lock_sim);
+}
+
+/*
+ * simStop: Stops producing edges
+ *****************************************************************************
+ */
+
+void simStop(void) {
+  pthread_mutex_lock(&lock_sim);
+  running = false;
+  pthread_mutex_unlock(&lock_sim);
+}
+
+/*
+ * simReplaySeconds: How long the loaded flight is, 0 if there isn't one
+ *****************************************************************************
+ */
+
+long simReplaySeconds(void) {
+  long n;
+
+  pthread_mutex_lock(&lock_sim);
+  n = replaySecs;
+  pthread_mutex_unlock(&lock_sim);
+
+  return n;
+}
+
+/*
+ * simEdges: Produces every edge up to untilNS, oldest first
+ *           Returns how many there were
+ *****************************************************************************
+ */
+
+int simEdges(unsigned long long untilNS, void (*emit)(uint64_t ns, uint32_t type)) {
+  unsigned long long a;
+  int n = 0;
+
+  pthread_mutex_lock(&lock_sim);
+
+  while (running) {
+    a = (nextArrival >= endNS) ? NEVER : nextArrival;
+
+    // The pulse in progress ends before anything else happens
+    if ((pendingRise != 0) && (pendingRise <= a)) {
+      if (pendingRise > untilNS)
+        break;
+      emit(pendingRise, PULSE_EDGE_RISING);
+      pendingRise = 0;
+      n++;
+      continue;
+    }
+
+    // Nothing more yet
+    if (a > untilNS)
+      break;
+
+    // A particle arrives, and the tube either sees it or is still dead
+    truth.arrivals++;
+    if (a < deadUntil) {
+      truth.lost++;
+    }
+    else {
+      emit(a, PULSE_EDGE_FALLING);
+      truth.pulses++;
+      truth.deadTime += widthNS / 1000000000.0;
+      pendingRise = deadUntil = a + widthNS;
+      n++;
+    }
+
+    nextArrival = arrivalAfter(a);
+  }
+
+  pthread_mutex_unlock(&lock_sim);
+
+  return n;
+}
+
+/*
+ * simAltimeter: Raw altimeter readings for right now, from the flight
+ *               being replayed or else a steady day on the ground
+ *               Returns false if there is nothing to replay
+ *****************************************************************************
+ */
+
+bool simAltimeter(unsigned long *T, unsigned long *P) {
+  long s;
+  bool result = true;
+
+  *T = SIM_D2;
+  *P = SIM_D1;
+
+  pthread_mutex_lock(&lock_sim);
+
+  if (replaySecs > 0) {
+    s = (running && (getTimeNS() > startNS)) ? (long)((getTimeNS() - startNS) / 1000000000ULL) : 0;
+    if (s >= replaySecs)
+      s = replaySecs - 1;
+
+    // Skip seconds where the altimeter wasn't read
+    if ((replayT[s] != 0) && (replayP[s] != 0)) {
+      *T = replayT[s];
+      *P = replayP[s];
+    }
+  }
+  else {
+    result = false;
+  }
+
+  pthread_mutex_unlock(&lock_sim);
+
+  return result;
+}
+
+/*
+ * simGetTruth: Copies what has really happened since simStart()
+ *****************************************************************************
+ */
+
+void simGetTruth(struct sim_truth *out) {
+  pthread_mutex_lock(&lock_sim);
+  *out = truth;
+  pthread_mutex_unlock(&lock_sim);
+}
@@ -0,0 +1,55 @@
+/*
+ *****************************************************************************
+ * sim.h:  simulated Geiger pulses and altimeter readings, for testing and
+ *         benchmarking without a tube, a source or an MS5607.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// What to simulate
+struct sim_config {
+  double rate;            // Mean pulses per second, Poisson
+  double width;           // Pulse width (the tube's dead time), seconds
+  const char *replay;     // counts_*.txt to replay instead, or NULL
+  unsigned int seed;      // Random seed, 0 for a different run each time
+};
+
+// What really happened, to check the counting against
+struct sim_truth {
+  unsigned long long arrivals;  // Particles that reached the tube
+  unsigned long long pulses;    // Pulses it produced
+  unsigned long long lost;      // Particles that arrived while it was dead
+  double deadTime;              // Total width of the pulses, seconds
+};
+
+int simConfigure(const struct sim_config *cfg);
+void simStart(unsigned long long startNS, unsigned long long endNS);
+void simStop(void);
+long simReplaySeconds(void);
+int simEdges(unsigned long long untilNS, void (*emit)(uint64_t ns, uint32_t type));
+bool simAltimeter(unsigned long *T, unsigned long *P);
+void simGetTruth(struct sim_truth *truth);
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ *****************************************************************************
+ * spibus.c:  one thread that owns the SPI bus and runs every device's
+ *            transactions on it, one at a time, in the order they are due.
+ *
+ *            Every device has its own speed, mode and delays, and each
+ *            transaction carries them with it, so nothing one device
+ *            does can change another's timing.  A device that has to
+ *            wait for a conversion queues its readout for when the
+ *            conversion will be done and lets go of the bus, so the
+ *            waits of several devices overlap.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include "PiSPI.h"
+#include "realtime.h"
+#include "latency.h"
+#include "spibus.h"
+
+
+/*
+ * nowNS: The current CLOCK_MONOTONIC time, nanoseconds.  Transactions
+ *        are due against the real clock even when getTimeNS() is
+ *        virtual.
+ *****************************************************************************
+ */
+
+static unsigned long long nowNS(void) {
+  struct timespec tim;
+
+  clock_gettime(CLOCK_MONOTONIC, &tim);
+
+  return tim.tv_sec * 1000000000ULL + tim.tv_nsec;
+}
+
+/*
+ * runTxn: Send a transaction and record how long it held the bus
+ *****************************************************************************
+ */
+
+static int runTxn(const struct spi_device *dev, struct spi_segment *segs, int n) {
+  unsigned long long start = nowNS();
+  int result = SPIDeviceRWSegments(dev, segs, n);
+
+  latRecord(LAT_SPI, nowNS() - start);
+  return result;
+}
+
+/*
+ * nextTxn: The queued transaction that is due first, oldest first if
+ *          several are due at once.  Called with the lock held.
+ *****************************************************************************
+ */
+
+static int nextTxn(struct spi_bus *bus) {
+  int best = 0;
+
+  for (int i = 1; i < bus->queued; i++) {
+    if ((bus->queue[i]->dueNS < bus->queue[best]->dueNS) ||
+        ((bus->queue[i]->dueNS == bus->queue[best]->dueNS) && (bus->queue[i]->seq < bus->queue[best]->seq)))
+      best = i;
+  }
+
+  return best;
+}
+
+/*
+ * finishTxn: Hand a result back to whoever is waiting for it.  Called
+ *            with the lock held.
+ *****************************************************************************
+ */
+
+static void finishTxn(struct spi_bus *bus, struct spi_txn *txn, int result) {
+  txn->result = result;
+  txn->done = true;
+  pthread_cond_broadcast(&bus->finished);
+}
+
+/*
+ * busThread: Runs each transaction once it is due, the earliest first
+ *****************************************************************************
+ */
+
+static void *busThread(void *vargp) {
+  struct spi_bus *bus = vargp;
+  struct spi_txn *txn;
+  struct timespec tim;
+  int i, result;
+
+  rtApply(RT_SPI);
+
+  pthread_mutex_lock(&bus->lock);
+  while (atomic_load(&bus->running)) {
+
+    // Nothing to do
+    if (bus->queued == 0) {
+      pthread_cond_wait(&bus->wake, &bus->lock);
+      continue;
+    }
+
+    // Not due yet.  Something due sooner may be queued in the meantime.
+    i = nextTxn(bus);
+    txn = bus->queue[i];
+    if (txn->dueNS > nowNS()) {
+      tim.tv_sec = txn->dueNS / 1000000000ULL;
+      tim.tv_nsec = txn->dueNS % 1000000000ULL;
+      pthread_cond_timedwait(&bus->wake, &bus->lock, &tim);
+      continue;
+    }
+
+    bus->queue[i] = bus->queue[--bus->queued];
+
+    // Others can queue while it runs
+    pthread_mutex_unlock(&bus->lock);
+    result = runTxn(txn->dev, txn->segs, txn->n);
+    pthread_mutex_lock(&bus->lock);
+
+    finishTxn(bus, txn, result);
+  }
+
+  // Anything left over never goes out
+  while (bus->queued > 0) {
+    finishTxn(bus, bus->queue[--bus->queued], -1);
+  }
+  pthread_mutex_unlock(&bus->lock);
+
+  pthread_exit(NULL);
+}
+
+/*
+ * spiBusStart: Starts the thread that owns the bus
+ *              Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int spiBusStart(struct spi_bus *bus) {
+  pthread_condattr_t attr;
+
+  // Due times are CLOCK_MONOTONIC, so the waits have to be too
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+  pthread_mutex_init(&bus->lock, NULL);
+  pthread_cond_init(&bus->wake, &attr);
+  pthread_cond_init(&bus->finished, NULL);
+  pthread_condattr_destroy(&attr);
+
+  bus->queued = 0;
+  bus->seq = 0;
+  atomic_store(&bus->running, true);
+
+  if (pthread_create(&bus->thread, NULL, busThread, bus) != 0) {
+    atomic_store(&bus->running, false);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * spiBusStop: Stops the bus thread.  Anything still queued fails.
+ *****************************************************************************
+ */
+
+void spiBusStop(struct spi_bus *bus) {
+  if (!atomic_load(&bus->running))
+    return;
+
+  pthread_mutex_lock(&bus->lock);
+  atomic_store(&bus->running, false);
+  pthread_cond_signal(&bus->wake);
+  pthread_mutex_unlock(&bus->lock);
+
+  pthread_join(bus->thread, NULL);
+}
+
+/*
+ * spiBusSubmit: Queues a transaction without waiting for it.  txn and
+ *               its segments have to stay put until spiBusWait().
+ *               If the queue is full, waits for room.
+ *               Returns -1 if the bus isn't running
+ *****************************************************************************
+ */
+
+int spiBusSubmit(struct spi_bus *bus, struct spi_txn *txn) {
+  pthread_mutex_lock(&bus->lock);
+
+  while (atomic_load(&bus->running) && (bus->queued >= SPI_BUS_QUEUE)) {
+    pthread_cond_wait(&bus->finished, &bus->lock);
+  }
+
+  if (!atomic_load(&bus->running)) {
+    pthread_mutex_unlock(&bus->lock);
+    return -1;
+  }
+
+  txn->done = false;
+  txn->seq = bus->seq++;
+  bus->queue[bus->queued++] = txn;
+
+  pthread_cond_signal(&bus->wake);
+  pthread_mutex_unlock(&bus->lock);
+
+  return 0;
+}
+
+/*
+ * spiBusWait: Waits for a submitted transaction to go out
+ *             Returns what the transfer returned, -1 if it never did
+ *****************************************************************************
+ */
+
+int spiBusWait(struct spi_bus *bus, struct spi_txn *txn) {
+  int result;
+
+  pthread_mutex_lock(&bus->lock);
+  while (!txn->done) {
+    pthread_cond_wait(&bus->finished, &bus->lock);
+  }
+  result = txn->result;
+  pthread_mutex_unlock(&bus->lock);
+
+  return result;
+}
+
+/*
+ * spiBusTransfer: Sends a message to a device no earlier than dueNS and
+ *                 waits for it.  Without a running bus there is nothing
+ *                 to share it with, so it goes out straight away.
+ *****************************************************************************
+ */
+
+int spiBusTransfer(struct spi_bus *bus, const struct spi_device *dev, struct spi_segment *segs, int n, unsigned long long dueNS) {
+  struct spi_txn txn = { dev, segs, n, dueNS, 0, false, 0 };
+  struct timespec tim;
+
+  if ((bus != NULL) && (spiBusSubmit(bus, &txn) == 0))
+    return spiBusWait(bus, &txn);
+
+  // Keep to the due time on our own
+  tim.tv_sec = dueNS / 1000000000ULL;
+  tim.tv_nsec = dueNS % 1000000000ULL;
+  while (dueNS > nowNS()) {
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tim, NULL);
+  }
+
+  return runTxn(dev, segs, n);
+}
@@ -0,0 +1,64 @@
+/*
+ *****************************************************************************
+ * spibus.h:  one thread that owns the SPI bus and runs every device's
+ *            transactions on it, one at a time, in the order they are due.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef SPIBUS_H
+#define SPIBUS_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "PiSPI.h"
+
+// Most transactions that can be waiting for the bus at once
+#define SPI_BUS_QUEUE 16
+
+// One SPI message for one device, run no earlier than dueNS
+struct spi_txn {
+  const struct spi_device *dev;
+  struct spi_segment *segs;
+  int n;                          // Number of segments
+  unsigned long long dueNS;       // CLOCK_MONOTONIC, 0 to run as soon as possible
+  int result;                     // What the transfer returned
+  bool done;
+  unsigned long seq;              // Order submitted, so equal due times stay in order
+};
+
+struct spi_bus {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;            // Something was queued, or it's time to stop
+  pthread_cond_t finished;        // A transaction is done
+  struct spi_txn *queue[SPI_BUS_QUEUE];
+  int queued;
+  unsigned long seq;
+  atomic_bool running;
+};
+
+int spiBusStart(struct spi_bus *bus);
+void spiBusStop(struct spi_bus *bus);
+int spiBusSubmit(struct spi_bus *bus, struct spi_txn *txn);
+int spiBusWait(struct spi_bus *bus, struct spi_txn *txn);
+int spiBusTransfer(struct spi_bus *bus, const struct spi_device *dev, struct spi_segment *segs, int n, unsigned long long dueNS);
+
+#endif
@@ -28,9 +28,23 @@
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
+#include <sched.h>
 #include "star_common.h"
 #include "geiger.h"
 #include "MS5607.h"
+#include "spibus.h"
+#include "star_data.h"
+#include "flightlog.h"
+#include "packlog.h"
+#include "calcache.h"
+#include "logseg.h"
+#include "writer.h"
+#include "policy.h"
+#include "realtime.h"
+#include "latency.h"
+#include "sim.h"
+#include "telemetry.h"
+#include "liveshm.h"
 
 #ifdef DEBUG
   #define DEBUG_PRINT(...) do { fprintf(stdout, __VA_ARGS__); } while(false)
@@ -45,26 +59,21 @@
 #endif
 
 
-// A structure to hold onto the last <buffer_seconds> seconds of data
-struct data_second {
-   double elapsed;
-   int counts;
-   unsigned long T;
-   double T1;
-   unsigned long P;
-   double P1;
-   double P2;
-   float altitude;
-   double deadTime;
-   int deadCounts;
+// How often the flight log is synced to disk and which altimeter
+// profile is used follow what's going on, see policy.c.  -f changes
+// the records between syncs when quiet and busy.
+static struct policy_config policyCfg = {
+  POLICY_CLIMB_RATE, POLICY_SINK_RATE, POLICY_BUSY_CPS, POLICY_TAU,
+  POLICY_HOLD, POLICY_QUIET_FLUSH, POLICY_BUSY_FLUSH
 };
-
-// Buffer five seconds before writing to file
-static int buffer_seconds = 5;
+static struct policy policy;
 
 // Track interrupt signals
 volatile int sigReceived = 0;
 
+// Set by SIGUSR1 to ask for the latency histograms
+volatile sig_atomic_t dumpRequested = 0;
+
 // Keep the main loop running forever unless CTRL-C
 volatile bool keepRunning;
 
@@ -75,6 +84,66 @@ volatile int geigerAlt = 175;
 // turning the Geiger circuit on and off quickly
 volatile int deadBand = 10;
 
+// What the main loop is doing
+#define STATE_GROUND  0   // HV off, waiting to climb past geigerAlt
+#define STATE_POST    1   // HV on for a power on self test
+#define STATE_FLYING  2   // HV on, above geigerAlt
+
+// How long the power on self test counts for, seconds
+#define POST_SECONDS  30
+
+// How long after each second ends the main loop wakes to read it, ns.
+// Each countThread() drains its edge ring every millisecond, so by then
+// the pulses from the end of the second have all been counted.
+#define TICK_PHASE    5000000ULL
+
+// Expected length of the mission, hours.  Log segments are sized
+// (and their disk space reserved) so a mission this long fits in one.
+static int missionHours = 4;
+
+// Room to reserve in the log file for each hour of the mission
+#define ERR_BYTES_PER_HOUR  (64 * 1024)
+
+// Real-time scheduling with -R, on the CPU given with -c (-1 = the last one)
+static bool realTime = false;
+static int pulseCPU = -1;
+
+// Lock everything into RAM with -M
+static bool lockMemory = false;
+
+// Simulated pulses (-S rate or -P flight) and altimeter (-A or -P)
+static bool simPulses = false;
+static bool simAlt = false;
+static struct sim_config simCfg = { 0.0, 0.000150, NULL, 0 };
+
+// Telemetry to host:port with -T, a frame every telemetryBatch seconds
+// (-B).  The console table can be turned off with -q.
+static const char *telemetryTo = NULL;
+static int telemetryBatch = 5;
+static struct telemetry tlm;
+static bool console = true;
+
+// Publish live data in shared memory this many times a second with -L
+static double liveRate = 0.0;
+
+// Write the compressed log instead of the flight log with -z
+static bool packed = false;
+static struct packlog pakf;
+
+// Start on the calibration and QFF cached by the last full start with -F
+static bool fastStart = false;
+
+// Extra tubes with -N, and how close their pulses must be to count as
+// a coincidence with -W
+static double coincWindowUS = 10.0;
+static int coincNeeded = 2;
+
+// Altimeter profile given with -a, or NULL to follow the flight phase
+static const struct altimeter_profile *altPinned = NULL;
+
+// The SPI bus, shared by the altimeter and anything else on it
+static struct spi_bus spiBus;
+
 
 /*
  * breakHandler: Captures interrupts so we can shut down cleanly.
@@ -90,6 +159,188 @@ void breakHandler(int s) {
   keepRunning = false;
 }
 
+/*
+ * dumpHandler: Asks the main loop to dump the latency histograms.
+ *****************************************************************************
+ */
+
+void dumpHandler(int s) {
+  dumpRequested = 1;
+}
+
+/*
+ * setFlightPhase: Switches the altimeter to the profile for a flight
+ *                 phase (ALT_PROFILE_*), unless one was pinned with -a.
+ *****************************************************************************
+ */
+
+void setFlightPhase(FILE *errf, int phase) {
+  struct altimeter_profile cur;
+
+  if (altPinned != NULL)
+    return;
+
+  // Already there, nothing to do
+  altimeterGetProfile(&cur);
+  if (strcmp(cur.name, altimeterProfiles[phase].name) == 0)
+    return;
+
+  altimeterSetProfile(&altimeterProfiles[phase]);
+  fprintf(errf, "%s altimeterSetProfile(%s)\n", getTimeStamp(), altimeterProfiles[phase].name);
+  DEBUG2_PRINT("%s altimeterSetProfile(%s)\n", getTimeStamp(), altimeterProfiles[phase].name);
+}
+
+/*
+ * reportPROM: Logs how the PROM checked out after a fast start.  If it
+ *             differs from the cache, the altimeter thread is already
+ *             using what it read, and the cache is brought up to date.
+ *             The log header still has the cached calibration, so the
+ *             right one is written to the error log for reprocessing.
+ *****************************************************************************
+ */
+
+void reportPROM(FILE *errf, const int cachedC[8], const char *ts) {
+  struct calcache cal;
+  int c[8];
+
+  switch (altimeterPROMStatus()) {
+  case ALT_PROM_MATCH:
+    fprintf(errf, "%s PROM passed its CRC and matches %s\n", getTimeStamp(), CALCACHE_FILE);
+    break;
+  case ALT_PROM_BAD:
+    fprintf(errf, "%s PROM never passed its CRC, keeping the calibration from %s\n", getTimeStamp(), CALCACHE_FILE);
+    break;
+  case ALT_PROM_CHANGED:
+    getAltimeterCalibration(c);
+    fprintf(errf, "%s PROM differs from %s, the log header is out of date:", getTimeStamp(), CALCACHE_FILE);
+    for (int i = 0; i < 8; i++) {
+      fprintf(errf, " %d = %d (was %d)", i, c[i], cachedC[i]);
+    }
+    fprintf(errf, "\n");
+
+    calcacheFill(&cal, c, getQFF(), ts);
+    if (calcacheSave(CALCACHE_FILE, &cal) < 0)
+      fprintf(errf, "%s Can't save %s: %s\n", getTimeStamp(), CALCACHE_FILE, strerror(errno));
+    break;
+  }
+}
+
+/*
+ * setRealTime: Gives the pulse path a CPU of its own under SCHED_FIFO,
+ *              with the altimeter and main loop just below it on the
+ *              other CPUs, and the LED, writer and shared memory export
+ *              left as ordinary threads there too.  With more than one
+ *              tube, the pulse path gets a CPU per tube (counting down
+ *              from cpu) as long as one is left over for everything
+ *              else, and the coincidence matching runs with the main
+ *              loop.  The SPI bus thread runs just above the altimeter,
+ *              so a transaction goes out as soon as it is due.
+ *****************************************************************************
+ */
+
+void setRealTime(int cpu, int channels) {
+  int n = rtNumCPUs();
+  unsigned long mine, others;
+
+  if ((cpu < 0) || (cpu >= n))
+    cpu = n - 1;
+
+  mine = 1UL << cpu;
+  for (int i = 1; (i < channels) && (i < n - 1); i++) {
+    mine |= 1UL << ((cpu - i + n) % n);
+  }
+  others = ((n >= (int)(8 * sizeof(others))) ? ~0UL : ((1UL << n) - 1)) & ~mine;
+
+  // A single CPU has to be shared
+  if (others == 0)
+    others = mine;
+
+  rtConfigure(RT_CAPTURE,   SCHED_FIFO, 80, mine);
+  rtConfigure(RT_COUNT,     SCHED_FIFO, 70, mine);
+  rtConfigure(RT_SPI,       SCHED_FIFO, 55, others);
+  rtConfigure(RT_ALTIMETER, SCHED_FIFO, 50, others);
+  rtConfigure(RT_COINC,     SCHED_FIFO, 45, others);
+  rtConfigure(RT_MAIN,      SCHED_FIFO, 40, others);
+  rtConfigure(RT_LED,       SCHED_OTHER, 0, others);
+  rtConfigure(RT_WRITER,    SCHED_OTHER, 0, others);
+  rtConfigure(RT_EXPORT,    SCHED_OTHER, 0, others);
+}
+
+/*
+ * logWrite, logFlush: Writer sink for the flight log
+ *****************************************************************************
+ */
+
+static int logWrite(void *ctx, const struct writer_record *rec) {
+  return flightlogWrite(ctx, &rec->data);
+}
+
+static int logFlush(void *ctx) {
+  return flightlogSync(ctx);
+}
+
+/*
+ * packWrite, packFlush: Writer sink for the compressed log
+ *****************************************************************************
+ */
+
+static int packWrite(void *ctx, const struct writer_record *rec) {
+  return packlogWrite(ctx, &rec->data);
+}
+
+static int packFlush(void *ctx) {
+  return packlogSync(ctx);
+}
+
+/*
+ * consoleWrite, consoleFlush: Writer sink for the screen
+ *****************************************************************************
+ */
+
+static int consoleWrite(void *ctx, const struct writer_record *rec) {
+  const struct data_second *d = &rec->data;
+
+  // Every so often, print the header to screen
+  if ((long)d->elapsed % 20 == 0) {
+    printf("------+-----------+------+---------+--------+---------+----------+----------+----------+----------+-----\n");
+    printf("  Buf |   Elapsed |    N |       T |     T1 |       P |       P1 |       P2 |        H | Deadtime |  DTC \n");
+    printf("------+-----------+------+---------+--------+---------+----------+----------+----------+----------+-----\n");
+  }
+
+  // Write some output to the screen
+  printf("  %4d | %9.3lf | %4d | %7ld | %6.2lf | %7ld | %8.3lf | %8.3lf | %8.2f | %1.6lf | %4d\n", rec->secNum, d->elapsed, d->counts, d->T, d->T1, d->P, d->P1, d->P2, d->altitude, d->deadTime, d->deadCounts);
+
+  return 0;
+}
+
+static int consoleFlush(void *ctx) {
+  return (fflush(stdout) == 0) ? 0 : -1;
+}
+
+/*
+ * telemetryWriteSink: Writer sink for the telemetry stream.  Each second
+ *                     goes with its counts in every 100 ms, unless the
+ *                     writer is so far behind they've aged out of the
+ *                     history.  Frames go
+ *                     out when they're full, not when the writer
+ *                     flushes, so there's no flush.
+ *****************************************************************************
+ */
+
+static int telemetryWriteSink(void *ctx, const struct writer_record *rec) {
+  uint16_t tenths[TELEMETRY_TENTHS];
+  long sec = (long)rec->data.elapsed - 1;   // The second the counts are from
+  int n;
+
+  for (int i = 0; i < TELEMETRY_TENTHS; i++) {
+    if ((n = (sec >= 0) ? getCountsAt(HISTORY_TENTHS, sec * TELEMETRY_TENTHS + i) : 0) < 0)
+      return telemetryWrite(ctx, &rec->data, NULL);
+    tenths[i] = n;
+  }
+
+  return telemetryWrite(ctx, &rec->data, tenths);
+}
+
 /*
  *****************************************************************************
  * main
@@ -100,32 +351,104 @@ int main (int argc, char *argv[]) {
 
   int result = 0;                   // Result of file operations
   bool doPost = true;               // Do a POST when first started
-  unsigned long long start_time;    // Time the main loop started
+  int state = STATE_GROUND;         // STATE_*
+  long postStart = 0;               // First second of the POST
+  unsigned long long start_time;    // Time the main loop started (CLOCK_MONOTONIC ns)
   double elapsed;                   // Elapsed time since the main loop started
-  unsigned long curSec;             // The current second we are addressing in the counts buffer
-  int bufSec;                       // The current second we are addressing in the write buffer
-  int counts;                       // Number of counts in the last second
-  int deadCounts;                   // Number of dead time counts in the last second
-  double deadTime;                  // Amount of dead time in the last second
+  long curSec;                      // The current second we are addressing in the counts buffer
+  struct geiger_stats stats;        // Counts, dead time and HV state of the last second
+  struct altimeter_sample alt;      // Latest altimeter sample
+  struct altimeter_profile altProfile; // Altimeter profile in use
+  int phase;                        // Flight phase from the policy, ALT_PROFILE_*
   int c[8];                         // Altimeter calibration coefficients
+  struct calcache cal;              // Calibration and QFF kept for a fast start
+  bool cached = false;              // Are we starting on them?
+  bool promCheck;                   // Still waiting to hear how the PROM checked out
   int opt;                          // Command line options
+  int pins[GEIGER_MAX_CHANNELS];    // Pins given with -N
+  int n;
   char ts[40];                      // Timestamp
 
   // Parse simple command line options
-  while ((opt = getopt(argc, argv, "blt")) != -1) {
+  while ((opt = getopt(argc, argv, "bltga:m:Rc:MS:P:Ad:T:B:qL:zFN:W:f:")) != -1) {
     switch (opt) {
     case 'b': geigerAlt = 0; deadBand = 0; break;       // Bypass the altitude limitations
     case 'l': geigerAlt = 175; deadBand = 10; break;    // Launch day parameters
     case 't': geigerAlt = 50; deadBand = 3; break;      // Tethered launch parameters
+    case 'g': geigerSetCapture(GEIGER_CAPTURE_GPIOCDEV, NULL); break;  // Kernel-stamped GPIO line events
+    case 'a':                                           // Pin the altimeter profile
+      if ((altPinned = altimeterFindProfile(optarg)) == NULL) {
+        fprintf(stderr, "Unknown altimeter profile %s, try ground, ascent, float or descent\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'm':                                           // Expected mission length, hours
+      if ((missionHours = atoi(optarg)) < 1) {
+        fprintf(stderr, "Mission length must be at least 1 hour\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'R': realTime = true; break;                   // SCHED_FIFO for the pulse path
+    case 'c': pulseCPU = atoi(optarg); break;           // CPU for the pulse path
+    case 'M': lockMemory = true; break;                 // mlockall()
+    case 'S': simPulses = true; simCfg.rate = atof(optarg); break;  // Simulated pulses, counts/s
+    case 'P': simPulses = simAlt = true; simCfg.replay = optarg; break;  // Replay a recorded flight
+    case 'A': simAlt = true; break;                     // Simulated altimeter
+    case 'T': telemetryTo = optarg; break;              // Telemetry to host:port
+    case 'B': telemetryBatch = atoi(optarg); break;     // Seconds per telemetry frame
+    case 'q': console = false; break;                   // No table on the screen
+    case 'L': liveRate = atof(optarg); break;           // Shared memory updates per second
+    case 'z': packed = true; break;                     // Compressed log
+    case 'F': fastStart = true; break;                  // Fast start from the cache
+    case 'N':                                           // Pins of every tube
+      n = sscanf(optarg, "%d,%d,%d", &pins[0], &pins[1], &pins[2]);
+      if (geigerSetChannels(n, pins) < 0) {
+        fprintf(stderr, "Give the pins of 1 to %d tubes as pin,pin,...\n", GEIGER_MAX_CHANNELS);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'W':                                           // Coincidence window, us, and tubes needed
+      if ((sscanf(optarg, "%lf,%d", &coincWindowUS, &coincNeeded) != 2) || (coincWindowUS <= 0) || (coincNeeded < 2)) {
+        fprintf(stderr, "Give the coincidence window and tubes needed as us,tubes, at least 2 tubes\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'f':                                           // Records between syncs, quiet and busy
+      if ((sscanf(optarg, "%d,%d", &policyCfg.quietFlush, &policyCfg.busyFlush) != 2) || (policyCfg.quietFlush < 1) || (policyCfg.busyFlush < 1)) {
+        fprintf(stderr, "Give the records between syncs as quiet,busy, each at least 1\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'd':                                           // Dead time model
+      if (optarg[0] == 'p')
+        setDeadTimeModel(DEADTIME_PARALYZABLE);
+      else if (optarg[0] == 'n')
+        setDeadTimeModel(DEADTIME_NONPARALYZABLE);
+      else {
+        fprintf(stderr, "Unknown dead time model %s, try paralyzable or nonparalyzable\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
     default:
-      fprintf(stderr, "Usage: %s [-blt]\n", argv[0]);
+      fprintf(stderr, "Usage: %s [-bltgRMAqzF] [-a profile] [-m hours] [-c cpu] [-S rate] [-P counts.txt] [-d model] [-T host:port] [-B seconds] [-L rate] [-N pin,pin,...] [-W us,tubes] [-f quiet,busy]\n", argv[0]);
       exit(EXIT_FAILURE);
     }
   }
 
-  // Buffer a certain number of seconds of data
-  // so we're not saving to disk every second
-  struct data_second data[buffer_seconds];
+  // Now that every tube is known, check how many a coincidence needs
+  if ((geigerNumChannels() > 1) && (geigerSetCoincidence(coincWindowUS / 1e6, coincNeeded) < 0)) {
+    fprintf(stderr, "A coincidence can't need %d of %d tubes\n", coincNeeded, geigerNumChannels());
+    exit(EXIT_FAILURE);
+  }
+
+  // The second being put together, and how it's handed to the writer
+  struct data_second data;
+  struct writer_record rec;
+  struct writer_stats wstats;
+  struct width_stats wstat;         // Pulse widths so far
+  struct schedule tick;             // Deadlines for the main loop
+  long missed;                      // Deadlines the main loop missed
+  unsigned long countWaits = 0;     // Seconds read before the count threads caught up
 
   // Set up a signal handler to terminate cleanly
   struct sigaction act;
@@ -137,6 +460,9 @@ int main (int argc, char *argv[]) {
   sigaction(SIGABRT, &act, NULL);  // kill -6
   sigaction(SIGTERM, &act, NULL);  // kill -15
 
+  act.sa_handler = dumpHandler;
+  sigaction(SIGUSR1, &act, NULL);  // kill -USR1 dumps the latency histograms
+
   // Initialize random number generator
   srand(time(NULL));
   int r = rand();
@@ -144,35 +470,27 @@ int main (int argc, char *argv[]) {
   // Get the time stamp and trim it
   sprintf(ts, "%s", getDateTimeStamp());
 
-  // Define the output file
-  FILE *csvf;
+  // Define the output file, which is opened once the
+  // altimeter calibration is known
+  struct flightlog csvf;
+  struct flightlog_header csvhdr;
+  struct packlog_header pakhdr;
+  int opened;
   char csvfname[100];
-  sprintf(csvfname, "counts_%s_%d.txt", ts, r);
-
-  // Attempt to open our output file, write+append
-  csvf = fopen(csvfname, "aw");
-
-  // If we failed to open the file, complain and exit
-  if (csvf == NULL) {
-    DEBUG_PRINT("Can't open data file!\n");
-    fprintf(stderr, "Can't open data file!\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // Do not buffer, write directly to disk!
-  setbuf(csvf, NULL);
-
-  // Write header to file
-  fprintf(csvf, "%s\n", getTimeStamp());
-  fprintf(csvf, "Elapsed, Counts, T (Raw), T1 (C), P (Raw), P1 (mbar), P2 (mbar), Altitude (m), Dead Time (s), Dead Time Counts\n");
+  sprintf(csvfname, "counts_%s_%d", ts, r);
 
   // Define the log file
   FILE *errf;
+  FILE *msgf;                       // Log lines handed to the writer thread
+  struct logseg errseg;
   char errfname[100];
-  sprintf(errfname, "error_%s_%d.txt", ts, r);
+  sprintf(errfname, "error_%s_%d", ts, r);
 
-  // Attempt to open our log file, write+append
-  errf = fopen(errfname, "aw");
+  // Attempt to open our log file, with room for the whole mission
+  if (logsegOpen(&errseg, errfname, ".txt", (long long)missionHours * ERR_BYTES_PER_HOUR, NULL, 0) < 0)
+    errf = NULL;
+  else if ((errf = logsegFile(&errseg)) == NULL)
+    logsegClose(&errseg);
 
   // If we failed to open the file, complain and exit
   if (errf == NULL) {
@@ -181,17 +499,59 @@ int main (int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  // Do not buffer, write directly to disk!
-  setbuf(errf, NULL);
+  // Set up the simulator, if anything is to come from it
+  if (simPulses || simAlt) {
+    if (simConfigure(&simCfg) < 0) {
+      fprintf(stderr, "Can't replay %s!\n", simCfg.replay);
+      exit(EXIT_FAILURE);
+    }
+    if (simPulses)
+      geigerSetCapture(GEIGER_CAPTURE_SIM, NULL);
+    if (simAlt)
+      altimeterSetSource(ALT_SOURCE_SIM);
+  }
 
   // Run forever unless halted
   keepRunning = true;
 
+  // Threads pick these up as they start, so set them up first
+  if (realTime)
+    setRealTime(pulseCPU, geigerNumChannels());
+  rtApply(RT_MAIN);
+  if (lockMemory)
+    rtLockMemory();
+
   DEBUG2_PRINT("%s ****************************************\n", getTimeStamp());
   fprintf(errf, "%s ****************************************\n", getTimeStamp());
 
+  // A fast start takes the calibration and QFF from the last full
+  // start, and leaves reading the PROM to the altimeter thread
+  cached = fastStart && (calcacheLoad(CALCACHE_FILE, &cal) == 0) && altimeterPROMValid(cal.C);
+  promCheck = cached;
+  if (fastStart && !cached)
+    fprintf(errf, "%s No usable %s, doing a full start\n", getTimeStamp(), CALCACHE_FILE);
+
+  // Everything on the SPI bus goes through one thread
+  if (spiBusStart(&spiBus) < 0) {
+    fprintf(errf, "Unable to start the SPI bus!\n");
+    exit(EXIT_FAILURE);
+  }
+  altimeterSetBus(&spiBus);
+  DEBUG2_PRINT("%s spiBusStart()\n", getTimeStamp());
+  fprintf(errf, "%s spiBusStart()\n", getTimeStamp());
+
   // Setup the altimeter
-  if (altimeterSetup() < 0) {
+  if (cached) {
+    if (altimeterInit() < 0) {
+      fprintf(errf, "Unable to set up altimeter!\n");
+      exit(EXIT_FAILURE);
+    }
+    setAltimeterCalibration(cal.C);
+    setQFFValue(cal.qff);
+    DEBUG2_PRINT("%s altimeterInit(), fast start\n", getTimeStamp());
+    fprintf(errf, "%s altimeterInit(), fast start from %s saved %s\n", getTimeStamp(), CALCACHE_FILE, cal.saved);
+  }
+  else if (altimeterSetup() < 0) {
     fprintf(errf, "Unable to set up altimeter!\n");
     exit(EXIT_FAILURE);
   }
@@ -210,51 +570,136 @@ int main (int argc, char *argv[]) {
   }
   fprintf(errf, "\n");
 
-  // Calculate the QFF value (for low altitudes)
-  setQFF(43.06, 100, 1);
-  fprintf(errf, "%s setQFF(43.06, 100, 1): %f\n", getTimeStamp(), getQFF());
-  DEBUG2_PRINT("%s setQFF(43.06, 100, 1): %f\n", getTimeStamp(), getQFF());
+  // Calculate the QFF value (for low altitudes), and keep it and the
+  // calibration for the next fast start
+  if (cached) {
+    fprintf(errf, "%s cached QFF: %f\n", getTimeStamp(), getQFF());
+  }
+  else {
+    setQFF(43.06, 100, 1);
+    fprintf(errf, "%s setQFF(43.06, 100, 1): %f\n", getTimeStamp(), getQFF());
+    DEBUG2_PRINT("%s setQFF(43.06, 100, 1): %f\n", getTimeStamp(), getQFF());
+
+    calcacheFill(&cal, c, getQFF(), ts);
+    if (calcacheSave(CALCACHE_FILE, &cal) < 0)
+      fprintf(errf, "%s Can't save %s: %s\n", getTimeStamp(), CALCACHE_FILE, strerror(errno));
+  }
+
+  // Attempt to open our output file, with everything needed to
+  // make sense of it later in the header
+  if (packed) {
+    packlogHeader(&pakhdr, c, getQFF(), ts, PACKLOG_BLOCK);
+    opened = packlogOpen(&pakf, csvfname, &pakhdr, missionHours * 3600L);
+  }
+  else {
+    flightlogHeader(&csvhdr, c, getQFF(), ts);
+    opened = flightlogOpen(&csvf, csvfname, &csvhdr, missionHours * 3600L);
+  }
+  if (opened < 0) {
+    DEBUG_PRINT("Can't open data file!\n");
+    fprintf(stderr, "Can't open data file!\n");
+    fprintf(errf, "%s Can't open data file %s: %s\n", getTimeStamp(), csvfname, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  fprintf(errf, "%s %s(%s)\n", getTimeStamp(), packed ? "packlogOpen" : "flightlogOpen", csvfname);
+
+  // Everything from here on is written by its own thread
+  if (packed)
+    writerAddSink("compressed log", packWrite, packFlush, &pakf);
+  else
+    writerAddSink("flight log", logWrite, logFlush, &csvf);
+  if (console)
+    writerAddSink("console", consoleWrite, consoleFlush, NULL);
+  if (telemetryTo != NULL) {
+    if (telemetryOpen(&tlm, telemetryTo, telemetryBatch) < 0) {
+      fprintf(stderr, "Can't send telemetry to %s!\n", telemetryTo);
+      fprintf(errf, "%s Can't send telemetry to %s: %s\n", getTimeStamp(), telemetryTo, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    writerAddSink("telemetry", telemetryWriteSink, NULL, &tlm);
+    fprintf(errf, "%s telemetryOpen(%s), %d seconds per frame\n", getTimeStamp(), telemetryTo, tlm.batch);
+  }
+  // We start out on the ground
+  policyInit(&policy, &policyCfg);
+  if (writerStart(policyFlushEvery(&policy)) < 0) {
+    fprintf(errf, "%s Unable to start the writer!\n", getTimeStamp());
+    exit(EXIT_FAILURE);
+  }
+  fprintf(errf, "%s writerStart(), flushing every %d records when quiet, %d when busy\n", getTimeStamp(), policyCfg.quietFlush, policyCfg.busyFlush);
+
+  // From the main loop on, log lines are written by the writer too
+  if ((msgf = writerOpenLog(errf)) == NULL) {
+    fprintf(errf, "%s Unable to queue log lines, writing them directly: %s\n", getTimeStamp(), strerror(errno));
+    msgf = errf;
+  }
+
+  // Sample the altimeter in the background from now on
+  memset(&alt, 0, sizeof(alt));
+  altimeterStart(altPinned != NULL ? altPinned : &altimeterProfiles[ALT_PROFILE_GROUND]);
+  altimeterGetProfile(&altProfile);
+  fprintf(errf, "%s altimeterStart(%s), P OSR %d, T OSR %d, %.2f samples/s, T every %d\n", getTimeStamp(), altProfile.name, altProfile.osrP, altProfile.osrT, altProfile.rate, altProfile.tEvery);
+  DEBUG2_PRINT("%s altimeterStart(%s)\n", getTimeStamp(), altProfile.name);
 
   fprintf(errf, "%s HV altitude = %d, dead band = %d\n", getTimeStamp(), geigerAlt, deadBand);
   fprintf(stdout, "%s HV altitude = %d, dead band = %d\n", getTimeStamp(), geigerAlt, deadBand);
   DEBUG2_PRINT("%s HV altitude = %d, dead band = %d\n", getTimeStamp(), geigerAlt, deadBand);
 
-  // Sleep so we don't power everything on at once
-  sleep(2);
+  // Sleep so we don't power everything on at once, unless we're
+  // trying to get counting again as soon as we can
+  if (!cached)
+    sleep(2);
 
   // Setup the Geiger circuit
-  geigerSetup();
-  DEBUG2_PRINT("%s geigerSetup()\n", getTimeStamp());
-  fprintf(errf, "%s geigerSetup()\n", getTimeStamp());
+  if (geigerSetup() < 0) {
+    fprintf(errf, "%s Unable to set up %s, falling back to wiringPiISR\n", getTimeStamp(), getCaptureName());
+    geigerSetCapture(GEIGER_CAPTURE_WIRINGPI, NULL);
+    geigerSetup();
+  }
+  DEBUG2_PRINT("%s geigerSetup(), capture = %s\n", getTimeStamp(), getCaptureName());
+  if (simPulses || simAlt) {
+    fprintf(errf, "%s simulating%s%s, rate = %.1f counts/s, width = %.0f us, replay = %s\n", getTimeStamp(), simPulses ? " pulses" : "", simAlt ? " altimeter" : "", simCfg.rate, simCfg.width * 1e6, (simCfg.replay != NULL) ? simCfg.replay : "none");
+  }
+  fprintf(errf, "%s geigerSetup(), capture = %s\n", getTimeStamp(), getCaptureName());
+
+  // Match pulses across tubes, if there's more than one
+  if (geigerNumChannels() > 1) {
+    fprintf(errf, "%s geigerSetCoincidence(), %d tubes, %d within %.1f us\n", getTimeStamp(), geigerNumChannels(), coincNeeded, coincWindowUS);
+  }
 
   // Start the Geiger circuit
   geigerStart();
   fprintf(errf, "%s geigerStart()\n", getTimeStamp());
   DEBUG2_PRINT("%s geigerStart()\n", getTimeStamp());
 
+  // Let local readers see what's going on
+  if (liveRate > 0) {
+    if ((liveshmOpen(LIVESHM_NAME) < 0) || (liveshmStart(liveRate) < 0)) {
+      fprintf(errf, "%s Unable to export live data to %s: %s\n", getTimeStamp(), LIVESHM_NAME, strerror(errno));
+      liveshmClose();
+    }
+    else {
+      fprintf(errf, "%s liveshmStart(%s), %.1f updates/s\n", getTimeStamp(), LIVESHM_NAME, liveRate);
+    }
+  }
+
+  rtReport(errf);
+
   fprintf(errf, "%s entering main()\n", getTimeStamp());
   DEBUG2_PRINT("%s entering main()\n", getTimeStamp());
 
-  waitNextSec();                // Sleep until next second
-  start_time = getTimeMS();     // Save the start time
-  curSec = 0;                   // Start at zero seconds
+  if (!cached)
+    waitNextSec();              // Sleep until next second
   geigerReset();                // Reset the Geiger circuit
+  start_time = getEpochNS();    // Save the start time
+  scheduleInit(&tick, start_time + TICK_PHASE, 1000000000ULL);
+  if (simPulses || simAlt)
+    simStart(start_time, 0);    // Simulate from second zero
 
   // Loop forever or until CTRL-C
   while (keepRunning) {
-    // Elapsed time since start
-    elapsed = (getTimeMS() - start_time) / 1000.0;
-    DEBUG_PRINT("getTimeMS() %lld, start_time %lld, elapsed %f\n", getTimeMS(), start_time, elapsed);
-
-    // Get the counts from the last second
-    counts = getCounts(curSec);
-
-    // Get the dead time from the last second
-    deadTime = getDeadTime(curSec);
-
-    // Get the dead time counts from the last second
-    deadCounts = getDeadCounts(curSec);
-    DEBUG_PRINT("counts = %d, deadTime = %f, deadCounts = %d\n", counts, deadTime, deadCounts);
+    // Elapsed time since start, on the same clock the pulses are stamped with
+    elapsed = (getTimeNS() - start_time) / 1000000000.0;
+    DEBUG_PRINT("getTimeNS() %lld, start_time %lld, elapsed %f\n", getTimeNS(), start_time, elapsed);
 
     // Whole number of current second
     curSec = elapsed;
@@ -262,138 +707,231 @@ int main (int argc, char *argv[]) {
 
     DEBUG_PRINT("main()\n");
 
-    // Advance the count timer
-    setSecNum(curSec);
-    DEBUG2_PRINT("setSecNum(%ld)\n", curSec);
+    // Each pulse was binned by its own timestamp, so the last second
+    // is complete no matter how late we got here, once the count
+    // threads have caught up with the edges from the end of it
+    if (!geigerWaitCounted(start_time + curSec * 1000000000ULL))
+      countWaits++;
 
-    // Wrap around the circular write buffer
-    bufSec = (int)(curSec % buffer_seconds);
-    DEBUG2_PRINT("bufSec = %d\n", bufSec);
+    // Get the counts, dead time and HV state from the last second,
+    // all from the same moment
+    getStats(curSec - 1, &stats);
+    DEBUG_PRINT("counts = %d, deadTime = %f, deadCounts = %d\n", stats.counts, stats.deadTime, stats.deadCounts);
 
     // Put data into our struct
-    data[bufSec].elapsed = elapsed;
+    data.elapsed = elapsed;
+    data.flags = 0;
 
     // If HV is on, record counts
-    if (getHVOn() == true) {
-      data[bufSec].counts = counts;
-      data[bufSec].deadTime = deadTime;
-      data[bufSec].deadCounts = deadCounts;
+    if (stats.hvOn == true) {
+      data.flags |= DATA_HV_ON;
+      data.counts = stats.counts;
+      data.deadTime = stats.deadTime;
+      data.deadCounts = stats.deadCounts;
+
+      // HV came on during the second, so it wasn't counting for all of it
+      if (!stats.hvSteady)
+        data.flags |= DATA_HV_PARTIAL;
     }
     // If HV is not on, record an impossible result
     else {
-      data[bufSec].counts = -1;
-      data[bufSec].deadTime = 0.0;
-      data[bufSec].deadCounts = -1;
+      data.counts = -1;
+      data.deadTime = 0.0;
+      data.deadCounts = -1;
     }
 
-    // Read the raw T and P values from the altimeter
-    data[bufSec].T = readTUncompensated();
-    data[bufSec].P = readPUncompensated();
+    // Get the latest T and P values from the altimeter thread.
+    // If there isn't a new one, keep the last one.
+    if (!altimeterGetSample(&alt))
+      data.flags |= DATA_NO_ALT;
+    data.T = alt.T;
+    data.P = alt.P;
+    data.T1 = alt.T1;
+    data.P1 = alt.P1;
+    data.P2 = alt.P2;
+    data.altitude = alt.altitude;
+
+    // After a fast start, see how the PROM checked out once it's read
+    if (promCheck && (altimeterPROMStatus() > ALT_PROM_PENDING)) {
+      promCheck = false;
+      reportPROM(msgf, c, ts);
+    }
 
-    // Do some calculations with T and P
-    data[bufSec].T1 = calcFirstOrderT(data[bufSec].T);
-    data[bufSec].P1 = calcFirstOrderP(data[bufSec].T, data[bufSec].P);
-    data[bufSec].P2 = calcSecondOrderP(data[bufSec].T, data[bufSec].P);
-    data[bufSec].altitude = calcAltitude(data[bufSec].P2, data[bufSec].T1);
+    switch (state) {
+    case STATE_GROUND:
+      // After a fast start the first sample may not be in yet, and a
+      // zero altitude would look like we're on the ground
+      if (alt.seq == 0)
+        break;
 
-    // If HV is not on
-    if (getHVOn() == false) {
       // If we're above our threshold altitude, turn HV on
-      if (data[bufSec].altitude > geigerAlt) {
+      if (data.altitude > geigerAlt) {
         HVOn();                    // Turn the Geiger tube on
-        fprintf(errf, "%s HVOn(), altitude = %f\n", getTimeStamp(), data[bufSec].altitude);
-        DEBUG2_PRINT("%s HVOn(), altitude = %f\n", getTimeStamp(), data[bufSec].altitude);
+        fprintf(msgf, "%s HVOn(), altitude = %f\n", getTimeStamp(), data.altitude);
+        DEBUG2_PRINT("%s HVOn(), altitude = %f\n", getTimeStamp(), data.altitude);
 
         doPost = false;
+        state = STATE_FLYING;
       }
-      // If we're below our threshold altitude and we haven't done a POST, do a POST
-      else if ((doPost) && (data[bufSec].altitude < (geigerAlt - deadBand))) {
-        fprintf(stdout, "%s entering POST(), altitude = %f\n", getTimeStamp(), data[bufSec].altitude);
-        fprintf(errf, "%s entering POST(), altitude = %f\n", getTimeStamp(), data[bufSec].altitude);
-        DEBUG2_PRINT("%s entering POST(), altitude = %f\n", getTimeStamp(), data[bufSec].altitude);
-
-        // Start the POST thread
-        //pthread_create(&post_id, &attr, post, NULL);
+      // If we're below our threshold altitude and we haven't done a POST, do a POST.
+      // It counts like any other second, it's just flagged.
+      else if ((doPost) && (data.altitude < (geigerAlt - deadBand))) {
+        fprintf(stdout, "%s entering POST(), altitude = %f\n", getTimeStamp(), data.altitude);
+        fprintf(msgf, "%s entering POST(), altitude = %f\n", getTimeStamp(), data.altitude);
+        DEBUG2_PRINT("%s entering POST(), altitude = %f\n", getTimeStamp(), data.altitude);
+
         HVOn();
-        for (int i = 0; i < 30; i++) {
-          if (keepRunning) {
-            waitNextSec();
-          }
-        }
-        HVOff();
-        start_time = getTimeMS();     // Save the start time
-        curSec = 0;                   // Start at zero seconds
-        geigerReset();                // Reset the Geiger circuit
+        postStart = curSec;
         doPost = false;
-        fprintf(stdout, "%s exiting POST()\n", getTimeStamp());
-        fprintf(errf, "%s exiting POST()\n", getTimeStamp());
+        state = STATE_POST;
+      }
+      break;
+
+    case STATE_POST:
+      data.flags |= DATA_POST;
+
+      // Launched during the POST, just keep HV on
+      if (data.altitude > geigerAlt) {
+        fprintf(msgf, "%s POST() cut short, altitude = %f\n", getTimeStamp(), data.altitude);
+        DEBUG2_PRINT("%s POST() cut short, altitude = %f\n", getTimeStamp(), data.altitude);
+        state = STATE_FLYING;
+      }
+      else if (curSec - postStart >= POST_SECONDS) {
+        HVOff();
+
+        // The tube should see background radiation, if not it's broken
+        getStatsRange(postStart + 1, curSec - 1, &stats);
+        fprintf(stdout, "%s exiting POST(), %d counts in %ld s%s\n", getTimeStamp(), stats.counts, stats.last - stats.first + 1, (stats.counts > 0) ? "" : ", check the tube!");
+        fprintf(msgf, "%s exiting POST(), %d counts in %ld s, %d with dead time, %f s dead%s\n", getTimeStamp(), stats.counts, stats.last - stats.first + 1, stats.deadCounts, stats.deadTime, (stats.counts > 0) ? "" : ", check the tube!");
         DEBUG2_PRINT("%s exiting POST()\n", getTimeStamp());
+        state = STATE_GROUND;
       }
+      break;
+
+    case STATE_FLYING:
+      // If we're below our threshold altitude, turn HV off
+      if (data.altitude < (geigerAlt - deadBand)) {
+        HVOff();                   // Turn the Geiger tube off
+        fprintf(msgf, "%s HVOff()\n", getTimeStamp());
+        DEBUG2_PRINT("%s HVOff()\n", getTimeStamp());
+        state = STATE_GROUND;
+      }
+      break;
     }
 
-    // If HV is on and we're below our threshold altitude, turn HV off
-    else if ((getHVOn() == true) && (data[bufSec].altitude < (geigerAlt - deadBand))) {
-      HVOff();                   // Turn the Geiger tube off
-      fprintf(errf, "%s HVOff()\n", getTimeStamp());
-      DEBUG2_PRINT("%s HVOff()\n", getTimeStamp());
+    // Sample the altimeter and sync the log as often as what's going
+    // on calls for: fast going up, fast coming down, slow otherwise
+    phase = policyUpdate(&policy, state == STATE_FLYING, alt.seq, alt.ns, data.altitude, data.counts);
+    setFlightPhase(msgf, phase);
+    if (policyFlushEvery(&policy) != writerGetFlushEvery()) {
+      writerSetFlushEvery(policyFlushEvery(&policy));
+      fprintf(msgf, "%s writerSetFlushEvery(%d), vertical speed = %.1f m/s, count rate = %.1f counts/s\n", getTimeStamp(), policyFlushEvery(&policy), policySpeed(&policy), policyCPS(&policy));
+      DEBUG2_PRINT("%s writerSetFlushEvery(%d)\n", getTimeStamp(), policyFlushEvery(&policy));
     }
 
-    // Every so often, write to file
-    if (bufSec == (buffer_seconds - 1)) {
-      for (int i = 0; i < buffer_seconds; i++) {
-        fprintf(csvf, "%lf, %d, %ld, %lf, %ld, %lf, %lf, %f, %lf, %d\n", data[i].elapsed, data[i].counts, data[i].T, data[i].T1, data[i].P, data[i].P1, data[i].P2, data[i].altitude, data[i].deadTime, data[i].deadCounts);
-      }
-    }
+    // Hand the second over to be written to file and screen
+    rec.data = data;
+    rec.secNum = getSecNum();
+    writerPush(&rec);
 
     // Every so often, let the log file know we're alive
     if ((curSec % 60 == 0) && (curSec != 0)) {
-      fprintf(errf, "%s main() 60 seconds, altitude = %f\n", getTimeStamp(), data[bufSec].altitude);
-      DEBUG2_PRINT("%s main() 60 seconds, altitude = %f\n", getTimeStamp(), data[bufSec].altitude);
+      writerGetStats(&wstats);
+      fprintf(msgf, "%s main() 60 seconds, altitude = %f, vertical speed = %.1f m/s, dropped edges = %u, writer queue = %d (max %d), dropped = %lu, sink errors = %lu, overruns = %lu (worst %.3f ms), read before counted = %lu\n", getTimeStamp(), data.altitude, policySpeed(&policy), getDroppedEdges(), wstats.depth, wstats.maxDepth, wstats.dropped, wstats.errors, tick.overruns, tick.worstLate / 1000000.0, countWaits);
+      DEBUG2_PRINT("%s main() 60 seconds, altitude = %f, dropped edges = %u, writer dropped = %lu\n", getTimeStamp(), data.altitude, getDroppedEdges(), wstats.dropped);
+      getPulseWidths(&wstat);
+      fprintf(msgf, "%s main() 60 seconds, dose = %.3f uSv/h, corrected (%s) = %.3f uSv/h, pulse width mean %.1f us, sd %.1f us, p99 %.0f us, max %.1f us, n = %lu\n", getTimeStamp(), cpmTouSv(60), deadTimeModelName(getDeadTimeModel()), cpmTouSvCorrected(60), wstat.mean * 1e6, widthStatsStdDev(&wstat) * 1e6, widthStatsPercentile(&wstat, 0.99) * 1e6, wstat.max * 1e6, wstat.n);
+      if (geigerNumChannels() > 1) {
+        fprintf(msgf, "%s main() 60 seconds, counts by tube =", getTimeStamp());
+        for (int i = 0; i < geigerNumChannels(); i++) {
+          channelStatsRange(i, curSec - 60, curSec - 1, &stats);
+          fprintf(msgf, " %d (%u dropped)", stats.counts, channelDroppedEdges(i));
+        }
+        fprintf(msgf, ", coincidences = %d, too late to match = %lu, dropped before matching = %lu\n", getCoincidences(curSec - 60, curSec - 1), getCoincLate(), getCoincDropped());
+      }
+      latSummary(msgf);
     }
 
-    // Every so often, print the header to screen
-    if (curSec % 20 == 0) {
-      printf("-----+-----------+------+---------+--------+---------+----------+----------+----------+----------+-----\n");
-      printf(" Buf |   Elapsed |    N |       T |     T1 |       P |       P1 |       P2 |        H | Deadtime |  DTC \n");
-      printf("-----+-----------+------+---------+--------+---------+----------+----------+----------+----------+-----\n");
+    // Someone asked for the full histograms
+    if (dumpRequested) {
+      dumpRequested = 0;
+      fprintf(msgf, "%s SIGUSR1 received, dumping latency histograms\n", getTimeStamp());
+      latDump(msgf);
     }
 
-    // Write some output to the screen
-    printf("  %2d | %9.3lf | %4d | %7ld | %6.2lf | %7ld | %8.3lf | %8.3lf | %8.2f | %1.6lf | %4d\n", getSecNum(), data[bufSec].elapsed, data[bufSec].counts, data[bufSec].T, data[bufSec].T1, data[bufSec].P, data[bufSec].P1, data[bufSec].P2, data[bufSec].altitude, deadTime, deadCounts);
-
-    waitNextSec();              // Sleep until next second
+    // Sleep until the next second.  If we're late, say so.
+    if ((missed = scheduleWait(&tick)) > 0) {
+      fprintf(msgf, "%s main() overrun, %ld seconds skipped\n", getTimeStamp(), missed);
+      DEBUG2_PRINT("%s main() overrun, %ld seconds skipped\n", getTimeStamp(), missed);
+    }
+    latRecord(LAT_TICK, getTimeNS() - (tick.next - tick.period));
   }
 
   // We received a signal to terminate
   if (sigReceived > 0) {
-    DEBUG2_PRINT(errf, "%s Signal %d received, exiting gracefully.\n", getTimeStamp(), sigReceived);
+    DEBUG2_PRINT(msgf, "%s Signal %d received, exiting gracefully.\n", getTimeStamp(), sigReceived);
     switch (sigReceived) {
-      case  2: fprintf(errf, "%s SIGINT received, exiting gracefully.\n", getTimeStamp()); break;
-      case  3: fprintf(errf, "%s SIGQUIT received, exiting gracefully.\n", getTimeStamp()); break;
-      case  6: fprintf(errf, "%s SIGABRT received, exiting gracefully.\n", getTimeStamp()); break;
-      case 15: fprintf(errf, "%s SIGTERM received, exiting gracefully.\n", getTimeStamp()); break;
+      case  2: fprintf(msgf, "%s SIGINT received, exiting gracefully.\n", getTimeStamp()); break;
+      case  3: fprintf(msgf, "%s SIGQUIT received, exiting gracefully.\n", getTimeStamp()); break;
+      case  6: fprintf(msgf, "%s SIGABRT received, exiting gracefully.\n", getTimeStamp()); break;
+      case 15: fprintf(msgf, "%s SIGTERM received, exiting gracefully.\n", getTimeStamp()); break;
       default:
-        fprintf(errf, "%s unknown signal received, exiting with some confusion.\n", getTimeStamp()); break;
+        fprintf(msgf, "%s unknown signal received, exiting with some confusion.\n", getTimeStamp()); break;
     }
   }
 
   // Turn the Geiger tube off
   if (getHVOn() == true) {
     HVOff();
-    fprintf(errf, "%s HVOff()\n", getTimeStamp());
+    fprintf(msgf, "%s HVOff()\n", getTimeStamp());
     DEBUG2_PRINT("%s HVOff()\n", getTimeStamp());
   }
 
-  fprintf(errf, "%s exiting main()\n", getTimeStamp());
+  rtReport(msgf);
+  fprintf(msgf, "%s exiting main()\n", getTimeStamp());
   DEBUG2_PRINT("%s exiting main()\n", getTimeStamp());
 
+  // Stop sampling the altimeter
+  altimeterStop();
+  fprintf(msgf, "%s altimeterStop()\n", getTimeStamp());
+  DEBUG2_PRINT("%s altimeterStop()\n", getTimeStamp());
+
+  // Nothing is left on the SPI bus
+  spiBusStop(&spiBus);
+  altimeterSetBus(NULL);
+  fprintf(msgf, "%s spiBusStop()\n", getTimeStamp());
+  DEBUG2_PRINT("%s spiBusStop()\n", getTimeStamp());
+
+  // Stop exporting live data, which reads from the Geiger circuit
+  if (liveRate > 0) {
+    liveshmStop();
+    liveshmClose();
+    fprintf(msgf, "%s liveshmClose()\n", getTimeStamp());
+  }
+
   // Stop the Geiger circuit
   geigerStop();
-  fprintf(errf, "%s geigerStop()\n", getTimeStamp());
+  fprintf(msgf, "%s geigerStop()\n", getTimeStamp());
   DEBUG2_PRINT("%s geigerStop()\n", getTimeStamp());
 
+  // Write out anything still queued
+  writerStop();
+  if (msgf != errf)
+    fclose(msgf);
+  writerGetStats(&wstats);
+  fprintf(errf, "%s writerStop(), %lu records written, %lu dropped, %lu sink errors, max queue %d, %lu bytes of log dropped\n", getTimeStamp(), wstats.written, wstats.dropped, wstats.errors, wstats.maxDepth, wstats.logDropped);
+
+  // Send the last of the telemetry
+  if (telemetryTo != NULL) {
+    telemetryClose(&tlm);
+    fprintf(errf, "%s telemetryClose(), %lu frames sent, %lu unsent\n", getTimeStamp(), tlm.sent, tlm.unsent);
+  }
+
   // Close the output file
-  fclose(csvf);
+  if (packed)
+    packlogClose(&pakf);
+  else
+    flightlogClose(&csvf);
   fprintf(errf, "%s Closed output file.\n", getTimeStamp());
 
   // Close the log file
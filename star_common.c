@@ -26,7 +26,46 @@
 #include <math.h>
 #include <time.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "star_common.h"
 
+// Set by clockSetVirtual(), for running recorded data faster than real time
+static atomic_bool virtualClock;
+static atomic_ullong virtualNS;
+
+
+/*
+ * getTimeNS: Gets the current CLOCK_MONOTONIC time in nanoseconds, or
+ *            the virtual time if clockSetVirtual() has been called
+ *****************************************************************************
+ */
+
+unsigned long long getTimeNS(void) {
+  struct timespec tim;
+
+  if (atomic_load_explicit(&virtualClock, memory_order_relaxed))
+    return atomic_load_explicit(&virtualNS, memory_order_relaxed);
+
+  clock_gettime(CLOCK_MONOTONIC, &tim);
+
+  return tim.tv_sec * 1000000000ULL + tim.tv_nsec;
+}
+
+/*
+ * clockSetVirtual: Makes getTimeNS() return ns from now on instead of
+ *                  reading the clock.  Sleeping just moves the virtual
+ *                  clock on to the wake up time, so code that paces
+ *                  itself with waitNextSec() or scheduleWait() runs
+ *                  as fast as the CPU allows.
+ *****************************************************************************
+ */
+
+void clockSetVirtual(unsigned long long ns) {
+  atomic_store(&virtualNS, ns);
+  atomic_store(&virtualClock, true);
+}
 
 /*
  * getTimeMS: Gets the current time in milliseconds
@@ -39,7 +78,7 @@ unsigned long long getTimeMS(void) {
   clock_gettime(CLOCK_REALTIME, &tim);
 
   /* seconds, converted to ms */
-  unsigned long ms = tim.tv_sec * 1000;
+  unsigned long long ms = tim.tv_sec * 1000ULL;
 
   /* Add full ms */
   ms += tim.tv_nsec / 1000000;
@@ -52,93 +91,175 @@ unsigned long long getTimeMS(void) {
   return ms;
 }
 
+// Each thread keeps its own stamps, so callers never share a buffer.
+// The slow part (localtime() and strftime()) only runs when the second
+// changes; in between only the milliseconds are patched in.
+struct stamp_cache {
+  time_t sec;             // Second the text was built for, -1 if never
+  char ts[STAMP_LEN];     // [HH:MM:SS.mmm]
+};
+
+static _Thread_local struct stamp_cache timeCache = { -1, "" };
+static _Thread_local struct stamp_cache dateCache = { -1, "" };
+
+
 /*
  * getTimeStamp: Gets the current timestamp [HH:MM:SS.ms]
+ *               The text belongs to the calling thread and is good until
+ *               that thread calls again
  *****************************************************************************
  */
 
 const char * getTimeStamp(void) {
-  unsigned long ms = getTimeMS();
-  unsigned int s;
-  static char t[12] = {0};
-  static char ts[12] = {0};
+  struct timespec tim;
   struct tm tstruct;
+  int ms;
 
-  // Get the current time (UTC)
-  time_t now = time(0);
-  // Convert to the local time
-  tstruct = *localtime(&now);
+  // Seconds and milliseconds from the same reading of the clock
+  clock_gettime(CLOCK_REALTIME, &tim);
 
-  // Calculate seconds
-  s = ms / 1000;
-  ms -= s * 1000;
+  // A new second, build the rest of the stamp in the local time
+  if (tim.tv_sec != timeCache.sec) {
+    localtime_r(&tim.tv_sec, &tstruct);
+    strftime(timeCache.ts, sizeof(timeCache.ts), "[%H:%M:%S.000]", &tstruct);
+    timeCache.sec = tim.tv_sec;
+  }
 
-  strftime(t, sizeof(t), "%H:%M:%S", &tstruct);
+  // Patch in the milliseconds, after "[HH:MM:SS."
+  ms = tim.tv_nsec / 1000000;
+  timeCache.ts[10] = '0' + ms / 100;
+  timeCache.ts[11] = '0' + (ms / 10) % 10;
+  timeCache.ts[12] = '0' + ms % 10;
 
-  sprintf(ts, "[%s.%03ld]", t, ms);
-  return ts;
+  return timeCache.ts;
 }
 
 /*
- * getDateTimeStamp: Gets the current timestamp YYYY-MM-DD.HH.MM.SS
+ * getDateTimeStamp: Gets the current timestamp YYYY-MM-DD_HH-MM-SS
+ *                   The text belongs to the calling thread and is good
+ *                   until that thread calls again
  *****************************************************************************
  */
 
 const char * getDateTimeStamp(void) {
-  static char ts[20] = {0};
   struct tm tstruct;
 
   // Get the current time (UTC)
   time_t now = time(0);
-  // Convert to the local time
-  tstruct = *localtime(&now);
 
-  strftime(ts, sizeof(ts), "%Y-%m-%d_%H-%M-%S", &tstruct);
+  // Convert to the local time, only if it has changed
+  if (now != dateCache.sec) {
+    localtime_r(&now, &tstruct);
+    strftime(dateCache.ts, sizeof(dateCache.ts), "%Y-%m-%d_%H-%M-%S", &tstruct);
+    dateCache.sec = now;
+  }
 
-  return ts;
+  return dateCache.ts;
 }
 
 /*
- * waitNanoSec: Waits for a specified number of nanoseconds.
- *              The maximum interval is 999999999 ns.
+ * formatTimeStamp, formatDateTimeStamp: Same as above, into a buffer of
+ *                                       the caller's
  *****************************************************************************
  */
 
-void waitNanoSec(long interval) {
-  struct timespec tim, tim2, rem;
+char * formatTimeStamp(char *buf, size_t len) {
+  snprintf(buf, len, "%s", getTimeStamp());
+  return buf;
+}
 
-  // Get the current time
-  clock_gettime(CLOCK_MONOTONIC, &tim);
+char * formatDateTimeStamp(char *buf, size_t len) {
+  snprintf(buf, len, "%s", getDateTimeStamp());
+  return buf;
+}
+
+/*
+ * sleepUntilNS: Sleeps until an absolute CLOCK_MONOTONIC time, picking
+ *               up again if a signal wakes us early
+ *****************************************************************************
+ */
 
-  // Calculate how long to wait until the next interval
-  interval = interval - tim.tv_nsec;
+static void sleepUntilNS(unsigned long long ns) {
+  struct timespec tim;
 
-  tim2.tv_sec = interval / 1000000000;    // seconds
-  tim2.tv_nsec = interval % 1000000000;   // nanoseconds
+  tim.tv_sec = ns / 1000000000ULL;
+  tim.tv_nsec = ns % 1000000000ULL;
 
-  // nanosleep() can be interrupted by the system
-  // If it is interrupted, it returns -1 and places
-  // the remaining time into rem
-  while (nanosleep(&tim2, &rem) < 0) {
-    tim2 = rem;             // If any time remaining, wait some more
+  // Nothing to wait for on the virtual clock, just move it on
+  if (atomic_load(&virtualClock)) {
+    if (ns > atomic_load(&virtualNS))
+      atomic_store(&virtualNS, ns);
+    return;
   }
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tim, NULL) == EINTR) { }
+}
+
+/*
+ * waitNanoSec: Waits for a specified number of nanoseconds.
+ *****************************************************************************
+ */
+
+void waitNanoSec(long interval) {
+  sleepUntilNS(getTimeNS() + interval);
 }
 
 /*
- * waitNextSec: Attempts to wait until the next whole second.
+ * waitNextSec: Waits until the next whole second of CLOCK_MONOTONIC.
  *****************************************************************************
  */
 
 void waitNextSec(void) {
-  struct timespec tim, tim2, rem;
+  sleepUntilNS((getTimeNS() / 1000000000ULL + 1) * 1000000000ULL);
+}
 
-  // Get the current time
-  clock_gettime(CLOCK_MONOTONIC, &tim);
+/*
+ * scheduleInit: Sets up a periodic schedule whose deadlines fall at
+ *               start + n * period (CLOCK_MONOTONIC ns), n = 1, 2, ...
+ *****************************************************************************
+ */
+
+void scheduleInit(struct schedule *sch, unsigned long long start, unsigned long long period) {
+  sch->period = period;
+  sch->next = start + period;
+  sch->ticks = 0;
+  sch->overruns = 0;
+  sch->missed = 0;
+  sch->worstLate = 0;
+}
+
+/*
+ * scheduleWait: Sleeps until the next deadline.  Deadlines are absolute,
+ *               so time spent working doesn't push later ones back.  If
+ *               the deadline has already passed it's an overrun: we
+ *               return right away, and skip any deadlines that were
+ *               missed entirely rather than racing to catch up.
+ *               Returns the number of deadlines skipped
+ *****************************************************************************
+ */
+
+long scheduleWait(struct schedule *sch) {
+  unsigned long long now = getTimeNS();
+  unsigned long long late;
+  long missed = 0;
+
+  if (now < sch->next) {
+    sleepUntilNS(sch->next);
+  }
+  else {
+    late = now - sch->next;
+    missed = late / sch->period;
+
+    sch->overruns++;
+    sch->missed += missed;
+    if (late > sch->worstLate)
+      sch->worstLate = late;
+  }
 
-  tim2.tv_nsec = 999999999 - tim.tv_nsec; // nanoseconds
-  tim2.tv_sec = 0;                        // seconds
+  sch->next += (missed + 1) * sch->period;
+  sch->ticks++;
 
-  nanosleep(&tim2, &rem);
+  return missed;
 }
 
 /*
@@ -24,12 +24,32 @@
 #ifndef STAR_COMMON_H
 #define STAR_COMMON_H
 
+#include <stddef.h>
+
+// Room for either kind of time stamp, with its NUL
+#define STAMP_LEN  24
+
+// Absolute deadlines every period nanoseconds, on CLOCK_MONOTONIC
+struct schedule {
+  unsigned long long period;      // Nanoseconds between deadlines
+  unsigned long long next;        // The next deadline
+  unsigned long ticks;            // Deadlines waited for
+  unsigned long overruns;         // Times we got there after the deadline
+  unsigned long missed;           // Deadlines skipped entirely
+  unsigned long long worstLate;   // Latest we've ever been, nanoseconds
+};
+
 unsigned long long getTimeNS(void);
+void clockSetVirtual(unsigned long long ns);
 unsigned long long getTimeMS(void);
 const char * getTimeStamp(void);
 const char * getDateTimeStamp(void);
+char * formatTimeStamp(char *buf, size_t len);
+char * formatDateTimeStamp(char *buf, size_t len);
 void waitNanoSec(long interval);
 void waitNextSec(void);
+void scheduleInit(struct schedule *sch, unsigned long long start, unsigned long long period);
+long scheduleWait(struct schedule *sch);
 double roundPrecision(double val, int precision);
 float cvtCtoF(double temp);
 float cvtMbtoIn(double pressure);
@@ -0,0 +1,49 @@
+/*
+ *****************************************************************************
+ * star_data.h:  one second of STAR data, as kept by the main loop and
+ *               written to the flight log.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef STAR_DATA_H
+#define STAR_DATA_H
+
+// What was going on during a second
+#define DATA_HV_ON      0x0001    // The Geiger tube was powered
+#define DATA_POST       0x0002    // Counts are from the power on self test
+#define DATA_HV_PARTIAL 0x0004    // HV came on part way through, counts cover only part of the second
+#define DATA_NO_ALT     0x0008    // The altimeter had no sample yet, T, P and altitude are 0
+
+// A single second of data
+struct data_second {
+   double elapsed;
+   int counts;
+   unsigned long T;
+   double T1;
+   unsigned long P;
+   double P1;
+   double P2;
+   float altitude;
+   double deadTime;
+   int deadCounts;
+   unsigned int flags;      // DATA_*
+};
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ *****************************************************************************
+ * telemetry.c:  batched binary telemetry frames, sent to the ground over
+ *               UDP without ever waiting on the link.
+ *
+ *               Seconds are packed into frames of a few at a time, each
+ *               second as its flight log record plus its 100 ms counts,
+ *               so the ground gets everything the log has at a fraction
+ *               of the datagrams.  The socket never blocks: if the link
+ *               isn't ready the frame is counted as unsent and dropped,
+ *               and the next frame says how many went missing.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "telemetry.h"
+
+// The wire layout must not depend on the compiler's padding
+_Static_assert(sizeof(struct telemetry_frame_header) == 24, "telemetry_frame_header is padded");
+_Static_assert(sizeof(struct telemetry_second) == 96, "telemetry_second is padded");
+_Static_assert(sizeof(struct telemetry_frame) <= 1472, "telemetry_frame doesn't fit in a datagram");
+
+
+/*
+ * telemetryFrameSize: Bytes on the wire for a frame of count seconds
+ *****************************************************************************
+ */
+
+size_t telemetryFrameSize(int count) {
+  return sizeof(struct telemetry_frame_header) + count * sizeof(struct telemetry_second);
+}
+
+/*
+ * telemetryOpen: Sets up a stream to host:port, sending a frame every
+ *                batch seconds
+ *                Returns -1 if the address can't be used
+ *****************************************************************************
+ */
+
+int telemetryOpen(struct telemetry *t, const char *hostPort, int batch) {
+  struct addrinfo hints, *res;
+  char host[256];
+  const char *port;
+  size_t len;
+
+  memset(t, 0, sizeof(*t));
+  t->fd = -1;
+  t->batch = (batch < 1) ? 1 : (batch > TELEMETRY_MAX_BATCH) ? TELEMETRY_MAX_BATCH : batch;
+
+  // The port is after the last colon
+  if (((port = strrchr(hostPort, ':')) == NULL) || ((len = port - hostPort) >= sizeof(host)))
+    return -1;
+  memcpy(host, hostPort, len);
+  host[len] = '\0';
+  port++;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(host, port, &hints, &res) != 0)
+    return -1;
+
+  memcpy(&t->addr, res->ai_addr, res->ai_addrlen);
+  t->addrLen = res->ai_addrlen;
+  t->fd = socket(res->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  freeaddrinfo(res);
+
+  if (t->fd < 0)
+    return -1;
+
+  memcpy(t->frame.hdr.magic, TELEMETRY_MAGIC, sizeof(t->frame.hdr.magic));
+  t->frame.hdr.version = TELEMETRY_VERSION;
+
+  return 0;
+}
+
+/*
+ * telemetryWrite: Adds a second, with its counts in each 100 ms, and
+ *                 sends the frame once it has batch seconds in it.
+ *                 tenths is NULL if they aren't known any more.
+ *                 Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int telemetryWrite(struct telemetry *t, const struct data_second *data, const uint16_t tenths[TELEMETRY_TENTHS]) {
+  struct telemetry_second *s = &t->frame.secs[t->frame.hdr.count];
+
+  flightlogFromData(&s->rec, t->recSeq++, data);
+  if (tenths != NULL) {
+    memcpy(s->tenths, tenths, sizeof(s->tenths));
+    s->flags = 0;
+  }
+  else {
+    memset(s->tenths, 0, sizeof(s->tenths));
+    s->flags = TELEMETRY_NO_TENTHS;
+  }
+
+  if (++t->frame.hdr.count < t->batch)
+    return 0;
+
+  return telemetrySend(t);
+}
+
+/*
+ * telemetrySend: Sends whatever is in the frame now.  If the link isn't
+ *                ready the frame is dropped rather than waited for.
+ *                Returns -1 if there is an error other than that
+ *****************************************************************************
+ */
+
+int telemetrySend(struct telemetry *t) {
+  struct telemetry_frame_header *hdr = &t->frame.hdr;
+  size_t len = telemetryFrameSize(hdr->count);
+  int result = 0;
+
+  if ((t->fd < 0) || (hdr->count == 0))
+    return 0;
+
+  hdr->unsent = t->unsent;
+  hdr->crc = 0;
+  hdr->crc = flightlogCRC(&t->frame, len);
+
+  if (sendto(t->fd, &t->frame, len, MSG_DONTWAIT, (struct sockaddr *)&t->addr, t->addrLen) == (ssize_t)len) {
+    t->sent++;
+  }
+  else {
+    t->unsent++;
+
+    // Full buffers, or nobody listening, isn't our problem
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS) &&
+        (errno != ECONNREFUSED) && (errno != ENETUNREACH) && (errno != EHOSTUNREACH))
+      result = -1;
+  }
+
+  hdr->seq++;
+  hdr->count = 0;
+
+  return result;
+}
+
+/*
+ * telemetryClose: Sends anything left over and closes the socket
+ *****************************************************************************
+ */
+
+void telemetryClose(struct telemetry *t) {
+  telemetrySend(t);
+
+  if (t->fd >= 0)
+    close(t->fd);
+  t->fd = -1;
+}
+
+/*
+ * telemetryFrameValid: Checks a received frame, len bytes long
+ *****************************************************************************
+ */
+
+bool telemetryFrameValid(const struct telemetry_frame *frame, size_t len) {
+  struct telemetry_frame copy;
+
+  if ((len < sizeof(frame->hdr)) || (len > sizeof(*frame)))
+    return false;
+  if ((memcmp(frame->hdr.magic, TELEMETRY_MAGIC, sizeof(frame->hdr.magic)) != 0) || (frame->hdr.version != TELEMETRY_VERSION))
+    return false;
+  if ((frame->hdr.count > TELEMETRY_MAX_BATCH) || (len != telemetryFrameSize(frame->hdr.count)))
+    return false;
+
+  memcpy(&copy, frame, len);
+  copy.hdr.crc = 0;
+
+  return flightlogCRC(&copy, len) == frame->hdr.crc;
+}
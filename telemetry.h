@@ -0,0 +1,90 @@
+/*
+ *****************************************************************************
+ * telemetry.h:  batched binary telemetry frames, sent to the ground over
+ *               UDP without ever waiting on the link.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include "star_data.h"
+#include "flightlog.h"
+
+#define TELEMETRY_MAGIC    "STARTLM"  // Seven characters and a NUL
+#define TELEMETRY_VERSION  1
+
+// Seconds in a frame at most, so a frame fits in one Ethernet datagram
+#define TELEMETRY_MAX_BATCH  14
+
+// Counts in each 100 ms of a second
+#define TELEMETRY_TENTHS     10
+
+// A second as sent to the ground
+struct telemetry_second {
+  struct flightlog_record rec;              // Just as written to the flight log
+  uint16_t tenths[TELEMETRY_TENTHS];        // Counts in each 100 ms
+  uint32_t flags;                           // TELEMETRY_*
+};
+
+// The 100 ms counts had aged out of the history before the second was
+// sent, so its tenths are all 0 and mean nothing
+#define TELEMETRY_NO_TENTHS  0x0001
+
+// What precedes the seconds in a frame
+struct telemetry_frame_header {
+  char magic[8];          // TELEMETRY_MAGIC
+  uint16_t version;       // TELEMETRY_VERSION
+  uint16_t count;         // Seconds in this frame
+  uint32_t seq;           // Frame number, from 0
+  uint32_t unsent;        // Frames that couldn't be sent before this one
+  uint32_t crc;           // CRC-32 of the frame, with this set to 0
+};
+
+// A datagram.  Only the first count seconds are sent.
+struct telemetry_frame {
+  struct telemetry_frame_header hdr;
+  struct telemetry_second secs[TELEMETRY_MAX_BATCH];
+};
+
+// A stream being sent
+struct telemetry {
+  int fd;
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+  int batch;                        // Seconds per frame
+  uint32_t recSeq;                  // Next second's record number
+  struct telemetry_frame frame;     // Frame being filled
+  unsigned long sent;               // Frames sent
+  unsigned long unsent;             // Frames the link wasn't ready for
+};
+
+int telemetryOpen(struct telemetry *t, const char *hostPort, int batch);
+int telemetryWrite(struct telemetry *t, const struct data_second *data, const uint16_t tenths[TELEMETRY_TENTHS]);
+int telemetrySend(struct telemetry *t);
+void telemetryClose(struct telemetry *t);
+size_t telemetryFrameSize(int count);
+bool telemetryFrameValid(const struct telemetry_frame *frame, size_t len);
+
+#endif
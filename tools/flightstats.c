@@ -0,0 +1,399 @@
+/*
+ *****************************************************************************
+ * flightstats.c:  Dose and count rate against altitude for a whole flight,
+ *                 straight from the binary log.
+ *
+ *                 Every segment is memory mapped and the records split into
+ *                 one chunk per core.  Each chunk is checked, run through
+ *                 the same compensation STAR uses live to get its altitude,
+ *                 and added up into altitude bins on its own, and the bins
+ *                 of every chunk are added together at the end.  Dose uses
+ *                 the same conversion factor as cpmTouSv(), and the dead
+ *                 time correction the same model as cpmTouSvCorrected().
+ *
+ *                 The altitude profile goes to stdout as CSV, with the
+ *                 totals, the integrated dose and the Pfotzer maximum (the
+ *                 bin that counted fastest) after it on stderr.
+ *
+ *                 Usage: flightstats [-b metres] [-s seconds] [-j threads]
+ *                                    [-d model] <segment>...
+ *
+ * Copyright 2018, Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../star_common.h"
+#include "../star_data.h"
+#include "../geiger.h"
+#include "../deadtime.h"
+#include "../MS5607.h"
+#include "../flightlog.h"
+
+#define ALT_TOP       50000.0   // m, anything higher goes in the last bin
+#define MAX_THREADS   64
+#define MIN_CHUNK     4096      // Records, smaller logs use fewer threads
+
+// A mapped segment
+struct segment {
+  const char *fname;
+  void *map;
+  size_t size;
+  const struct flightlog_record *recs;
+  long n;                       // Whole records in it
+};
+
+// Seconds with HV on in one altitude bin
+struct alt_bin {
+  long seconds;
+  long long counts;
+  long long deadCounts;
+  double deadTime;              // Seconds
+};
+
+// What one thread adds up over records first..last-1, counting every
+// segment one after the other
+struct chunk {
+  pthread_t thread;
+  long first, last;
+  struct alt_bin *bins;         // numBins of them
+  struct alt_bin noAlt;         // HV on before the altimeter had a sample
+  unsigned long records, bad;
+  double maxDead;               // Most dead time in any one second
+};
+
+static struct segment *segs;
+static int numSegs = 0;
+static long totalRecords = 0;
+
+static double binWidth = 100.0;  // m
+static int numBins;
+static int minSeconds = 30;      // Seconds a bin needs to be the Pfotzer maximum
+
+
+/*
+ * mapSegment: Maps a segment and checks it's from the same flight as the
+ *             first one
+ *             Returns -1 if it can't be read
+ *****************************************************************************
+ */
+
+static int mapSegment(const char *fname, struct segment *seg, struct flightlog_header *first) {
+  const struct flightlog_header *hdr;
+  struct stat st;
+  int fd;
+
+  if ((fd = open(fname, O_RDONLY)) < 0) {
+    fprintf(stderr, "Can't open %s!\n", fname);
+    return -1;
+  }
+
+  if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(*hdr))) {
+    fprintf(stderr, "%s is not a STAR flight log (or is a version we can't read)\n", fname);
+    close(fd);
+    return -1;
+  }
+
+  seg->fname = fname;
+  seg->size = st.st_size;
+  seg->map = mmap(NULL, seg->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (seg->map == MAP_FAILED) {
+    fprintf(stderr, "Can't map %s!\n", fname);
+    return -1;
+  }
+
+  hdr = seg->map;
+  if (!flightlogHeaderValid(hdr)) {
+    fprintf(stderr, "%s is not a STAR flight log (or is a version we can't read)\n", fname);
+    munmap(seg->map, seg->size);
+    return -1;
+  }
+
+  // Everything is binned with one calibration and QFF
+  if (numSegs == 0) {
+    *first = *hdr;
+  }
+  else if ((memcmp(hdr->C, first->C, sizeof(hdr->C)) != 0) || (hdr->qff != first->qff)) {
+    fprintf(stderr, "%s is from another flight than %s\n", fname, segs[0].fname);
+    munmap(seg->map, seg->size);
+    return -1;
+  }
+
+  // Read front to back, once
+  madvise(seg->map, seg->size, MADV_SEQUENTIAL);
+
+  // A short record at the end is a write that was cut off
+  seg->recs = (const struct flightlog_record *)((const char *)seg->map + sizeof(*hdr));
+  seg->n = (seg->size - sizeof(*hdr)) / sizeof(struct flightlog_record);
+
+  return 0;
+}
+
+/*
+ * altBin: The bin an altitude goes in
+ *****************************************************************************
+ */
+
+static int altBin(float altitude) {
+  int bin = (altitude < 0) ? 0 : (int)(altitude / binWidth);
+
+  return (bin >= numBins) ? numBins - 1 : bin;
+}
+
+/*
+ * addSecond: Adds one second with HV on to a bin
+ *****************************************************************************
+ */
+
+static void addSecond(struct alt_bin *bin, const struct data_second *data) {
+  bin->seconds++;
+  bin->counts += data->counts;
+  bin->deadCounts += data->deadCounts;
+  bin->deadTime += data->deadTime;
+}
+
+/*
+ * chunkThread: Checks and bins the records of one chunk
+ *****************************************************************************
+ */
+
+static void *chunkThread(void *vargp) {
+  struct chunk *ch = vargp;
+  struct altimeter_sample s;
+  struct data_second data;
+  long base = 0, from, to;
+
+  for (int i = 0; i < numSegs; i++) {
+    from = (ch->first > base) ? ch->first - base : 0;
+    to = (ch->last < base + segs[i].n) ? ch->last - base : segs[i].n;
+
+    for (long r = from; r < to; r++) {
+      if (!flightlogRecordValid(&segs[i].recs[r])) {
+        ch->bad++;
+        continue;
+      }
+      ch->records++;
+
+      flightlogToData(&segs[i].recs[r], &data);
+      // A second HV came on part way through would drag the rate down
+      if (!(data.flags & DATA_HV_ON) || (data.flags & DATA_HV_PARTIAL) || (data.counts < 0))
+        continue;
+
+      if (data.deadTime > ch->maxDead)
+        ch->maxDead = data.deadTime;
+
+      // Until the altimeter has a sample, everything is recorded as zero.
+      // Older logs don't flag it.
+      if ((data.flags & DATA_NO_ALT) || ((data.T == 0) && (data.P == 0))) {
+        addSecond(&ch->noAlt, &data);
+        continue;
+      }
+
+      altimeterConvert(data.T, data.P, &s);
+      addSecond(&ch->bins[altBin(s.altitude)], &data);
+    }
+
+    base += segs[i].n;
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * addBin: Adds one bin into another
+ *****************************************************************************
+ */
+
+static void addBin(struct alt_bin *total, const struct alt_bin *bin) {
+  total->seconds += bin->seconds;
+  total->counts += bin->counts;
+  total->deadCounts += bin->deadCounts;
+  total->deadTime += bin->deadTime;
+}
+
+/*
+ * correctedCounts: The counts of a bin with the ones the tube missed
+ *                  while it was dead put back, using the mean dead time
+ *                  of the bin, or of the whole flight if none was
+ *                  measured in it
+ *                  Returns -1 if the tube was saturated.
+ *****************************************************************************
+ */
+
+static double correctedCounts(const struct alt_bin *bin, double flightTau) {
+  double tau = (bin->deadCounts > 0) ? bin->deadTime / bin->deadCounts : flightTau;
+  double rate = deadTimeCorrect(getDeadTimeModel(), (double)bin->counts / bin->seconds, tau);
+
+  return (rate < 0) ? -1.0 : rate * bin->seconds;
+}
+
+/*
+ * dose: Dose from a number of counts, microSieverts
+ *****************************************************************************
+ */
+
+static double dose(double counts) {
+  return cpmToDose(1.0) * counts / 60.0;
+}
+
+int main (int argc, char *argv[]) {
+  unsigned long long start = getTimeMS();
+  struct flightlog_header hdr;
+  struct chunk chunks[MAX_THREADS];
+  struct alt_bin *bins, total, noAlt;
+  unsigned long records = 0, bad = 0;
+  double maxDead = 0.0, tau, rate, corrected, correctedTotal = 0.0;
+  double pfotzerRate = 0.0;
+  bool saturated = false;
+  int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int pfotzer = -1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:s:j:d:")) != -1) {
+    switch (opt) {
+    case 'b': binWidth = atof(optarg); break;                   // Altitude bin width, m
+    case 's': minSeconds = atoi(optarg); break;                 // Seconds in the Pfotzer maximum bin
+    case 'j': numThreads = atoi(optarg); break;                 // Threads to use
+    case 'd':                                                   // Dead time model
+      setDeadTimeModel((optarg[0] == 'p') ? DEADTIME_PARALYZABLE : DEADTIME_NONPARALYZABLE);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-b metres] [-s seconds] [-j threads] [-d model] <segment>...\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if ((optind >= argc) || (binWidth <= 0)) {
+    fprintf(stderr, "Usage: %s [-b metres] [-s seconds] [-j threads] [-d model] <segment>...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  segs = calloc(argc - optind, sizeof(segs[0]));
+  for (int i = optind; i < argc; i++) {
+    if (mapSegment(argv[i], &segs[numSegs], &hdr) < 0)
+      exit(EXIT_FAILURE);
+    totalRecords += segs[numSegs++].n;
+  }
+
+  // The same compensation and altitude as in flight
+  setAltimeterCalibration(hdr.C);
+  setQFFValue(hdr.qff);
+
+  // No more threads than there are chunks worth splitting off
+  if (numThreads > MAX_THREADS)
+    numThreads = MAX_THREADS;
+  if (numThreads > (totalRecords + MIN_CHUNK - 1) / MIN_CHUNK)
+    numThreads = (totalRecords + MIN_CHUNK - 1) / MIN_CHUNK;
+  if (numThreads < 1)
+    numThreads = 1;
+
+  numBins = ALT_TOP / binWidth + 1;
+
+  for (int t = 0; t < numThreads; t++) {
+    memset(&chunks[t], 0, sizeof(chunks[t]));
+    chunks[t].first = totalRecords * t / numThreads;
+    chunks[t].last = totalRecords * (t + 1) / numThreads;
+    chunks[t].bins = calloc(numBins, sizeof(struct alt_bin));
+
+    if (pthread_create(&chunks[t].thread, NULL, chunkThread, &chunks[t]) != 0) {
+      fprintf(stderr, "Can't start thread %d!\n", t);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Add every chunk up in order, so the result doesn't depend on which
+  // thread finished first
+  bins = calloc(numBins, sizeof(struct alt_bin));
+  memset(&total, 0, sizeof(total));
+  memset(&noAlt, 0, sizeof(noAlt));
+  for (int t = 0; t < numThreads; t++) {
+    pthread_join(chunks[t].thread, NULL);
+
+    for (int b = 0; b < numBins; b++) {
+      addBin(&bins[b], &chunks[t].bins[b]);
+    }
+    addBin(&noAlt, &chunks[t].noAlt);
+    records += chunks[t].records;
+    bad += chunks[t].bad;
+    if (chunks[t].maxDead > maxDead)
+      maxDead = chunks[t].maxDead;
+    free(chunks[t].bins);
+  }
+
+  for (int b = 0; b < numBins; b++) {
+    addBin(&total, &bins[b]);
+  }
+  addBin(&total, &noAlt);
+  tau = (total.deadCounts > 0) ? total.deadTime / total.deadCounts : 0.0;
+
+  fprintf(stdout, "%s\n", hdr.started);
+  fprintf(stdout, "Altitude (m), Seconds, Counts, Count Rate (counts/s), Dose Rate (uSv/h), Corrected Dose Rate (uSv/h), Dead Time Counts, Mean Dead Time (us), Dead Fraction\n");
+
+  for (int b = 0; b < numBins; b++) {
+    if (bins[b].seconds == 0)
+      continue;
+
+    rate = (double)bins[b].counts / bins[b].seconds;
+    corrected = correctedCounts(&bins[b], tau);
+    if (corrected < 0)
+      saturated = true;
+    else
+      correctedTotal += corrected;
+
+    if ((bins[b].seconds >= minSeconds) && ((pfotzer < 0) || (rate > pfotzerRate))) {
+      pfotzer = b;
+      pfotzerRate = rate;
+    }
+
+    fprintf(stdout, "%.0f, %ld, %lld, %f, %f, %f, %lld, %f, %f\n", b * binWidth, bins[b].seconds, bins[b].counts, rate, cpmToDose(rate * 60.0), (corrected < 0) ? -1.0 : cpmToDose(corrected / bins[b].seconds * 60.0), bins[b].deadCounts, (bins[b].deadCounts > 0) ? bins[b].deadTime / bins[b].deadCounts * 1e6 : 0.0, bins[b].deadTime / bins[b].seconds);
+  }
+
+  // Before the altimeter had a sample, so not in any bin
+  if (noAlt.seconds > 0) {
+    corrected = correctedCounts(&noAlt, tau);
+    if (corrected < 0)
+      saturated = true;
+    else
+      correctedTotal += corrected;
+  }
+
+  fprintf(stderr, "%s: %d segments, %lu records, %lu failed their CRC, %ld s with HV on (%ld without an altitude)\n", hdr.started, numSegs, records, bad, total.seconds, noAlt.seconds);
+  fprintf(stderr, "%lld counts, %.4f uSv, corrected (%s) %.4f uSv%s\n", total.counts, dose(total.counts), deadTimeModelName(getDeadTimeModel()), dose(correctedTotal), saturated ? ", leaving out bins where the tube was saturated" : "");
+  fprintf(stderr, "Dead time: %lld counts, mean %.1f us, %.6f s in all, at most %.6f s in one second\n", total.deadCounts, tau * 1e6, total.deadTime, maxDead);
+  if (pfotzer >= 0)
+    fprintf(stderr, "Pfotzer maximum: %.0f..%.0f m, %.3f counts/s over %ld s\n", pfotzer * binWidth, (pfotzer + 1) * binWidth, pfotzerRate, bins[pfotzer].seconds);
+  else
+    fprintf(stderr, "Pfotzer maximum: no bin with %d s in it\n", minSeconds);
+  fprintf(stderr, "%d threads in %.3f s\n", numThreads, (getTimeMS() - start) / 1000.0);
+
+  free(bins);
+  for (int i = 0; i < numSegs; i++) {
+    munmap(segs[i].map, segs[i].size);
+  }
+  free(segs);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/*
+ *****************************************************************************
+ * geigerbench.c:  Drives the Geiger counting path with simulated pulses
+ *                 and checks the results against ground truth.
+ *
+ *                 Steps through increasing (Poisson) count rates and, for
+ *                 each, reports how many pulses were counted, how many
+ *                 edges were dropped, how close the measured dead time
+ *                 came to the truth, how close the dead time corrected
+ *                 rate came to the true arrival rate, and how much CPU
+ *                 it took.  The
+ *                 highest rate counted without loss is the maximum
+ *                 sustainable rate.  With -P a recorded flight is played
+ *                 back instead.
+ *
+ *                 Usage: geigerbench [-d seconds] [-w width_us] [-r from]
+ *                                    [-x to] [-P counts.txt] [-R]
+ *
+ * Copyright 2018, Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "../star_common.h"
+#include "../geiger.h"
+#include "../sim.h"
+#include "../realtime.h"
+#include "../latency.h"
+
+// A step loses pulses if it counts fewer than this fraction of them
+#define LOSS_LIMIT  0.001
+
+// The results of one step
+struct step {
+  double rate;                  // Arrivals per second asked for
+  struct sim_truth truth;
+  struct geiger_stats stats;
+  unsigned int dropped;         // Edges lost to a full ring
+  double cpu;                   // CPU seconds per second, all threads
+  double loss;                  // Fraction of pulses not counted
+};
+
+
+/*
+ * cpuSeconds: User and system time used so far, every thread
+ *****************************************************************************
+ */
+
+static double cpuSeconds(void) {
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+         ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * runStep: Simulates secs seconds and counts them
+ *****************************************************************************
+ */
+
+static void runStep(struct sim_config *cfg, long secs, struct step *st) {
+  unsigned long long epoch, start, end;
+  unsigned int dropped;
+  double cpu;
+
+  simConfigure(cfg);
+  geigerReset();
+
+  // Start on a whole second so the bins line up with the simulation
+  epoch = getEpochNS();
+  start = epoch + 1000000000ULL;
+  end = start + secs * 1000000000ULL;
+
+  dropped = getDroppedEdges();
+  simStart(start, end);
+  cpu = cpuSeconds();
+
+  // Leave time for the last pulse to end and be counted
+  waitNanoSec(end + 200000000ULL - getTimeNS());
+
+  st->rate = cfg->rate;
+  st->cpu = (cpuSeconds() - cpu) / ((end + 200000000ULL - start) / 1e9);
+  st->dropped = getDroppedEdges() - dropped;
+  simStop();
+  simGetTruth(&st->truth);
+  getStatsRange(1, secs, &st->stats);
+
+  st->loss = (st->truth.pulses > 0) ? 1.0 - (double)st->stats.counts / st->truth.pulses : 0.0;
+}
+
+/*
+ * printStep: Writes a row of the results table
+ *****************************************************************************
+ */
+
+static void printStep(const struct step *st, long secs) {
+  double dtErr = (st->truth.deadTime > 0) ? (st->stats.deadTime - st->truth.deadTime) / st->truth.deadTime * 100.0 : 0.0;
+  double arrivals = st->truth.arrivals / (double)secs;
+  double tau = (st->stats.deadCounts > 0) ? st->stats.deadTime / st->stats.deadCounts : 0.0;
+  double corrected = deadTimeCorrect(getDeadTimeModel(), st->stats.counts / (double)secs, tau);
+  double corrErr = (arrivals > 0) ? (corrected - arrivals) / arrivals * 100.0 : 0.0;
+
+  printf(" %9.0f | %9.1f | %9llu | %9d | %7.3f%% | %7u | %9.6f | %9.6f | %+7.3f%% | %9.1f | %+7.3f%% | %5.1f%%\n",
+         st->rate, arrivals, st->truth.pulses, st->stats.counts,
+         st->loss * 100.0, st->dropped, st->truth.deadTime, st->stats.deadTime, dtErr,
+         corrected, corrErr, st->cpu * 100.0);
+}
+
+int main (int argc, char *argv[]) {
+  struct sim_config cfg = { 0.0, 0.000010, NULL, 1 };
+  struct step st;
+  double from = 100, to = 200000, best = 0;
+  long secs = 5;
+  bool secsGiven = false;
+  bool lossy = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:w:r:x:P:R")) != -1) {
+    switch (opt) {
+    case 'd': secs = atol(optarg); secsGiven = true; break;      // Seconds per step
+    case 'w': cfg.width = atof(optarg) / 1e6; break;              // Pulse width, us
+    case 'r': from = atof(optarg); break;                         // First rate
+    case 'x': to = atof(optarg); break;                           // Last rate
+    case 'P': cfg.replay = optarg; break;                         // Replay a flight
+    case 'R':                                                     // Real-time pulse path
+      rtConfigure(RT_CAPTURE, SCHED_FIFO, 80, 0);
+      rtConfigure(RT_COUNT, SCHED_FIFO, 70, 0);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-d seconds] [-w width_us] [-r from] [-x to] [-P counts.txt] [-R]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if ((secs < 1) || (from <= 0) || (to < from)) {
+    fprintf(stderr, "Need at least 1 second per step, and 0 < from <= to\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (simConfigure(&cfg) < 0) {
+    fprintf(stderr, "Can't replay %s!\n", cfg.replay);
+    exit(EXIT_FAILURE);
+  }
+
+  geigerSetCapture(GEIGER_CAPTURE_SIM, NULL);
+  if (geigerSetup() < 0) {
+    fprintf(stderr, "Unable to set up the Geiger counting path!\n");
+    exit(EXIT_FAILURE);
+  }
+  geigerStart();
+
+  printf("Pulse width %.1f us, %ld s per step\n", cfg.width * 1e6, secs);
+  printf("-----------+-----------+-----------+-----------+----------+---------+-----------+-----------+----------+-----------+----------+-------\n");
+  printf("      Rate |  Arrive/s |    Pulses |   Counted |     Loss | Dropped | Dead Time |  Measured |    Error | Corrected |    Error |   CPU\n");
+  printf("-----------+-----------+-----------+-----------+----------+---------+-----------+-----------+----------+-----------+----------+-------\n");
+
+  // Play back a flight, all of it unless told otherwise
+  if (cfg.replay != NULL) {
+    if (!secsGiven)
+      secs = simReplaySeconds();
+    runStep(&cfg, secs, &st);
+    printStep(&st, secs);
+  }
+
+  // Double the rate until counting falls behind
+  else {
+    for (double rate = from; rate <= to; rate *= 2) {
+      cfg.rate = rate;
+      runStep(&cfg, secs, &st);
+      printStep(&st, secs);
+
+      if ((st.loss > LOSS_LIMIT) || (st.dropped > 0)) {
+        lossy = true;
+        break;
+      }
+      best = rate;
+    }
+
+    if (best == 0)
+      printf("Pulses were lost even at %.0f counts/s\n", from);
+    else
+      printf("Maximum sustainable rate: %.0f arrivals/s%s\n", best, lossy ? "" : " (or more, nothing was lost)");
+  }
+
+  latSummary(stdout);
+  geigerStop();
+
+  return EXIT_SUCCESS;
+}
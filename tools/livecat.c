@@ -0,0 +1,81 @@
+/*
+ *****************************************************************************
+ * livecat.c:  Shows what a running STAR is publishing in shared memory,
+ *             and is an example of how to read it.
+ *
+ *             Usage: livecat [-n name] [-w seconds]
+ *
+ *             Once a second, prints the counts of the last whole second,
+ *             the average over the window and the latest altitude.
+ *
+ * Copyright 2018, Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../star_common.h"
+#include "../liveshm.h"
+
+// A snapshot is a few hundred kB, so it doesn't go on the stack
+static struct live_data live;
+
+int main (int argc, char *argv[]) {
+  const struct live_shm *shm;
+  const char *name = LIVESHM_NAME;
+  struct history_bin last, window;
+  long curSec, secs = 60;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+    switch (opt) {
+    case 'n': name = optarg; break;                 // Segment name
+    case 'w': secs = atol(optarg); break;           // Averaging window, seconds
+    default:
+      fprintf(stderr, "Usage: %s [-n name] [-w seconds]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if ((secs < 1) || (secs >= historySize(HISTORY_SECONDS))) {
+    fprintf(stderr, "The window must be 1 to %d seconds\n", historySize(HISTORY_SECONDS) - 1);
+    exit(EXIT_FAILURE);
+  }
+
+  if ((shm = liveshmMap(name)) == NULL) {
+    fprintf(stderr, "Can't map %s, is STAR running with -L?\n", name);
+    exit(EXIT_FAILURE);
+  }
+
+  while (true) {
+    if (liveshmRead(shm, &live)) {
+      curSec = (live.updatedNS - live.epochNS) / 1000000000ULL;
+
+      historyGet(&live.hist, HISTORY_SECONDS, curSec - 1, &last);
+      historySum(&live.hist, HISTORY_SECONDS, curSec - secs, curSec - 1, &window);
+
+      printf("%s update %llu, second %ld, HV %s, counts %d, dead time %.6f s, %.2f cpm over %ld s, altitude %.2f m, T %.2f C, P %.3f mbar\n",
+             getTimeStamp(), (unsigned long long)live.updates, curSec - 1, live.hvOn ? "on" : "off", last.counts, last.deadTime,
+             window.counts * 60.0 / secs, secs, live.alt.altitude, live.alt.T1, live.alt.P2);
+      fflush(stdout);
+    }
+
+    waitNextSec();
+  }
+
+  return EXIT_SUCCESS;
+}
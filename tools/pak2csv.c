@@ -0,0 +1,161 @@
+/*
+ *****************************************************************************
+ * pak2csv.c:  Converts a STAR compressed log to the same CSV star2csv
+ *             writes for a flight log.
+ *
+ *             Usage: pak2csv counts_<stamp>_*.pak > counts_<stamp>.txt
+ *
+ *             T1, P1, P2 and the altitude aren't stored, so they are
+ *             worked out again from the raw T and P with the calibration
+ *             and QFF in the header, by the same code STAR used in flight.
+ *             A damaged block is skipped, and decoding picks up again at
+ *             the next one.
+ *
+ * Copyright 2018, Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ *****************************************************************************
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "../MS5607.h"
+#include "../packlog.h"
+
+
+/*
+ * readFile: Reads a whole segment into memory
+ *           Returns NULL if it can't be read
+ *****************************************************************************
+ */
+
+static uint8_t *readFile(const char *fname, size_t *len) {
+  uint8_t *buf;
+  long size;
+  FILE *in;
+
+  if ((in = fopen(fname, "rb")) == NULL)
+    return NULL;
+
+  fseek(in, 0, SEEK_END);
+  size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+
+  if ((size < 0) || ((buf = malloc(size)) == NULL)) {
+    fclose(in);
+    return NULL;
+  }
+
+  *len = fread(buf, 1, size, in);
+  fclose(in);
+
+  return buf;
+}
+
+/*
+ * convert: Writes the records of one segment as CSV
+ *          Returns -1 if it isn't a compressed log we can read
+ *****************************************************************************
+ */
+
+static int convert(const char *fname, bool first) {
+  struct packlog_header hdr;
+  struct data_second data[PACKLOG_MAX_BLOCK];
+  struct altimeter_sample s;
+  unsigned long good = 0, blocks = 0, skipped = 0;
+  size_t len, pos, used;
+  uint8_t *buf;
+  int n;
+
+  if ((buf = readFile(fname, &len)) == NULL) {
+    fprintf(stderr, "Can't open %s!\n", fname);
+    return -1;
+  }
+
+  if (len < sizeof(hdr)) {
+    fprintf(stderr, "%s is not a STAR compressed log\n", fname);
+    free(buf);
+    return -1;
+  }
+
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (!packlogHeaderValid(&hdr)) {
+    fprintf(stderr, "%s is not a STAR compressed log (or is a version we can't read)\n", fname);
+    free(buf);
+    return -1;
+  }
+
+  fprintf(stderr, "%s: started %s, QFF = %f, %u records a block\n", fname, hdr.started, hdr.qff, hdr.blockRecords);
+  fprintf(stderr, "%s: C", fname);
+  for (int i = 0; i < 8; i++) {
+    fprintf(stderr, " %d = %u", i, hdr.C[i]);
+  }
+  fprintf(stderr, "\n");
+
+  setAltimeterCalibration(hdr.C);
+  setQFFValue(hdr.qff);
+
+  if (first) {
+    fprintf(stdout, "%s\n", hdr.started);
+    fprintf(stdout, "Elapsed, Counts, T (Raw), T1 (C), P (Raw), P1 (mbar), P2 (mbar), Altitude (m), Dead Time (s), Dead Time Counts, Flags\n");
+  }
+
+  for (pos = sizeof(hdr); pos < len; pos += used) {
+    if ((n = packlogDecode(buf + pos, len - pos, data, PACKLOG_MAX_BLOCK, &used)) < 0) {
+      skipped += used;
+      continue;
+    }
+    blocks++;
+
+    for (int i = 0; i < n; i++) {
+
+      // Until the altimeter has a sample, everything is recorded as zero
+      if ((data[i].T != 0) || (data[i].P != 0)) {
+        altimeterConvert(data[i].T, data[i].P, &s);
+        data[i].T1 = s.T1;
+        data[i].P1 = s.P1;
+        data[i].P2 = s.P2;
+        data[i].altitude = s.altitude;
+      }
+
+      fprintf(stdout, "%lf, %d, %ld, %lf, %ld, %lf, %lf, %f, %lf, %d, %u\n", data[i].elapsed, data[i].counts, data[i].T, data[i].T1, data[i].P, data[i].P1, data[i].P2, data[i].altitude, data[i].deadTime, data[i].deadCounts, data[i].flags);
+    }
+    good += n;
+  }
+
+  fprintf(stderr, "%s: %lu records in %lu blocks, %lu bytes skipped over damage, %.1f bytes a record\n", fname, good, blocks, skipped, (good > 0) ? (double)(len - sizeof(hdr)) / good : 0.0);
+  free(buf);
+
+  return 0;
+}
+
+int main (int argc, char *argv[]) {
+  int result = EXIT_SUCCESS;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <compressed log segment>...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 1; i < argc; i++) {
+    if (convert(argv[i], i == 1) < 0)
+      result = EXIT_FAILURE;
+  }
+
+  return result;
+}
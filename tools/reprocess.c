@@ -0,0 +1,271 @@
+/*
+ *****************************************************************************
+ * reprocess.c:  Runs a recorded flight back through the same compensation,
+ *               altitude and dose rate code STAR uses live, as fast as the
+ *               CPU allows.
+ *
+ *               The raw T and P of every second are compensated again with
+ *               the calibration from the log header, and the altitude
+ *               worked out again against either the recorded QFF, one
+ *               given with -Q, or one recomputed for a station given with
+ *               -q from the first reading of the flight.  Counts are fed
+ *               into the counting history on a virtual clock, so
+ *               cpmTouSv() and cpmTouSvCorrected() see just what they
+ *               would have seen in flight.
+ *               With the recorded QFF the output is identical to the
+ *               recording, and any second that isn't is reported.
+ *
+ *               Usage: reprocess [-Q qff] [-q latitude,elevation,height]
+ *                                [-w seconds] [-o prefix] [-m hours]
+ *                                [-d model] <segment>...
+ *
+ * Copyright 2018, Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "../star_common.h"
+#include "../geiger.h"
+#include "../MS5607.h"
+#include "../flightlog.h"
+
+// What to do with the QFF
+#define QFF_RECORDED  0         // Use the one in the log header
+#define QFF_GIVEN     1         // -Q
+#define QFF_STATION   2         // -q, worked out from the first reading
+
+static int qffMode = QFF_RECORDED;
+static float qff;
+static float latitude, elevation, height;
+
+// Dose rate window, seconds
+static int window = 60;
+
+// Reprocessed flight log, if -o was given, in segments of missionHours
+static struct flightlog out;
+static int missionHours = 4;
+static char *outPrefix = NULL;
+static bool outOpen = false;
+
+// Where we are in the flight
+static bool started = false;
+static double lastElapsed;
+static unsigned long records, changed, bad;
+
+
+/*
+ * startRun: Begins counting again from second zero of a run, as STAR
+ *           does at startup and after a POST
+ *****************************************************************************
+ */
+
+static void startRun(void) {
+  clockSetVirtual(0);
+  geigerReset();
+}
+
+/*
+ * setup: Sets up the altimeter calculations from the first header, and
+ *        opens the reprocessed log if one was asked for
+ *        Returns -1 if the log can't be opened
+ *****************************************************************************
+ */
+
+static int setup(const struct flightlog_header *hdr, const struct flightlog_record *first) {
+  struct flightlog_header outHdr;
+  int c[8];
+
+  setAltimeterCalibration(hdr->C);
+
+  if (qffMode == QFF_RECORDED)
+    qff = hdr->qff;
+  else if (qffMode == QFF_STATION)
+    qff = calcQFF(first->T, first->P, latitude, elevation, height);
+  setQFFValue(qff);
+
+  fprintf(stderr, "QFF = %f (recorded %f), dose rate over %d s, %s dead time\n", getQFF(), hdr->qff, window, deadTimeModelName(getDeadTimeModel()));
+
+  if (outPrefix != NULL) {
+    for (int i = 0; i < 8; i++) {
+      c[i] = hdr->C[i];
+    }
+    flightlogHeader(&outHdr, c, getQFF(), hdr->started);
+    if (flightlogOpen(&out, outPrefix, &outHdr, missionHours * 3600L) < 0) {
+      fprintf(stderr, "Can't open %s!\n", outPrefix);
+      return -1;
+    }
+    outOpen = true;
+  }
+
+  fprintf(stdout, "%s\n", hdr->started);
+  fprintf(stdout, "Elapsed, Counts, T (Raw), T1 (C), P (Raw), P1 (mbar), P2 (mbar), Altitude (m), Dead Time (s), Dead Time Counts, Flags, Dose Rate (uSv/h), Corrected Dose Rate (uSv/h)\n");
+
+  return 0;
+}
+
+/*
+ * reprocessSecond: Runs one recorded second through the pipeline
+ *****************************************************************************
+ */
+
+static void reprocessSecond(struct data_second *data) {
+  struct altimeter_sample s;
+  long curSec = data->elapsed;
+  float dose = -1.0, corrected = -1.0;
+
+  // Elapsed went backwards, so the run was started over.  STAR used
+  // to do this at the end of every POST.
+  if (data->elapsed < lastElapsed)
+    startRun();
+  lastElapsed = data->elapsed;
+
+  // The main loop recorded the second before the one it woke up in
+  clockSetVirtual(llround(data->elapsed * 1e9));
+  if ((data->flags & DATA_HV_ON) && (curSec > 0)) {
+    geigerAddCounts((curSec - 1) * 1000000000ULL, data->counts, data->deadCounts, data->deadTime);
+    dose = cpmTouSv(window);
+    corrected = cpmTouSvCorrected(window);
+  }
+
+  // Until the altimeter has a sample, everything is recorded as zero
+  if ((data->T != 0) || (data->P != 0)) {
+    altimeterConvert(data->T, data->P, &s);
+
+    if ((s.T1 != data->T1) || (s.P1 != data->P1) || (s.P2 != data->P2) || (s.altitude != data->altitude))
+      changed++;
+
+    data->T1 = s.T1;
+    data->P1 = s.P1;
+    data->P2 = s.P2;
+    data->altitude = s.altitude;
+  }
+
+  fprintf(stdout, "%lf, %d, %ld, %lf, %ld, %lf, %lf, %f, %lf, %d, %u, %f, %f\n", data->elapsed, data->counts, data->T, data->T1, data->P, data->P1, data->P2, data->altitude, data->deadTime, data->deadCounts, data->flags, dose, corrected);
+
+  if (outOpen)
+    flightlogWrite(&out, data);
+
+  records++;
+}
+
+/*
+ * reprocess: Runs every record of one segment through the pipeline
+ *            Returns -1 if it isn't a flight log we can read
+ *****************************************************************************
+ */
+
+static int reprocess(const char *fname) {
+  struct flightlog_header hdr;
+  struct flightlog_record rec;
+  struct data_second data;
+  FILE *in;
+
+  if ((in = fopen(fname, "rb")) == NULL) {
+    fprintf(stderr, "Can't open %s!\n", fname);
+    return -1;
+  }
+
+  if ((fread(&hdr, sizeof(hdr), 1, in) != 1) || !flightlogHeaderValid(&hdr)) {
+    fprintf(stderr, "%s is not a STAR flight log (or is a version we can't read)\n", fname);
+    fclose(in);
+    return -1;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, in) == 1) {
+    if (!flightlogRecordValid(&rec)) {
+      bad++;
+      continue;
+    }
+
+    if (!started) {
+      if (setup(&hdr, &rec) < 0) {
+        fclose(in);
+        return -1;
+      }
+      startRun();
+      started = true;
+    }
+
+    flightlogToData(&rec, &data);
+    reprocessSecond(&data);
+  }
+
+  fclose(in);
+
+  return 0;
+}
+
+int main (int argc, char *argv[]) {
+  int result = EXIT_SUCCESS;
+  unsigned long long start = getTimeMS();  // Wall clock, getTimeNS() is virtual
+  int opt;
+
+  while ((opt = getopt(argc, argv, "Q:q:w:o:m:d:")) != -1) {
+    switch (opt) {
+    case 'Q': qffMode = QFF_GIVEN; qff = atof(optarg); break;    // QFF, mbar
+    case 'q':                                                   // Station to work out the QFF for
+      if (sscanf(optarg, "%f,%f,%f", &latitude, &elevation, &height) != 3) {
+        fprintf(stderr, "Station must be given as latitude,elevation,height\n");
+        exit(EXIT_FAILURE);
+      }
+      qffMode = QFF_STATION;
+      break;
+    case 'w': window = atoi(optarg); break;                     // Dose rate window, seconds
+    case 'o': outPrefix = optarg; break;                        // Write a reprocessed log
+    case 'm': missionHours = atoi(optarg); break;               // Hours per segment of it
+    case 'd':                                                   // Dead time model
+      if (optarg[0] == 'p')
+        setDeadTimeModel(DEADTIME_PARALYZABLE);
+      else if (optarg[0] == 'n')
+        setDeadTimeModel(DEADTIME_NONPARALYZABLE);
+      else {
+        fprintf(stderr, "Unknown dead time model %s, try paralyzable or nonparalyzable\n", optarg);
+        fprintf(stderr, "Usage: %s [-Q qff] [-q latitude,elevation,height] [-w seconds] [-o prefix] [-m hours] [-d model] <segment>...\n", argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-Q qff] [-q latitude,elevation,height] [-w seconds] [-o prefix] [-m hours] [-d model] <segment>...\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if ((optind >= argc) || (missionHours < 1)) {
+    fprintf(stderr, "Usage: %s [-Q qff] [-q latitude,elevation,height] [-w seconds] [-o prefix] [-m hours] [-d model] <segment>...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Counts are fed in by hand, nothing is read from the pin
+  geigerSetCapture(GEIGER_CAPTURE_OFFLINE, NULL);
+  geigerSetup();
+
+  for (int i = optind; i < argc; i++) {
+    if (reprocess(argv[i]) < 0)
+      result = EXIT_FAILURE;
+  }
+
+  if (outOpen)
+    flightlogClose(&out);
+
+  fprintf(stderr, "%lu records in %.3f s, %lu failed their CRC, %lu changed from the recording\n", records, (getTimeMS() - start) / 1000.0, bad, changed);
+
+  return result;
+}
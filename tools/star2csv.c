@@ -0,0 +1,103 @@
+/*
+ *****************************************************************************
+ * star2csv.c:  Converts a STAR binary flight log to the CSV that STAR
+ *              used to write directly.
+ *
+ *              Usage: star2csv counts_<stamp>_*.bin > counts_<stamp>.txt
+ *
+ *              Segments are converted in the order given, with a single
+ *              CSV header from the first one.
+ *
+ * Copyright 2018, Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "../flightlog.h"
+
+
+/*
+ * convert: Writes the records of one segment as CSV
+ *          Returns -1 if it isn't a flight log we can read
+ *****************************************************************************
+ */
+
+static int convert(const char *fname, bool first) {
+  struct flightlog_header hdr;
+  struct flightlog_record rec;
+  struct data_second data;
+  unsigned long good = 0, bad = 0;
+  FILE *in;
+
+  if ((in = fopen(fname, "rb")) == NULL) {
+    fprintf(stderr, "Can't open %s!\n", fname);
+    return -1;
+  }
+
+  if ((fread(&hdr, sizeof(hdr), 1, in) != 1) || !flightlogHeaderValid(&hdr)) {
+    fprintf(stderr, "%s is not a STAR flight log (or is a version we can't read)\n", fname);
+    fclose(in);
+    return -1;
+  }
+
+  fprintf(stderr, "%s: started %s, QFF = %f\n", fname, hdr.started, hdr.qff);
+  fprintf(stderr, "%s: C", fname);
+  for (int i = 0; i < 8; i++) {
+    fprintf(stderr, " %d = %u", i, hdr.C[i]);
+  }
+  fprintf(stderr, "\n");
+
+  if (first) {
+    fprintf(stdout, "%s\n", hdr.started);
+    fprintf(stdout, "Elapsed, Counts, T (Raw), T1 (C), P (Raw), P1 (mbar), P2 (mbar), Altitude (m), Dead Time (s), Dead Time Counts, Flags\n");
+  }
+
+  // Records are fixed size, so a bad one can just be skipped.  A short
+  // one at the end is a write that was cut off.
+  while (fread(&rec, sizeof(rec), 1, in) == 1) {
+    if (!flightlogRecordValid(&rec)) {
+      bad++;
+      continue;
+    }
+    good++;
+
+    flightlogToData(&rec, &data);
+    fprintf(stdout, "%lf, %d, %ld, %lf, %ld, %lf, %lf, %f, %lf, %d, %u\n", data.elapsed, data.counts, data.T, data.T1, data.P, data.P1, data.P2, data.altitude, data.deadTime, data.deadCounts, data.flags);
+  }
+
+  fprintf(stderr, "%s: %lu records, %lu failed their CRC\n", fname, good, bad);
+  fclose(in);
+
+  return 0;
+}
+
+int main (int argc, char *argv[]) {
+  int result = EXIT_SUCCESS;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <flight log segment>...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 1; i < argc; i++) {
+    if (convert(argv[i], i == 1) < 0)
+      result = EXIT_FAILURE;
+  }
+
+  return result;
+}
@@ -0,0 +1,103 @@
+/*
+ *****************************************************************************
+ * tlmrecv.c:  Receives STAR telemetry frames and writes them out as CSV,
+ *             the same as star2csv, with the counts in every 100 ms
+ *             after each second.
+ *
+ *             Usage: tlmrecv [port] > telemetry.txt
+ *
+ *             Frames that were lost on the way, or never sent because
+ *             the link was down, are reported as they're noticed.
+ *
+ * Copyright 2018, Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "../telemetry.h"
+
+int main (int argc, char *argv[]) {
+  struct telemetry_frame frame;
+  struct sockaddr_in6 addr;
+  struct data_second data;
+  unsigned long frames = 0, bad = 0, lost = 0;
+  uint32_t nextSeq = 0, unsent = 0;
+  int port = (argc > 1) ? atoi(argv[1]) : 7607;
+  int fd, off = 0;
+  ssize_t len;
+
+  if ((fd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) {
+    fprintf(stderr, "Can't open a socket!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Take IPv4 as well
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "Can't listen on port %d!\n", port);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(stderr, "Listening on port %d\n", port);
+  fprintf(stdout, "Elapsed, Counts, T (Raw), T1 (C), P (Raw), P1 (mbar), P2 (mbar), Altitude (m), Dead Time (s), Dead Time Counts, Flags");
+  for (int i = 0; i < TELEMETRY_TENTHS; i++) {
+    fprintf(stdout, ", Counts %d.%d s", i / 10, i % 10);
+  }
+  fprintf(stdout, "\n");
+
+  while ((len = recv(fd, &frame, sizeof(frame), 0)) >= 0) {
+    if (!telemetryFrameValid(&frame, len)) {
+      bad++;
+      continue;
+    }
+    frames++;
+
+    // Anything between the last frame and this one went missing
+    if ((frames > 1) && (frame.hdr.seq != nextSeq)) {
+      lost += frame.hdr.seq - nextSeq;
+      fprintf(stderr, "Frames %u to %u missing, %u of them never sent\n", nextSeq, frame.hdr.seq - 1, frame.hdr.unsent - unsent);
+    }
+    nextSeq = frame.hdr.seq + 1;
+    unsent = frame.hdr.unsent;
+
+    for (int i = 0; i < frame.hdr.count; i++) {
+      flightlogToData(&frame.secs[i].rec, &data);
+      fprintf(stdout, "%lf, %d, %ld, %lf, %ld, %lf, %lf, %f, %lf, %d, %u", data.elapsed, data.counts, data.T, data.T1, data.P, data.P1, data.P2, data.altitude, data.deadTime, data.deadCounts, data.flags);
+      // Tenths that were lost read as -1, like counts with HV off
+      for (int j = 0; j < TELEMETRY_TENTHS; j++) {
+        if (frame.secs[i].flags & TELEMETRY_NO_TENTHS)
+          fprintf(stdout, ", -1");
+        else
+          fprintf(stdout, ", %u", frame.secs[i].tenths[j]);
+      }
+      fprintf(stdout, "\n");
+    }
+    fflush(stdout);
+  }
+
+  fprintf(stderr, "%lu frames, %lu bad, %lu lost\n", frames, bad, lost);
+
+  return EXIT_SUCCESS;
+}
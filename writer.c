@@ -0,0 +1,350 @@
+/*
+ *****************************************************************************
+ * writer.c:  queue of finished seconds, drained to disk, console and
+ *            telemetry by a thread of its own.
+ *
+ *            The main loop only ever copies a record into the queue, so
+ *            a slow SD card or a blocked terminal can't make it late.
+ *            If the writer falls a whole queue behind, new records are
+ *            dropped (and counted) rather than making the main loop wait.
+ *            Lines for the error log go the same way, see writerOpenLog().
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "realtime.h"
+#include "latency.h"
+#include "star_common.h"
+#include "writer.h"
+
+static struct writer_sink sinks[WRITER_MAX_SINKS];
+static int numSinks = 0;
+
+static struct writer_record queue[WRITER_QUEUE];
+static int head = 0;                // Next slot to fill
+static int depth = 0;               // Records waiting
+static struct writer_stats stats;
+
+// Error log text waiting to be written to logTo, see writerOpenLog()
+static char logText[WRITER_LOG_BYTES];
+static char logOut[WRITER_LOG_BYTES]; // The writer thread's copy
+static size_t logLen = 0;
+static FILE *logTo = NULL;
+
+static int flushEvery = 1;          // Records between flushes, guarded by lock_queue
+static bool running = false;
+static pthread_t writer_id;
+
+pthread_mutex_t lock_queue;         // Guards the queue and stats
+pthread_cond_t queue_ready;         // Signalled when there is work
+
+
+/*
+ * writerAddSink: Adds somewhere for records to go.  Only before
+ *                writerStart().
+ *                Returns -1 if there is no room for another sink
+ *****************************************************************************
+ */
+
+int writerAddSink(const char *name, int (*write)(void *, const struct writer_record *), int (*flush)(void *), void *ctx) {
+  if (running || (numSinks == WRITER_MAX_SINKS))
+    return -1;
+
+  sinks[numSinks].name = name;
+  sinks[numSinks].write = write;
+  sinks[numSinks].flush = flush;
+  sinks[numSinks].ctx = ctx;
+  sinks[numSinks].errors = 0;
+  numSinks++;
+
+  return 0;
+}
+
+/*
+ * logCookieWrite: Queues error log text for the writer thread.  What
+ *                 doesn't fit is dropped and counted, never waited for.
+ *****************************************************************************
+ */
+
+static ssize_t logCookieWrite(void *cookie, const char *buf, size_t size) {
+  size_t n;
+
+  pthread_mutex_lock(&lock_queue);
+
+  n = sizeof(logText) - logLen;
+  if (n > size)
+    n = size;
+  memcpy(logText + logLen, buf, n);
+  logLen += n;
+  stats.logDropped += size - n;
+  if (n > 0)
+    pthread_cond_signal(&queue_ready);
+
+  pthread_mutex_unlock(&lock_queue);
+
+  // Dropped text isn't an error the caller can do anything about
+  return size;
+}
+
+/*
+ * writerOpenLog: Opens a stream whose lines the writer thread writes to
+ *                to, so writing to it never waits on the disk.  Call after writerStart(), and stop using
+ *                it once writerStop() has written out the last of it.
+ *                Returns NULL if there is an error
+ *****************************************************************************
+ */
+
+FILE *writerOpenLog(FILE *to) {
+  cookie_io_functions_t io = { NULL, logCookieWrite, NULL, NULL };
+  FILE *f;
+
+  if ((f = fopencookie(NULL, "w", io)) == NULL)
+    return NULL;
+
+  // Hand each line over as soon as it's finished
+  setvbuf(f, NULL, _IOLBF, 0);
+
+  pthread_mutex_lock(&lock_queue);
+  logTo = to;
+  pthread_mutex_unlock(&lock_queue);
+
+  return f;
+}
+
+/*
+ * flushSinks: Flushes every sink that can be
+ *****************************************************************************
+ */
+
+static unsigned long flushSinks(void) {
+  unsigned long errors = 0;
+
+  for (int i = 0; i < numSinks; i++) {
+    if ((sinks[i].flush != NULL) && (sinks[i].flush(sinks[i].ctx) < 0)) {
+      sinks[i].errors++;
+      errors++;
+    }
+  }
+
+  return errors;
+}
+
+/*
+ * writerThread: Hands each record to every sink, oldest first
+ *****************************************************************************
+ */
+
+static void *writerThread(void *vargp) {
+  struct writer_record rec;
+  unsigned long errors;
+  unsigned long long start;
+  int sinceFlush = 0;
+  int every;
+  size_t len;
+  FILE *to;
+
+  rtApply(RT_WRITER);
+
+  pthread_mutex_lock(&lock_queue);
+  while (true) {
+    while ((depth == 0) && (logLen == 0) && running) {
+      pthread_cond_wait(&queue_ready, &lock_queue);
+    }
+
+    // Only stop once everything has been written
+    if ((depth == 0) && (logLen == 0))
+      break;
+
+    // Log lines are few and far between, write them out straight away
+    if (logLen > 0) {
+      len = logLen;
+      memcpy(logOut, logText, len);
+      logLen = 0;
+      to = logTo;
+      pthread_mutex_unlock(&lock_queue);
+
+      if (to != NULL) {
+        fwrite(logOut, 1, len, to);
+        fflush(to);
+      }
+
+      pthread_mutex_lock(&lock_queue);
+      continue;
+    }
+
+    rec = queue[(head - depth + WRITER_QUEUE) % WRITER_QUEUE];
+    depth--;
+    every = flushEvery;
+    pthread_mutex_unlock(&lock_queue);
+
+    // The slow part, without holding anything
+    errors = 0;
+    start = getTimeNS();
+    for (int i = 0; i < numSinks; i++) {
+      if (sinks[i].write(sinks[i].ctx, &rec) < 0) {
+        sinks[i].errors++;
+        errors++;
+      }
+    }
+    latRecord(LAT_WRITE, getTimeNS() - start);
+
+    if (++sinceFlush >= every) {
+      start = getTimeNS();
+      errors += flushSinks();
+      latRecord(LAT_SYNC, getTimeNS() - start);
+      sinceFlush = 0;
+    }
+
+    pthread_mutex_lock(&lock_queue);
+    stats.written++;
+    stats.errors += errors;
+  }
+  pthread_mutex_unlock(&lock_queue);
+
+  // Whatever is left over
+  errors = flushSinks();
+  pthread_mutex_lock(&lock_queue);
+  stats.errors += errors;
+  pthread_mutex_unlock(&lock_queue);
+
+  pthread_exit(NULL);
+}
+
+/*
+ * writerStart: Starts the writer thread.  Sinks are flushed every
+ *              flushEvery records.
+ *              Returns -1 if there is an error
+ *****************************************************************************
+ */
+
+int writerStart(int every) {
+  pthread_mutex_init(&lock_queue, NULL);
+  pthread_cond_init(&queue_ready, NULL);
+
+  head = 0;
+  depth = 0;
+  logLen = 0;
+  memset(&stats, 0, sizeof(stats));
+  flushEvery = (every < 1) ? 1 : every;
+  running = true;
+
+  // Joinable, so stopping can wait for the queue to drain
+  if (pthread_create(&writer_id, NULL, writerThread, NULL) != 0) {
+    running = false;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * writerSetFlushEvery: Changes how many records go between flushes.  A
+ *                      shorter wait than what has built up since the last
+ *                      flush takes effect with the next record.
+ *****************************************************************************
+ */
+
+void writerSetFlushEvery(int every) {
+  pthread_mutex_lock(&lock_queue);
+  flushEvery = (every < 1) ? 1 : every;
+  pthread_mutex_unlock(&lock_queue);
+}
+
+/*
+ * writerGetFlushEvery: How many records go between flushes
+ *****************************************************************************
+ */
+
+int writerGetFlushEvery(void) {
+  int every;
+
+  pthread_mutex_lock(&lock_queue);
+  every = flushEvery;
+  pthread_mutex_unlock(&lock_queue);
+
+  return every;
+}
+
+/*
+ * writerPush: Queues a record without waiting for it to be written
+ *             Returns false if the queue is full and it was dropped
+ *****************************************************************************
+ */
+
+bool writerPush(const struct writer_record *rec) {
+  bool result = true;
+
+  pthread_mutex_lock(&lock_queue);
+
+  if (!running || (depth == WRITER_QUEUE)) {
+    stats.dropped++;
+    result = false;
+  }
+  else {
+    queue[head] = *rec;
+    head = (head + 1) % WRITER_QUEUE;
+    depth++;
+    stats.pushed++;
+    if (depth > stats.maxDepth)
+      stats.maxDepth = depth;
+    pthread_cond_signal(&queue_ready);
+  }
+
+  pthread_mutex_unlock(&lock_queue);
+
+  return result;
+}
+
+/*
+ * writerStop: Writes out whatever is queued, flushes every sink and
+ *             stops the writer thread
+ *****************************************************************************
+ */
+
+void writerStop(void) {
+  pthread_mutex_lock(&lock_queue);
+  if (!running) {
+    pthread_mutex_unlock(&lock_queue);
+    return;
+  }
+  running = false;
+  pthread_cond_signal(&queue_ready);
+  pthread_mutex_unlock(&lock_queue);
+
+  // The lock is left alone so the final stats can still be read
+  pthread_join(writer_id, NULL);
+}
+
+/*
+ * writerGetStats: Copies how the queue is holding up
+ *****************************************************************************
+ */
+
+void writerGetStats(struct writer_stats *out) {
+  pthread_mutex_lock(&lock_queue);
+  *out = stats;
+  out->depth = depth;
+  pthread_mutex_unlock(&lock_queue);
+}
@@ -0,0 +1,73 @@
+/*
+ *****************************************************************************
+ * writer.h:  queue of finished seconds, drained to disk, console and
+ *            telemetry by a thread of its own.
+ *
+ * Copyright 2018 by Catherine Nicoloff, GNU GPL-3.0-or-later
+ *****************************************************************************
+ * This file is part of STAR.
+ *
+ * STAR is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * STAR is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with STAR.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "star_data.h"
+
+#define WRITER_QUEUE      64      // Seconds that can be waiting
+#define WRITER_LOG_BYTES  16384   // Error log text that can be waiting
+#define WRITER_MAX_SINKS  8
+
+// A finished second, and where it came from
+struct writer_record {
+  struct data_second data;
+  int secNum;             // Slot in the count history
+};
+
+// Somewhere records go.  write() is called for every record, flush()
+// (which may be NULL) every so often and when the writer stops.
+// Both return -1 if there is an error.
+struct writer_sink {
+  const char *name;
+  int (*write)(void *ctx, const struct writer_record *rec);
+  int (*flush)(void *ctx);
+  void *ctx;
+  unsigned long errors;   // Calls that returned -1
+};
+
+// How the queue is holding up
+struct writer_stats {
+  unsigned long pushed;   // Records accepted
+  unsigned long written;  // Records handed to every sink
+  unsigned long dropped;  // Records turned away because the queue was full
+  unsigned long errors;   // Sink calls that failed, all sinks
+  unsigned long logDropped; // Bytes of error log text turned away
+  int depth;              // Records waiting right now
+  int maxDepth;           // Most records ever waiting at once
+};
+
+int writerAddSink(const char *name, int (*write)(void *, const struct writer_record *), int (*flush)(void *), void *ctx);
+int writerStart(int flushEvery);
+void writerSetFlushEvery(int every);
+int writerGetFlushEvery(void);
+bool writerPush(const struct writer_record *rec);
+FILE *writerOpenLog(FILE *to);
+void writerStop(void);
+void writerGetStats(struct writer_stats *stats);
+
+#endif